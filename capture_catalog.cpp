@@ -0,0 +1,754 @@
+#include "capture_catalog.h"
+#include "photo_thumbs.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "ff.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <algorithm>
+
+#define CATALOG_MAGIC 0x54414352u   // "RCAT"
+#define CATALOG_VERSION 1
+#define CATALOG_TMP_PATH "/sdcard/.catalog.tmp"
+#define CATALOG_NEW_PATH "/sdcard/.catalog.new"
+#define CATALOG_FATFS_ROOT "0:"     // FatFs drive of the /sdcard mount (the only FAT volume)
+#define CATALOG_SCAN_DEPTH 4
+#define CATALOG_BATCH 64            // records per buffered read or write, 4 KB
+#define CATALOG_APPEND_BATCH 8      // records per write in catalog_appendBatch()
+#define CATALOG_SAME_SECOND 16      // records read per batch by catalog_lookup() after the time search
+
+struct CatalogHeader {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t record_size;
+  uint32_t count;       // records in the file, including removed ones at the front
+  uint32_t first;       // index of the oldest live record
+  uint32_t next_seq;
+  uint32_t reserved;
+  uint64_t bytes;       // total size of the live records
+};
+
+static_assert(sizeof(CatalogRecord) == 64, "catalog records are 64 bytes on the card");
+static_assert(sizeof(CatalogHeader) == 32, "catalog header is 32 bytes on the card");
+
+static int s_fd = -1;
+static CatalogHeader s_hdr;
+static CatalogRecord s_firstRec;    // cached ends, valid while there are live records
+static CatalogRecord s_lastRec;
+static uint32_t s_rebuilds = 0;
+static uint32_t s_rebuildMs = 0;
+static CatalogRetention s_retention;
+static uint32_t s_retired = 0;
+static uint64_t s_freeBytes = 0;
+static SemaphoreHandle_t s_lock = NULL;   // guards the file and everything above
+
+// ---------- records ----------
+static uint16_t record_check(const CatalogRecord &r) {
+  CatalogRecord c = r;
+  c.check = 0;
+  const uint8_t *p = (const uint8_t*)&c;
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < sizeof(c); ++i) h = (h ^ p[i]) * 16777619u;
+  return (uint16_t)(h ^ (h >> 16));
+}
+
+static void seal(CatalogRecord *r) {
+  r->check = record_check(*r);
+}
+
+static bool read_records(int fd, uint32_t index, CatalogRecord *out, size_t n) {
+  off_t at = sizeof(CatalogHeader) + (off_t)index * sizeof(CatalogRecord);
+  if (lseek(fd, at, SEEK_SET) != at) return false;
+  return read(fd, out, n * sizeof(CatalogRecord)) == (ssize_t)(n * sizeof(CatalogRecord));
+}
+
+static bool write_records(int fd, uint32_t index, const CatalogRecord *recs, size_t n) {
+  off_t at = sizeof(CatalogHeader) + (off_t)index * sizeof(CatalogRecord);
+  if (lseek(fd, at, SEEK_SET) != at) return false;
+  return write(fd, recs, n * sizeof(CatalogRecord)) == (ssize_t)(n * sizeof(CatalogRecord));
+}
+
+static bool write_header(int fd, const CatalogHeader &hdr) {
+  if (lseek(fd, 0, SEEK_SET) != 0) return false;
+  return write(fd, &hdr, sizeof(hdr)) == (ssize_t)sizeof(hdr);
+}
+
+static void init_header(CatalogHeader *hdr) {
+  memset(hdr, 0, sizeof(*hdr));
+  hdr->magic = CATALOG_MAGIC;
+  hdr->version = CATALOG_VERSION;
+  hdr->record_size = sizeof(CatalogRecord);
+  hdr->next_seq = 1;
+}
+
+static uint32_t live_count() {
+  return s_hdr.count - s_hdr.first;
+}
+
+// Re-read the cached first and last records after the ends moved.
+static bool refresh_ends() {
+  if (!live_count()) return true;
+  return read_records(s_fd, s_hdr.first, &s_firstRec, 1) &&
+         read_records(s_fd, s_hdr.count - 1, &s_lastRec, 1);
+}
+
+// "/sdcard/2025/01/02/x.jpg" -> "2025/01/02/x.jpg"
+static const char* relative_name(const char *path) {
+  if (strncmp(path, "/sdcard/", 8) == 0) path += 8;
+  while (*path == '/') path++;
+  return path;
+}
+
+static bool photo_exists(const CatalogRecord &r) {
+  char path[64];
+  snprintf(path, sizeof(path), "/sdcard/%s", r.name);
+  struct stat st;
+  return stat(path, &st) == 0;
+}
+
+// ---------- open and check (s_lock held) ----------
+static bool load() {
+  CatalogHeader hdr;
+  if (lseek(s_fd, 0, SEEK_SET) != 0 || read(s_fd, &hdr, sizeof(hdr)) != (ssize_t)sizeof(hdr)) return false;
+  if (hdr.magic != CATALOG_MAGIC || hdr.version != CATALOG_VERSION ||
+      hdr.record_size != sizeof(CatalogRecord) || hdr.first > hdr.count) {
+    Serial.println("catalog: bad header");
+    return false;
+  }
+  struct stat st;
+  if (fstat(s_fd, &st) != 0) return false;
+  off_t expected = sizeof(CatalogHeader) + (off_t)hdr.count * sizeof(CatalogRecord);
+  if (st.st_size < expected) {
+    Serial.printf("catalog: %ld bytes, header says %ld\n", (long)st.st_size, (long)expected);
+    return false;
+  }
+
+  // records appended before a reset that lost the header update
+  uint32_t adopted = 0;
+  while (expected + (off_t)sizeof(CatalogRecord) <= st.st_size) {
+    CatalogRecord r;
+    if (!read_records(s_fd, hdr.count, &r, 1) || r.check != record_check(r) || r.seq != hdr.next_seq) break;
+    hdr.count++;
+    hdr.next_seq++;
+    hdr.bytes += r.size;
+    expected += sizeof(CatalogRecord);
+    adopted++;
+  }
+  if (adopted && !write_header(s_fd, hdr)) return false;
+
+  s_hdr = hdr;
+  if (!refresh_ends()) return false;
+  if (live_count()) {
+    if (s_lastRec.check != record_check(s_lastRec) || s_firstRec.check != record_check(s_firstRec)) {
+      Serial.println("catalog: damaged record");
+      return false;
+    }
+    // photos deleted behind the catalog's back, e.g. with a card reader
+    if (!photo_exists(s_lastRec) || !photo_exists(s_firstRec)) {
+      Serial.println("catalog: out of step with the card");
+      return false;
+    }
+  }
+  if (adopted) Serial.printf("catalog: adopted %u records\n", (unsigned)adopted);
+  return true;
+}
+
+// ---------- rebuild ----------
+// Photo names carry the capture time, in either layout:
+//   YYYY/MM/DD/HHMMSS[_NN].jpg, YYYY/MM/DD/event_HHMMSS_NN.jpg
+//   capture_YYYYMMDD_HHMMSS[_NN].jpg, event_YYYYMMDD_HHMMSS_NN.jpg (flat)
+// NN orders the frames of one second.
+static bool parse_name_time(const char *rel, time_t *t, unsigned *sub) {
+  struct tm tm;
+  memset(&tm, 0, sizeof(tm));
+  int used = 0;
+  const char *rest;
+  if (sscanf(rel, "%4d/%2d/%2d/%n", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &used) == 3 && used == 11) {
+    const char *base = rel + used;
+    if (strncmp(base, "event_", 6) == 0) base += 6;
+    int hms = 0;
+    if (sscanf(base, "%2d%2d%2d%n", &tm.tm_hour, &tm.tm_min, &tm.tm_sec, &hms) != 3 || hms != 6) return false;
+    rest = base + hms;
+  } else {
+    const char *base = strrchr(rel, '/');
+    const char *p = strchr(base ? base + 1 : rel, '_');
+    if (!p || sscanf(p + 1, "%4d%2d%2d_%2d%2d%2d%n", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+                     &tm.tm_hour, &tm.tm_min, &tm.tm_sec, &used) != 6) {
+      return false;
+    }
+    rest = p + 1 + used;
+  }
+  tm.tm_year -= 1900;
+  tm.tm_mon -= 1;
+  tm.tm_isdst = -1;
+  *t = mktime(&tm);
+  *sub = *rest == '_' ? (unsigned)atoi(rest + 1) : 0;
+  return true;
+}
+
+static time_t fat_time(WORD fdate, WORD ftime) {
+  struct tm tm;
+  memset(&tm, 0, sizeof(tm));
+  tm.tm_year = (fdate >> 9) + 80;
+  tm.tm_mon = ((fdate >> 5) & 15) - 1;
+  tm.tm_mday = fdate & 31;
+  tm.tm_hour = ftime >> 11;
+  tm.tm_min = (ftime >> 5) & 63;
+  tm.tm_sec = (ftime & 31) * 2;
+  tm.tm_isdst = -1;
+  return mktime(&tm);
+}
+
+static bool is_photo(const char *name) {
+  size_t n = strlen(name);
+  return n > 4 && strcasecmp(name + n - 4, ".jpg") == 0;
+}
+
+// Scan state. Every record goes to the temp file in directory order; keys
+// hold (time, sub-second index, temp index) so sorting them orders the
+// photos without keeping the records in RAM: 8 bytes per photo.
+struct Scan {
+  int fd;
+  CatalogRecord *batch;
+  size_t batched;
+  uint32_t found;
+  uint64_t *keys;
+  size_t key_cap;
+  bool ok;
+};
+
+static void flush_scan(Scan *s) {
+  if (s->batched && !write_records(s->fd, s->found - s->batched, s->batch, s->batched)) s->ok = false;
+  s->batched = 0;
+}
+
+static void add_photo(Scan *s, const char *rel, const FILINFO &fi) {
+  if (s->found >= 0xFFFFFF) return;   // 24-bit index in the key
+  if (s->found == s->key_cap) {
+    size_t cap = s->key_cap ? s->key_cap * 2 : 1024;
+    uint64_t *keys = (uint64_t*)heap_caps_realloc(s->keys, cap * sizeof(uint64_t), MALLOC_CAP_SPIRAM);
+    if (!keys) keys = (uint64_t*)realloc(s->keys, cap * sizeof(uint64_t));
+    if (!keys) {
+      s->ok = false;
+      return;
+    }
+    s->keys = keys;
+    s->key_cap = cap;
+  }
+  CatalogRecord &r = s->batch[s->batched];
+  memset(&r, 0, sizeof(r));
+  strlcpy(r.name, rel, sizeof(r.name));
+  r.size = (uint32_t)fi.fsize;
+  time_t t;
+  unsigned sub = 0;
+  if (!parse_name_time(rel, &t, &sub)) t = fat_time(fi.fdate, fi.ftime);
+  r.time = t;
+  s->keys[s->found] = ((uint64_t)(uint32_t)t << 32) | ((uint64_t)(sub & 0xFF) << 24) | s->found;
+  s->found++;
+  if (++s->batched == CATALOG_BATCH) flush_scan(s);
+}
+
+// rel is the directory relative to /sdcard, "" for the root
+static void scan_dir(Scan *s, const char *rel, int depth) {
+  char fat_path[96];
+  snprintf(fat_path, sizeof(fat_path), "%s/%s", CATALOG_FATFS_ROOT, rel);
+  FF_DIR dir;
+  if (f_opendir(&dir, fat_path) != FR_OK) return;
+  FILINFO fi;
+  while (s->ok && f_readdir(&dir, &fi) == FR_OK && fi.fname[0]) {
+    if (fi.fname[0] == '.' || (fi.fattrib & (AM_HID | AM_SYS))) continue;
+    char child[CATALOG_NAME_LEN + 8];
+    int n = snprintf(child, sizeof(child), "%s%s%s", rel, *rel ? "/" : "", fi.fname);
+    if (fi.fattrib & AM_DIR) {
+      if (depth < CATALOG_SCAN_DEPTH && n < (int)sizeof(child)) scan_dir(s, child, depth + 1);
+    } else if (is_photo(fi.fname)) {
+      if (n >= CATALOG_NAME_LEN) Serial.printf("catalog: name too long, skipped: %s\n", fi.fname);
+      else add_photo(s, child, fi);
+    }
+  }
+  f_closedir(&dir);
+}
+
+// The sequence a rebuild numbers from. Clients page and resume by sequence,
+// so it must not go back even when the old file failed its checks: take the
+// later of the old header's next_seq and the seq after its last sealed record.
+static uint32_t carried_seq() {
+  uint32_t next = s_hdr.magic == CATALOG_MAGIC ? s_hdr.next_seq : 1;
+  int fd = open(CATALOG_PATH, O_RDONLY);
+  if (fd < 0) return next;
+  CatalogHeader hdr;
+  struct stat st;
+  if (read(fd, &hdr, sizeof(hdr)) == (ssize_t)sizeof(hdr) && hdr.magic == CATALOG_MAGIC &&
+      hdr.record_size == sizeof(CatalogRecord)) {
+    next = std::max(next, hdr.next_seq);
+    CatalogRecord r;
+    if (fstat(fd, &st) == 0 && st.st_size >= (off_t)(sizeof(CatalogHeader) + sizeof(CatalogRecord))) {
+      uint32_t last = (st.st_size - sizeof(CatalogHeader)) / sizeof(CatalogRecord) - 1;
+      if (read_records(fd, last, &r, 1) && r.check == record_check(r)) next = std::max(next, r.seq + 1);
+    }
+  }
+  close(fd);
+  return next;
+}
+
+// Write the scanned records to CATALOG_NEW_PATH in key order, numbered from first_seq.
+static bool write_sorted(Scan *s, CatalogHeader *hdr, uint32_t first_seq) {
+  int out = open(CATALOG_NEW_PATH, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (out < 0) return false;
+  init_header(hdr);
+  hdr->next_seq = first_seq;
+  bool ok = write_header(out, *hdr);
+
+  // Directory order is mostly time order, so a window of CATALOG_BATCH temp
+  // records usually serves many keys in a row.
+  CatalogRecord *outbuf = s->batch;
+  CatalogRecord *window = outbuf + CATALOG_BATCH;
+  int64_t window_start = -1;
+  size_t queued = 0;
+  for (uint32_t i = 0; ok && i < s->found; ++i) {
+    uint32_t idx = s->keys[i] & 0xFFFFFF;
+    if (window_start < 0 || idx < window_start || idx >= window_start + CATALOG_BATCH) {
+      window_start = idx - idx % CATALOG_BATCH;
+      size_t n = std::min<size_t>(CATALOG_BATCH, s->found - window_start);
+      if (!read_records(s->fd, window_start, window, n)) ok = false;
+    }
+    CatalogRecord &r = outbuf[queued++];
+    r = window[idx - window_start];
+    r.seq = hdr->next_seq++;
+    seal(&r);
+    hdr->bytes += r.size;
+    hdr->count++;
+    if (queued == CATALOG_BATCH || i + 1 == s->found) {
+      if (!write_records(out, hdr->count - queued, outbuf, queued)) ok = false;
+      queued = 0;
+    }
+  }
+  if (ok) ok = write_header(out, *hdr) && fsync(out) == 0;
+  if (close(out) != 0) ok = false;
+  return ok;
+}
+
+// s_lock held; leaves s_fd open on the new catalog on success
+static bool rebuild_locked() {
+  int64_t t0 = esp_timer_get_time();
+  uint32_t first_seq = carried_seq();
+  if (s_fd >= 0) close(s_fd);
+  s_fd = -1;
+  Serial.println("catalog: rebuilding from a directory scan");
+
+  Scan s;
+  memset(&s, 0, sizeof(s));
+  s.ok = true;
+  // scan batch, then output batch + read window while sorting
+  s.batch = (CatalogRecord*)malloc(2 * CATALOG_BATCH * sizeof(CatalogRecord));
+  s.fd = open(CATALOG_TMP_PATH, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  bool ok = s.batch && s.fd >= 0;
+  if (ok) {
+    scan_dir(&s, "", 0);
+    flush_scan(&s);
+    ok = s.ok;
+  }
+  CatalogHeader hdr;
+  if (ok) {
+    std::sort(s.keys, s.keys + s.found);
+    ok = write_sorted(&s, &hdr, first_seq);
+  }
+  if (s.fd >= 0) close(s.fd);
+  unlink(CATALOG_TMP_PATH);
+  free(s.batch);
+  heap_caps_free(s.keys);
+
+  if (ok) {
+    // FatFs rename does not replace an existing file
+    unlink(CATALOG_PATH);
+    ok = rename(CATALOG_NEW_PATH, CATALOG_PATH) == 0;
+  }
+  if (ok) {
+    s_fd = open(CATALOG_PATH, O_RDWR);
+    s_hdr = hdr;
+    ok = s_fd >= 0 && refresh_ends();
+  }
+  s_rebuilds++;
+  s_rebuildMs = (uint32_t)((esp_timer_get_time() - t0) / 1000);
+  if (!ok) {
+    Serial.println("catalog: rebuild failed");
+    if (s_fd >= 0) close(s_fd);
+    s_fd = -1;
+    return false;
+  }
+  Serial.printf("catalog: %u photos, %llu bytes, rebuilt in %u ms\n", (unsigned)hdr.count,
+                (unsigned long long)hdr.bytes, (unsigned)s_rebuildMs);
+  return true;
+}
+
+// ---------- compaction (s_lock held) ----------
+// Copy the live records to a new file so the removed front stops costing
+// space. Sequence numbers are kept.
+static void compact_locked() {
+  uint32_t live = live_count();
+  int out = open(CATALOG_NEW_PATH, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (out < 0) return;
+  CatalogRecord *buf = (CatalogRecord*)malloc(CATALOG_BATCH * sizeof(CatalogRecord));
+  CatalogHeader hdr = s_hdr;
+  hdr.count = live;
+  hdr.first = 0;
+  bool ok = buf && write_header(out, hdr);
+  for (uint32_t i = 0; ok && i < live; i += CATALOG_BATCH) {
+    size_t n = std::min<uint32_t>(CATALOG_BATCH, live - i);
+    ok = read_records(s_fd, s_hdr.first + i, buf, n) && write_records(out, i, buf, n);
+  }
+  free(buf);
+  if (ok) ok = fsync(out) == 0;
+  if (close(out) != 0) ok = false;
+  if (!ok) {
+    unlink(CATALOG_NEW_PATH);
+    return;   // the old file is still good
+  }
+  close(s_fd);
+  unlink(CATALOG_PATH);
+  rename(CATALOG_NEW_PATH, CATALOG_PATH);
+  s_fd = open(CATALOG_PATH, O_RDWR);
+  if (s_fd < 0 || !load()) rebuild_locked();
+  Serial.printf("catalog: compacted to %u records\n", (unsigned)live);
+}
+
+// ---------- public API ----------
+bool catalog_begin() {
+  if (!s_lock) s_lock = xSemaphoreCreateMutex();
+  if (!s_lock) return false;
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  bool ok = s_fd >= 0;
+  if (!ok) {
+    s_fd = open(CATALOG_PATH, O_RDWR);
+    ok = s_fd >= 0 && load();
+    if (ok) Serial.printf("catalog: %u photos, %llu bytes\n", (unsigned)live_count(), (unsigned long long)s_hdr.bytes);
+    else ok = rebuild_locked();
+  }
+  xSemaphoreGive(s_lock);
+  return ok;
+}
+
+bool catalog_rebuild() {
+  if (!s_lock) return false;
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  bool ok = rebuild_locked();
+  xSemaphoreGive(s_lock);
+  return ok;
+}
+
+// Whether rel is one of the newest n live records (s_lock held).
+static bool listed_locked(const char *rel, const CatalogRecord *tail, size_t n) {
+  for (size_t i = 0; i < n; ++i) {
+    if (strcmp(tail[i].name, rel) == 0) return true;
+  }
+  return false;
+}
+
+size_t catalog_appendBatch(const CatalogEntry *entries, size_t n) {
+  if (!s_lock) return 0;
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  bool ok = s_fd >= 0;
+  // a rebuild that ran while the files were open has already listed them,
+  // as the newest records
+  CatalogRecord tail[CATALOG_APPEND_BATCH];
+  size_t tail_n = ok ? std::min<size_t>(std::min<size_t>(n, CATALOG_APPEND_BATCH), live_count()) : 0;
+  if (tail_n && !read_records(s_fd, s_hdr.count - tail_n, tail, tail_n)) tail_n = 0;
+
+  // records first, then the header once: a reset in between is repaired by load()
+  CatalogHeader hdr = s_hdr;
+  CatalogRecord recs[CATALOG_APPEND_BATCH];
+  CatalogRecord first;
+  size_t staged = 0, appended = 0, listed = 0;
+  for (size_t i = 0; ok && i < n; ++i) {
+    const char *rel = relative_name(entries[i].path);
+    if (strlen(rel) >= CATALOG_NAME_LEN) {
+      Serial.printf("catalog: name too long: %s\n", rel);
+      continue;
+    }
+    if (listed_locked(rel, tail, tail_n)) {
+      listed++;
+      continue;
+    }
+    CatalogRecord &r = recs[staged++];
+    memset(&r, 0, sizeof(r));
+    r.seq = hdr.next_seq++;
+    r.time = entries[i].when;
+    r.size = entries[i].size;
+    r.fingerprint = entries[i].fingerprint;
+    strlcpy(r.name, rel, sizeof(r.name));
+    seal(&r);
+    hdr.bytes += r.size;
+    if (!appended++) first = r;
+    if (staged == CATALOG_APPEND_BATCH || i + 1 == n) {
+      ok = write_records(s_fd, hdr.count, recs, staged);
+      hdr.count += staged;
+      staged = 0;
+    }
+  }
+  if (ok && staged) {   // the last entries were skipped
+    ok = write_records(s_fd, hdr.count, recs, staged);
+    hdr.count += staged;
+  }
+  if (ok && appended) ok = write_header(s_fd, hdr) && fsync(s_fd) == 0;
+  if (ok && appended) {
+    bool was_empty = live_count() == 0;
+    s_hdr = hdr;
+    if (was_empty) s_firstRec = first;
+    ok = read_records(s_fd, s_hdr.count - 1, &s_lastRec, 1);
+  }
+  if (!ok && s_fd >= 0) Serial.printf("catalog: append of %u records failed\n", (unsigned)n);
+  xSemaphoreGive(s_lock);
+  return ok ? appended + listed : 0;
+}
+
+bool catalog_append(const char *path, time_t when, uint32_t size, uint32_t fingerprint) {
+  CatalogEntry e = { path, when, size, fingerprint };
+  return catalog_appendBatch(&e, 1) == 1;
+}
+
+bool catalog_rename(uint32_t seq, const char *path) {
+  if (!s_lock) return false;
+  const char *rel = relative_name(path);
+  if (strlen(rel) >= CATALOG_NAME_LEN) return false;
+
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  bool ok = s_fd >= 0 && live_count() && seq >= s_firstRec.seq && seq <= s_lastRec.seq;
+  if (ok) {
+    uint32_t index = s_hdr.first + (seq - s_firstRec.seq);
+    CatalogRecord r;
+    ok = read_records(s_fd, index, &r, 1) && r.seq == seq;
+    if (ok) {
+      memset(r.name, 0, sizeof(r.name));
+      strlcpy(r.name, rel, sizeof(r.name));
+      seal(&r);
+      ok = write_records(s_fd, index, &r, 1);
+      if (ok && seq == s_firstRec.seq) s_firstRec = r;
+      if (ok && seq == s_lastRec.seq) s_lastRec = r;
+    }
+  }
+  xSemaphoreGive(s_lock);
+  return ok;
+}
+
+size_t catalog_count() {
+  if (!s_lock) return 0;
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  size_t n = s_fd >= 0 ? live_count() : 0;
+  xSemaphoreGive(s_lock);
+  return n;
+}
+
+size_t catalog_read(size_t pos, CatalogRecord *out, size_t n) {
+  if (!s_lock) return 0;
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  size_t live = s_fd >= 0 ? live_count() : 0;
+  if (pos >= live) n = 0;
+  else if (n > live - pos) n = live - pos;
+  if (n && !read_records(s_fd, s_hdr.first + pos, out, n)) n = 0;
+  xSemaphoreGive(s_lock);
+  return n;
+}
+
+// Position of the first live record with seq >= seq (s_lock held).
+static size_t find_seq_locked(uint32_t seq) {
+  size_t live = s_fd >= 0 ? live_count() : 0;
+  if (!live || seq <= s_firstRec.seq) return 0;
+  if (seq <= s_lastRec.seq) return seq - s_firstRec.seq;   // sequences have no gaps
+  return live;
+}
+
+// Position of the first record taken at or after t (s_lock held).
+static size_t find_time_locked(time_t t) {
+  size_t lo = 0, hi = s_fd >= 0 ? live_count() : 0;
+  // about 16 probes of one record each at 50k photos
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    CatalogRecord r;
+    if (!read_records(s_fd, s_hdr.first + mid, &r, 1)) break;
+    if (r.time < t) lo = mid + 1;
+    else hi = mid;
+  }
+  return lo;
+}
+
+size_t catalog_findSeq(uint32_t seq) {
+  if (!s_lock) return 0;
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  size_t pos = find_seq_locked(seq);
+  xSemaphoreGive(s_lock);
+  return pos;
+}
+
+size_t catalog_findTime(time_t t) {
+  if (!s_lock) return 0;
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  size_t pos = find_time_locked(t);
+  xSemaphoreGive(s_lock);
+  return pos;
+}
+
+void catalog_findRange(uint32_t since, int64_t from, int64_t to, uint32_t *first, uint32_t *end) {
+  *first = *end = 0;
+  if (!s_lock) return;
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  size_t lo = since ? find_seq_locked(since + 1) : 0;
+  size_t hi = s_fd >= 0 ? live_count() : 0;
+  if (from >= 0) lo = std::max(lo, find_time_locked((time_t)from));
+  if (to >= 0) hi = std::min(hi, find_time_locked((time_t)(to + 1)));
+  if (hi < lo) hi = lo;
+  // position p holds sequence s_firstRec.seq + p; an empty catalog numbers on from next_seq
+  uint32_t base = s_fd >= 0 && live_count() ? s_firstRec.seq : s_hdr.next_seq;
+  *first = base + lo;
+  *end = base + hi;
+  xSemaphoreGive(s_lock);
+}
+
+size_t catalog_readSeq(uint32_t seq, CatalogRecord *out, size_t n) {
+  if (!s_lock) return 0;
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  size_t live = s_fd >= 0 ? live_count() : 0;
+  size_t pos = find_seq_locked(seq);
+  if (n > live - pos) n = live - pos;
+  if (n && !read_records(s_fd, s_hdr.first + pos, out, n)) n = 0;
+  xSemaphoreGive(s_lock);
+  return n;
+}
+
+bool catalog_lookup(const char *path, CatalogRecord *out) {
+  const char *rel = relative_name(path);
+  time_t t;
+  unsigned sub;
+  if (!parse_name_time(rel, &t, &sub)) return false;
+  // a burst or event shares one second (an event alone is 17 frames): read
+  // that second's records a batch at a time, by sequence so retention
+  // running in between cannot shift them
+  uint32_t seq, end;
+  catalog_findRange(0, t, t, &seq, &end);
+  CatalogRecord recs[CATALOG_SAME_SECOND];
+  while (seq < end) {
+    size_t n = catalog_readSeq(seq, recs, std::min<size_t>(CATALOG_SAME_SECOND, end - seq));
+    if (!n) return false;
+    for (size_t i = 0; i < n && recs[i].seq < end; ++i) {
+      if (strcmp(recs[i].name, rel) == 0) {
+        *out = recs[i];
+        return true;
+      }
+    }
+    seq = recs[n - 1].seq + 1;
+  }
+  return false;
+}
+
+// Free space on the card and its cluster size, from FatFs' free-cluster
+// count (kept up to date by FatFs once read, so this is cheap after boot).
+static bool card_free(uint64_t *free_bytes, uint32_t *cluster) {
+  DWORD clusters;
+  FATFS *fs;
+  if (f_getfree(CATALOG_FATFS_ROOT, &clusters, &fs) != FR_OK) return false;
+#if FF_MAX_SS != FF_MIN_SS
+  *cluster = (uint32_t)fs->csize * fs->ssize;
+#else
+  *cluster = (uint32_t)fs->csize * FF_MAX_SS;
+#endif
+  *free_bytes = (uint64_t)clusters * *cluster;
+  return true;
+}
+
+// Delete photos from the front until at least n have gone, their sizes add up
+// to at least bytes and they held at least space in whole clusters, keeping
+// the newest keep records. freed gets the space released (s_lock held).
+static size_t remove_front_locked(size_t n, uint64_t bytes, uint64_t space, uint32_t cluster,
+                                  size_t keep, uint64_t *freed) {
+  size_t removed = 0;
+  uint64_t gone = 0, released = 0;
+  CatalogRecord batch[16];
+  while (live_count() > keep && (removed < n || gone < bytes || released < space)) {
+    size_t k = std::min<size_t>(16, live_count() - keep);
+    if (!read_records(s_fd, s_hdr.first, batch, k)) break;
+    for (size_t i = 0; i < k && (removed < n || gone < bytes || released < space); ++i) {
+      char path[64];
+      snprintf(path, sizeof(path), "/sdcard/%s", batch[i].name);
+      Serial.printf("Removing old file: %s\n", path);
+      unlink(path);   // already gone is fine: the record goes either way
+      thumb_remove(path);
+      s_hdr.first++;
+      s_hdr.bytes -= batch[i].size;
+      gone += batch[i].size;
+      released += (batch[i].size + cluster - 1) / cluster * cluster;
+      removed++;
+    }
+  }
+  if (removed) {
+    write_header(s_fd, s_hdr);
+    fsync(s_fd);
+    refresh_ends();
+    if (s_hdr.first >= CATALOG_COMPACT_MIN && s_hdr.first >= live_count()) compact_locked();
+  }
+  if (freed) *freed = released;
+  return removed;
+}
+
+size_t catalog_removeOldest(size_t n) {
+  if (!s_lock) return 0;
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  size_t removed = s_fd >= 0 ? remove_front_locked(n, 0, 0, 1, 0, NULL) : 0;
+  xSemaphoreGive(s_lock);
+  return removed;
+}
+
+void catalog_setRetention(const CatalogRetention &limits) {
+  if (!s_lock) return;
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  s_retention = limits;
+  xSemaphoreGive(s_lock);
+}
+
+size_t catalog_enforceRetention() {
+  if (!s_lock) return 0;
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  size_t removed = 0;
+  if (s_fd >= 0) {
+    const CatalogRetention &r = s_retention;
+    size_t live = live_count();
+    size_t n = r.max_files && live > r.max_files ? live - r.max_files : 0;
+    uint64_t bytes = r.max_bytes && s_hdr.bytes > r.max_bytes ? s_hdr.bytes - r.max_bytes : 0;
+    uint64_t space = 0;
+    uint32_t cluster = 1;
+    bool measured = r.min_free && card_free(&s_freeBytes, &cluster);
+    if (measured && s_freeBytes < r.min_free) space = r.min_free - s_freeBytes;
+    if (n || bytes || space) {
+      uint64_t freed;
+      removed = remove_front_locked(n, bytes, space, cluster, 1, &freed);
+      s_retired += removed;
+      if (measured) s_freeBytes += freed;
+    }
+  }
+  xSemaphoreGive(s_lock);
+  return removed;
+}
+
+void catalog_getInfo(CatalogInfo *info) {
+  memset(info, 0, sizeof(*info));
+  if (!s_lock) return;
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  info->ready = s_fd >= 0;
+  if (info->ready) {
+    info->records = live_count();
+    info->bytes = s_hdr.bytes;
+    if (info->records) {
+      info->first_seq = s_firstRec.seq;
+      info->last_seq = s_lastRec.seq;
+      info->first_time = (time_t)s_firstRec.time;
+      info->last_time = (time_t)s_lastRec.time;
+    }
+  }
+  info->rebuilds = s_rebuilds;
+  info->rebuild_ms = s_rebuildMs;
+  info->retention = s_retention;
+  info->retired = s_retired;
+  info->free_bytes = s_freeBytes;
+  xSemaphoreGive(s_lock);
+}
@@ -0,0 +1,131 @@
+#ifndef CAPTURE_CATALOG_H
+#define CAPTURE_CATALOG_H
+
+#include <Arduino.h>
+#include "time.h"
+
+// Index of the photos on the SD card, so listing, search and retention never
+// walk the FAT directory. CATALOG_PATH holds a small header and one fixed-size
+// record per photo, oldest first. The capture writer appends the records of
+// each group of files it commits in one go; retention removes from the front
+// by moving the header's first-record index, and the dead front is compacted
+// away once it is more than half of the file.
+//
+// catalog_begin() checks the header against the file size, adopts records
+// whose header update was lost, and checks that the first and last files
+// still exist. Only when the catalog is missing or fails those checks is it
+// rebuilt from a directory scan (FatFs f_readdir, which returns sizes and
+// dates without a stat per file), sorted by capture time.
+//
+// Positions used below count live records from the oldest (0). Sequence
+// numbers increase by one per record, so a sequence maps straight to a
+// position; a rebuild numbers on from the old file's last sequence, so they
+// never go back while the catalog file survives. All calls are thread-safe.
+//
+// Retention works from the header's running totals (records, bytes) and the
+// FatFs free-cluster count, so deciding what to delete costs O(1) and
+// deleting k photos O(k), however many photos the card holds.
+
+#define CATALOG_PATH "/sdcard/.catalog"
+#define CATALOG_NAME_LEN 40          // path under /sdcard, including the terminator
+#define CATALOG_COMPACT_MIN 4096     // dead records before compaction is considered
+
+struct CatalogRecord {
+  uint32_t seq;
+  uint16_t flags;         // reserved, 0
+  uint16_t check;         // over the other fields; catches a torn append
+  int64_t time;           // capture time, from the name when rebuilt
+  uint32_t size;
+  uint32_t fingerprint;   // frame_fingerprint(), 0 for records rebuilt from a scan
+  char name[CATALOG_NAME_LEN];   // e.g. "2025/01/02/103000.jpg"
+};
+
+// Retention limits; 0 turns a limit off.
+struct CatalogRetention {
+  uint32_t max_files;
+  uint64_t max_bytes;     // total size of the photos
+  uint64_t min_free;      // free space to keep on the card
+};
+
+struct CatalogInfo {
+  bool ready;
+  uint32_t records;       // live records
+  uint64_t bytes;         // their total size
+  uint32_t first_seq;
+  uint32_t last_seq;
+  time_t first_time;
+  time_t last_time;
+  uint32_t rebuilds;      // since boot
+  uint32_t rebuild_ms;    // duration of the last rebuild
+  CatalogRetention retention;
+  uint32_t retired;       // photos deleted by retention since boot
+  uint64_t free_bytes;    // card free space when retention last looked, 0 if never
+};
+
+// Open the catalog, rebuilding it if needed. Call once the card is mounted.
+bool catalog_begin();
+
+// Rescan the card and replace the catalog.
+bool catalog_rebuild();
+
+// A committed photo. path is "/sdcard/..." or relative to /sdcard.
+struct CatalogEntry {
+  const char *path;
+  time_t when;
+  uint32_t size;
+  uint32_t fingerprint;
+};
+
+// Record committed photos, oldest first, with one header write and one
+// fsync for the lot. Returns how many are now in the catalog.
+size_t catalog_appendBatch(const CatalogEntry *entries, size_t n);
+
+// Record one committed photo.
+bool catalog_append(const char *path, time_t when, uint32_t size, uint32_t fingerprint);
+
+// Point the record with this sequence at a moved photo. Time order is kept.
+bool catalog_rename(uint32_t seq, const char *path);
+
+// Live records.
+size_t catalog_count();
+
+// Copy up to n records starting at position pos; returns how many were read.
+size_t catalog_read(size_t pos, CatalogRecord *out, size_t n);
+
+// Position of the first record with seq >= seq (catalog_count() if none).
+size_t catalog_findSeq(uint32_t seq);
+
+// Position of the first record taken at or after t (catalog_count() if none).
+// Assumes capture times increase; a clock stepped backwards only blurs the
+// answer around the step.
+size_t catalog_findTime(time_t t);
+
+// The sequences [*first, *end) of the records after since (0: from the
+// oldest) taken in [from, to] (Unix seconds, inclusive; < 0 leaves that end
+// open), resolved under one lock. Unlike positions, sequences stay valid
+// while retention removes records, so read the range with catalog_readSeq().
+void catalog_findRange(uint32_t since, int64_t from, int64_t to, uint32_t *first, uint32_t *end);
+
+// Copy up to n records starting at the first live one with seq >= seq,
+// resolved and read under one lock; returns how many were read. Records
+// removed since seq was found are skipped, so check the seq of each.
+size_t catalog_readSeq(uint32_t seq, CatalogRecord *out, size_t n);
+
+// Find the record of a photo by name ("/sdcard/..." or relative). Only
+// names with a capture time can be found: the time narrows the search to a
+// binary search plus the few photos of the same second.
+bool catalog_lookup(const char *path, CatalogRecord *out);
+
+// Delete the n oldest photos and drop their records. Returns how many went.
+size_t catalog_removeOldest(size_t n);
+
+void catalog_setRetention(const CatalogRetention &limits);
+
+// Delete the oldest photos until the catalog is within the retention limits;
+// the newest photo is always kept. The capture writer calls this once per
+// commit, so normally one photo goes per photo added. Returns how many went.
+size_t catalog_enforceRetention();
+
+void catalog_getInfo(CatalogInfo *info);
+
+#endif // CAPTURE_CATALOG_H
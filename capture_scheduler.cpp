@@ -0,0 +1,389 @@
+#include "capture_scheduler.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include <sys/time.h>
+#include <math.h>
+
+#define SCHED_CLOCK_RETRY_S 10
+#define SCHED_HOURLY_US 3600000000LL
+#define SCHED_SEARCH_MINUTES (2 * 24 * 60)
+
+enum SpecKind { SPEC_CRON, SPEC_SUNRISE, SPEC_SUNSET };
+
+struct Spec {
+  SpecKind kind;
+  uint64_t minutes;   // bit n: minute n (cron)
+  uint32_t hours;     // bit n: hour n (cron)
+  int16_t offset_min; // sunrise/sunset
+};
+
+static Spec s_specs[SCHED_MAX_SPECS];
+static size_t s_specCount = 0;
+static String s_specText;
+static SchedCatchup s_policy = SCHED_CATCHUP_ONE;
+static SchedCapture s_capture = NULL;
+static SchedMaintenance s_hourly = NULL;
+static SchedStats s_stats;
+static SemaphoreHandle_t s_lock = NULL;   // guards the specs, policy and stats
+static TaskHandle_t s_task = NULL;
+static esp_timer_handle_t s_timer = NULL;
+static time_t s_last = 0;                 // newest slot already handled
+static bool s_clockWasSet = false;
+static int64_t s_lastHourly = 0;
+
+static bool clock_is_set(time_t t) {
+  struct tm tm;
+  localtime_r(&t, &tm);
+  return tm.tm_year >= (2016 - 1900);
+}
+
+static int64_t now_ms() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+// ---------- spec parsing ----------
+// One cron field: "*", "*/n", "a", "a-b", "a-b/n", comma separated.
+static bool parse_field(const char *s, int lo, int hi, uint64_t *bits) {
+  *bits = 0;
+  while (*s) {
+    int from = lo, to = hi, step = 1;
+    char *end;
+    if (*s == '*') {
+      ++s;
+    } else {
+      from = to = strtol(s, &end, 10);
+      if (end == s) return false;
+      s = end;
+      if (*s == '-') {
+        to = strtol(s + 1, &end, 10);
+        if (end == s + 1) return false;
+        s = end;
+      }
+    }
+    if (*s == '/') {
+      step = strtol(s + 1, &end, 10);
+      if (end == s + 1 || step <= 0) return false;
+      s = end;
+    }
+    if (from < lo || to > hi || from > to) return false;
+    for (int v = from; v <= to; v += step) *bits |= 1ULL << v;
+    if (*s == ',') ++s;
+    else if (*s) return false;
+  }
+  return *bits != 0;
+}
+
+static bool parse_spec(const char *text, Spec *spec) {
+  while (*text == ' ') ++text;
+  const char *sun = NULL;
+  if (!strncmp(text, "sunrise", 7)) {
+    spec->kind = SPEC_SUNRISE;
+    sun = text + 7;
+  } else if (!strncmp(text, "sunset", 6)) {
+    spec->kind = SPEC_SUNSET;
+    sun = text + 6;
+  }
+  if (sun) {
+    char *end;
+    spec->offset_min = *sun ? strtol(sun, &end, 10) : 0;
+    if (*sun && (end == sun || *end)) return false;
+    return spec->offset_min > -720 && spec->offset_min < 720;
+  }
+
+  char minute[48], hour[48];
+  if (sscanf(text, "%47s %47s", minute, hour) != 2) return false;
+  uint64_t hours;
+  spec->kind = SPEC_CRON;
+  if (!parse_field(minute, 0, 59, &spec->minutes) || !parse_field(hour, 0, 23, &hours)) return false;
+  spec->hours = (uint32_t)hours;
+  return true;
+}
+
+// ---------- deadlines ----------
+// Days since 1970-01-01 for a civil date, and back (proleptic Gregorian).
+static int32_t days_from_civil(int y, unsigned m, unsigned d) {
+  y -= m <= 2;
+  int era = (y >= 0 ? y : y - 399) / 400;
+  unsigned yoe = (unsigned)(y - era * 400);
+  unsigned doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+  unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + (int32_t)doe - 719468;
+}
+
+static void civil_from_days(int32_t z, int *y, unsigned *m, unsigned *d) {
+  z += 719468;
+  int era = (z >= 0 ? z : z - 146096) / 146097;
+  unsigned doe = (unsigned)(z - era * 146097);
+  unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  unsigned mp = (5 * doy + 2) / 153;
+  *d = doy - (153 * mp + 2) / 5 + 1;
+  *m = mp < 10 ? mp + 3 : mp - 9;
+  *y = (int)yoe + era * 400 + (*m <= 2);
+}
+
+// Sunrise or sunset on a UTC day (NOAA approximation, about a minute).
+// Returns false during polar day or night.
+static bool sun_event(int32_t day, bool rise, time_t *out) {
+  int y;
+  unsigned m, d;
+  civil_from_days(day, &y, &m, &d);
+  int doy = day - days_from_civil(y, 1, 1);
+  double g = 2 * M_PI / 365.0 * doy;
+  double eqtime = 229.18 * (0.000075 + 0.001868 * cos(g) - 0.032077 * sin(g) -
+                            0.014615 * cos(2 * g) - 0.040849 * sin(2 * g));
+  double decl = 0.006918 - 0.399912 * cos(g) + 0.070257 * sin(g) - 0.006758 * cos(2 * g) +
+                0.000907 * sin(2 * g) - 0.002697 * cos(3 * g) + 0.00148 * sin(3 * g);
+  double lat = SCHED_LATITUDE * M_PI / 180;
+  double c = cos(90.833 * M_PI / 180) / (cos(lat) * cos(decl)) - tan(lat) * tan(decl);
+  if (c < -1 || c > 1) return false;
+  double ha = acos(c) * 180 / M_PI;
+  double minutes = 720 - 4 * (SCHED_LONGITUDE + (rise ? ha : -ha)) - eqtime;
+  *out = (time_t)day * 86400 + (time_t)lround(minutes * 60);
+  return true;
+}
+
+// First slot of spec strictly after t, or 0 if none within two days.
+static time_t next_slot(const Spec &spec, time_t t) {
+  if (spec.kind != SPEC_CRON) {
+    int32_t today = (int32_t)(t / 86400);
+    for (int32_t day = today - 1; day <= today + 2; ++day) {
+      time_t ev;
+      if (!sun_event(day, spec.kind == SPEC_SUNRISE, &ev)) continue;
+      ev += (time_t)spec.offset_min * 60;
+      if (ev > t) return ev;
+    }
+    return 0;
+  }
+  // local time is whole minutes off UTC, so minute boundaries line up
+  time_t c = t - t % 60 + 60;
+  for (int i = 0; i < SCHED_SEARCH_MINUTES; ) {
+    struct tm tm;
+    localtime_r(&c, &tm);
+    if (!(spec.hours & (1u << tm.tm_hour))) {
+      c += (time_t)(60 - tm.tm_min) * 60;   // skip to the next hour
+      i += 60 - tm.tm_min;
+      continue;
+    }
+    if (spec.minutes & (1ULL << tm.tm_min)) return c;
+    c += 60;
+    ++i;
+  }
+  return 0;
+}
+
+// Earliest slot of any spec strictly after t (s_lock held).
+static time_t next_any(time_t t) {
+  time_t best = 0;
+  for (size_t i = 0; i < s_specCount; ++i) {
+    time_t n = next_slot(s_specs[i], t);
+    if (n && (!best || n < best)) best = n;
+  }
+  return best;
+}
+
+// ---------- task ----------
+static void capture_slot(time_t slot, bool missed) {
+  int64_t start = now_ms();
+  s_capture(true);
+  int32_t jitter = (int32_t)(start - (int64_t)slot * 1000);
+  struct tm tm;
+  localtime_r(&slot, &tm);
+  Serial.printf("sched: %02d:%02d:%02d slot captured %+d ms from deadline%s\n",
+                tm.tm_hour, tm.tm_min, tm.tm_sec, (int)jitter, missed ? " (catch-up)" : "");
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  s_stats.captures++;
+  if (missed) {
+    s_stats.caught_up++;
+  } else {
+    s_stats.last_jitter_ms = jitter;
+    if (jitter > s_stats.max_jitter_ms) s_stats.max_jitter_ms = jitter;
+  }
+  xSemaphoreGive(s_lock);
+}
+
+static void run_due() {
+  time_t now = time(NULL);
+  if (!clock_is_set(now)) {
+    // keep the old behaviour: one numbered photo when the clock is lost
+    if (s_clockWasSet) {
+      s_clockWasSet = false;
+      s_capture(false);
+    }
+    return;
+  }
+  if (!s_clockWasSet) {
+    // the clock just became valid: start from now, do not catch up from 1970
+    s_clockWasSet = true;
+    s_last = now;
+    return;
+  }
+
+  // slots in (s_last, now]; the newest is on time if within the grace period
+  time_t recent[SCHED_CATCHUP_MAX + 1];
+  size_t due = 0;
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  SchedCatchup policy = s_policy;
+  for (time_t t = s_last; due < SCHED_SEARCH_MINUTES; ) {
+    time_t n = next_any(t);
+    if (!n || n > now) break;
+    recent[due % (SCHED_CATCHUP_MAX + 1)] = n;
+    ++due;
+    t = n;
+  }
+  xSemaphoreGive(s_lock);
+  s_last = now;
+  if (!due) return;
+
+  time_t newest = recent[(due - 1) % (SCHED_CATCHUP_MAX + 1)];
+  bool on_time = now_ms() - (int64_t)newest * 1000 <= SCHED_GRACE_MS;
+  size_t missed = due - (on_time ? 1 : 0);
+  if (missed) {
+    Serial.printf("sched: %u slot(s) missed, policy %d\n", (unsigned)missed, (int)policy);
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    s_stats.missed += missed;
+    xSemaphoreGive(s_lock);
+  }
+
+  if (policy == SCHED_CATCHUP_ALL && missed) {
+    size_t kept = missed < SCHED_CATCHUP_MAX ? missed : SCHED_CATCHUP_MAX;
+    for (size_t i = due - (on_time ? 1 : 0) - kept; i < due - (on_time ? 1 : 0); ++i) {
+      capture_slot(recent[i % (SCHED_CATCHUP_MAX + 1)], true);
+    }
+  } else if (policy == SCHED_CATCHUP_ONE && missed && !on_time) {
+    capture_slot(newest, true);
+  }
+  if (on_time) capture_slot(newest, false);
+}
+
+static void arm_next() {
+  time_t now = time(NULL);
+  int64_t delay_us = (int64_t)SCHED_CLOCK_RETRY_S * 1000000;
+  time_t next = 0;
+  if (clock_is_set(now)) {
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    next = next_any(s_last > now ? s_last : now);
+    xSemaphoreGive(s_lock);
+    delay_us = (int64_t)SCHED_MAX_SLEEP_S * 1000000;
+    if (next) {
+      int64_t until = ((int64_t)next * 1000 - now_ms()) * 1000;
+      if (until < delay_us) delay_us = until > 1000 ? until : 1000;
+    }
+  }
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  s_stats.next = next;
+  xSemaphoreGive(s_lock);
+  esp_timer_stop(s_timer);   // not running is fine
+  esp_timer_start_once(s_timer, delay_us);
+}
+
+static void timer_cb(void *arg) {
+  (void)arg;
+  xTaskNotifyGive(s_task);
+}
+
+static void sched_task(void *arg) {
+  (void)arg;
+  while (true) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    run_due();
+    if (s_hourly && esp_timer_get_time() - s_lastHourly >= SCHED_HOURLY_US) {
+      s_lastHourly = esp_timer_get_time();
+      s_hourly();
+    }
+    arm_next();
+  }
+}
+
+// ---------- public API ----------
+bool sched_begin(const char *specs, SchedCatchup policy, SchedCapture capture, SchedMaintenance hourly) {
+  if (s_task) return true;
+  s_lock = xSemaphoreCreateMutex();
+  if (!s_lock) return false;
+  memset(&s_stats, 0, sizeof(s_stats));
+  if (!sched_setSpecs(specs)) {
+    Serial.printf("sched: bad schedule \"%s\"\n", specs);
+    return false;
+  }
+  s_policy = policy;
+  s_capture = capture;
+  s_hourly = hourly;
+  s_lastHourly = esp_timer_get_time();  // setup() has just synced the clock
+
+  esp_timer_create_args_t args = {};
+  args.callback = timer_cb;
+  args.name = "sched";
+  if (esp_timer_create(&args, &s_timer) != ESP_OK ||
+      xTaskCreate(sched_task, "sched", 4096, NULL, 2, &s_task) != pdPASS) {
+    Serial.println("sched: failed to start");
+    return false;
+  }
+  sched_rearm();
+  return true;
+}
+
+bool sched_setSpecs(const char *specs) {
+  if (!s_lock) return false;
+  Spec parsed[SCHED_MAX_SPECS];
+  size_t count = 0;
+  const char *p = specs;
+  while (*p) {
+    const char *end = strchr(p, ';');
+    size_t len = end ? (size_t)(end - p) : strlen(p);
+    char one[64];
+    if (len >= sizeof(one) || count == SCHED_MAX_SPECS) return false;
+    memcpy(one, p, len);
+    one[len] = 0;
+    if (!parse_spec(one, &parsed[count++])) return false;
+    p += len + (end ? 1 : 0);
+  }
+  if (!count) return false;
+
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  memcpy(s_specs, parsed, sizeof(Spec) * count);
+  s_specCount = count;
+  s_specText = specs;
+  xSemaphoreGive(s_lock);
+  return true;
+}
+
+String sched_getSpecs() {
+  if (!s_lock) return String();
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  String text = s_specText;
+  xSemaphoreGive(s_lock);
+  return text;
+}
+
+void sched_setPolicy(SchedCatchup policy) {
+  if (!s_lock) return;
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  s_policy = policy;
+  xSemaphoreGive(s_lock);
+}
+
+SchedCatchup sched_getPolicy() {
+  if (!s_lock) return s_policy;
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  SchedCatchup policy = s_policy;
+  xSemaphoreGive(s_lock);
+  return policy;
+}
+
+void sched_rearm() {
+  if (s_task) xTaskNotifyGive(s_task);
+}
+
+void sched_getStats(SchedStats *stats) {
+  if (!s_lock) {
+    memset(stats, 0, sizeof(*stats));
+    return;
+  }
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  *stats = s_stats;
+  xSemaphoreGive(s_lock);
+}
@@ -0,0 +1,61 @@
+#ifndef CAPTURE_SCHEDULER_H
+#define CAPTURE_SCHEDULER_H
+
+#include <Arduino.h>
+#include "time.h"
+
+// Wall-clock capture schedule. The scheduler works out the next deadline,
+// arms a one-shot esp_timer for it and sleeps; nothing polls the clock.
+//
+// Specs are separated by ';':
+//   "M H"          cron-style minute and hour fields: *, */n, a, a-b, a-b/n
+//                  and comma lists, e.g. "0 *" on the hour, "*/15 7-19"
+//   "sunrise+30"   sunrise or sunset with an optional offset in minutes
+//
+// A slot served more than SCHED_GRACE_MS late counts as missed and is handled
+// by the catch-up policy. The scheduled-to-actual delay of every capture is
+// logged as jitter.
+
+#define SCHED_MAX_SPECS 8
+#define SCHED_GRACE_MS 5000
+#define SCHED_CATCHUP_MAX 4       // captures for missed slots per wake with SCHED_CATCHUP_ALL
+#define SCHED_MAX_SLEEP_S 600     // re-check at least this often, in case the clock was stepped
+#define SCHED_LATITUDE 51.5074    // for sunrise/sunset specs (London)
+#define SCHED_LONGITUDE -0.1278
+
+enum SchedCatchup {
+  SCHED_CATCHUP_SKIP,  // drop missed slots
+  SCHED_CATCHUP_ONE,   // one capture covers any number of missed slots
+  SCHED_CATCHUP_ALL    // one capture per missed slot, up to SCHED_CATCHUP_MAX
+};
+
+struct SchedStats {
+  uint32_t captures;
+  uint32_t missed;        // slots served late or not at all
+  uint32_t caught_up;     // captures taken for missed slots
+  int32_t last_jitter_ms;
+  int32_t max_jitter_ms;
+  time_t next;            // next deadline, 0 while the clock is not set
+};
+
+// capture(time_known) takes the photo. time_known is false only for the one
+// numbered capture taken when the clock is lost. hourly, if set, runs on the
+// scheduler task after any due captures, about once an hour (NTP resync).
+typedef void (*SchedCapture)(bool time_known);
+typedef void (*SchedMaintenance)();
+
+bool sched_begin(const char *specs, SchedCatchup policy, SchedCapture capture, SchedMaintenance hourly);
+
+// Replace the schedule. Returns false and keeps the old one if a spec does not parse.
+bool sched_setSpecs(const char *specs);
+String sched_getSpecs();
+
+void sched_setPolicy(SchedCatchup policy);
+SchedCatchup sched_getPolicy();
+
+// Recompute the next deadline now, e.g. after the clock was set.
+void sched_rearm();
+
+void sched_getStats(SchedStats *stats);
+
+#endif // CAPTURE_SCHEDULER_H
@@ -0,0 +1,420 @@
+#include "capture_service.h"
+#include "frame_broadcaster.h"
+#include "frame_pool.h"
+#include "sd_writer.h"
+#include "capture_catalog.h"
+#include "frame_fingerprint.h"
+#include "photo_thumbs.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/event_groups.h"
+#include "time.h"
+#include <sys/stat.h>
+
+#define CAPSVC_QUEUE_LEN 16       // frames waiting for the SD card
+#define CAPSVC_JOB_HISTORY 16     // finished jobs remembered for status lookups
+#define CAPSVC_FRAME_TIMEOUT_MS 1000
+#define CAPSVC_JOB_DONE_BIT 0x01
+
+struct CaptureJob {
+  uint32_t id;
+  const uint8_t *buf;
+  size_t len;
+  char path[64];
+  void (*release)(void *arg);  // NULL: buf is a frame_pool slab
+  void *arg;
+};
+
+static QueueHandle_t s_queue = NULL;
+static SemaphoreHandle_t s_jobsLock = NULL;
+static EventGroupHandle_t s_events = NULL;
+static CaptureJobInfo s_jobs[CAPSVC_JOB_HISTORY];  // indexed by id % CAPSVC_JOB_HISTORY
+static uint32_t s_nextId = 1;
+static int file_number = 0;
+
+// ---------- helpers ----------
+// burst_index > 0 adds a _NN suffix so all frames of a burst share one timestamp
+static String make_dated_filename(CaptureNaming naming, time_t now, unsigned burst_index) {
+  struct tm timeinfo;
+  localtime_r(&now, &timeinfo);
+
+  char strftime_buf[32];
+  strftime(strftime_buf, sizeof(strftime_buf), "%Y/%m/%d/%H%M%S", &timeinfo);
+  char filename[64];
+  // the day directory is created by sd_writer on the first write into it
+  char *time_part = strrchr(strftime_buf, '/') + 1;
+  time_part[-1] = '\0';
+  const char *prefix = naming == CAPTURE_NAME_EVENT ? "event_" : "";
+  if (burst_index) snprintf(filename, sizeof(filename), "/sdcard/%s/%s%s_%02u.jpg", strftime_buf, prefix, time_part, burst_index);
+  else snprintf(filename, sizeof(filename), "/sdcard/%s/%s.jpg", strftime_buf, time_part);
+  return String(filename);
+}
+
+static String make_numbered_filename() {
+  file_number++;
+  char filename[32];
+  snprintf(filename, sizeof(filename), "/sdcard/capture_%d.jpg", file_number);
+  return String(filename);
+}
+
+static void set_job(const CaptureJobInfo &info) {
+  xSemaphoreTake(s_jobsLock, portMAX_DELAY);
+  s_jobs[info.id % CAPSVC_JOB_HISTORY] = info;
+  xSemaphoreGive(s_jobsLock);
+}
+
+// Files sd_writer has reported since the last flush_committed(). Their
+// records go into the catalog together, so a group commit costs one catalog
+// write and fsync and one retention pass rather than one per photo.
+struct Committed {
+  uint32_t id;
+  bool ok;
+  size_t bytes;
+};
+static Committed s_committed[SDWR_GROUP_FILES];
+static size_t s_committedCount = 0;
+
+static void flush_committed() {
+  if (!s_committedCount) return;
+  CaptureJobInfo infos[SDWR_GROUP_FILES];
+  CatalogEntry entries[SDWR_GROUP_FILES];
+  size_t saved = 0;
+  for (size_t i = 0; i < s_committedCount; ++i) {
+    const Committed &c = s_committed[i];
+    CaptureJobInfo &info = infos[i];
+    if (!capsvc_status(c.id, &info)) {
+      memset(&info, 0, sizeof(info));
+      info.id = c.id;
+      strlcpy(info.path, "?", sizeof(info.path));
+    }
+    if (c.ok) {
+      Serial.printf("File saved: %s (bytes: %u)\n", info.path, (unsigned)c.bytes);
+      entries[saved++] = { info.path, info.when, (uint32_t)c.bytes, info.fingerprint };
+    }
+  }
+  if (saved) {
+    catalog_appendBatch(entries, saved);
+    catalog_enforceRetention();
+  }
+  for (size_t i = 0; i < s_committedCount; ++i) {
+    infos[i].state = s_committed[i].ok ? CAPTURE_JOB_DONE : CAPTURE_JOB_FAILED;
+    infos[i].bytes = s_committed[i].bytes;
+    set_job(infos[i]);
+  }
+  s_committedCount = 0;
+  xEventGroupSetBits(s_events, CAPSVC_JOB_DONE_BIT);
+  xEventGroupClearBits(s_events, CAPSVC_JOB_DONE_BIT);
+}
+
+// sd_writer callback: the file is on the card (or failed)
+static void on_committed(void *arg, bool ok, size_t bytes) {
+  if (s_committedCount == SDWR_GROUP_FILES) flush_committed();
+  s_committed[s_committedCount++] = { (uint32_t)(uintptr_t)arg, ok, bytes };
+}
+
+// A dated name has one-second resolution and a numbered one restarts at every
+// boot, so the name picked at submit can already be on the card (a /capture
+// and a scheduled save in the same second, the hour repeated when DST ends).
+// Take the first free _NN suffix rather than truncate a photo that is already
+// catalogued and served as immutable. Only this task creates photos, so the
+// name stays free until sdwr_write() opens it.
+static bool claim_free_name(CaptureJob &job) {
+  struct stat st;
+  if (stat(job.path, &st) != 0) return true;
+  char *ext = strrchr(job.path, '.');
+  if (!ext) return false;
+  char stem[64];
+  strlcpy(stem, job.path, min(sizeof(stem), (size_t)(ext - job.path) + 1));
+  for (unsigned n = 1; n < 100; ++n) {
+    char path[64];
+    if (snprintf(path, sizeof(path), "%s_%02u%s", stem, n, ext) >= (int)sizeof(path)) break;
+    if (stat(path, &st) == 0) continue;
+    Serial.printf("capture: %s exists, saving as %s\n", job.path, path);
+    strlcpy(job.path, path, sizeof(job.path));
+    xSemaphoreTake(s_jobsLock, portMAX_DELAY);
+    CaptureJobInfo &info = s_jobs[job.id % CAPSVC_JOB_HISTORY];
+    if (info.id == job.id) strlcpy(info.path, path, sizeof(info.path));
+    xSemaphoreGive(s_jobsLock);
+    return true;
+  }
+  Serial.printf("capture: no free name next to %s\n", job.path);
+  return false;
+}
+
+static void release_job(const CaptureJob &job) {
+  if (job.release) job.release(job.arg);
+  else fpool_release((uint8_t*)job.buf);
+}
+
+// the only place that touches the SD card for captures
+static void writer_task(void *arg) {
+  (void)arg;
+  while (true) {
+    CaptureJob job;
+    uint32_t due_ms = sdwr_commitDueMs();
+    TickType_t wait = due_ms == UINT32_MAX ? portMAX_DELAY : pdMS_TO_TICKS(due_ms);
+    if (xQueueReceive(s_queue, &job, wait) != pdTRUE) {
+      sdwr_commit();   // group timer ran out
+      flush_committed();
+      continue;
+    }
+    if (claim_free_name(job)) {
+      sdwr_write(job.path, job.buf, job.len, on_committed, (void*)(uintptr_t)job.id);
+      thumb_store(job.path, job.buf, job.len);   // eager thumbnails only
+    } else {
+      on_committed((void*)(uintptr_t)job.id, false, 0);
+    }
+    release_job(job);
+    // group commit: batch files only while more are waiting behind them
+    if (uxQueueMessagesWaiting(s_queue) == 0) sdwr_commit();
+    flush_committed();
+  }
+}
+
+bool capsvc_begin() {
+  if (s_queue) return true;
+  s_queue = xQueueCreate(CAPSVC_QUEUE_LEN, sizeof(CaptureJob));
+  s_jobsLock = xSemaphoreCreateMutex();
+  s_events = xEventGroupCreate();
+  if (!s_queue || !s_jobsLock || !s_events) {
+    Serial.println("capsvc: failed to create queue");
+    return false;
+  }
+  if (xTaskCreate(writer_task, "capsvc_writer", 4096, NULL, 2, NULL) != pdPASS) {
+    Serial.println("capsvc: failed to start writer task");
+    return false;
+  }
+  return true;
+}
+
+// Copy a referenced frame into a pool slab; NULL if it does not fit or the pool is empty.
+static uint8_t* copy_to_slab(const SharedFrame *frame) {
+  uint8_t *slab = frame->len <= fpool_slabSize() ? fpool_acquire() : NULL;
+  if (slab) memcpy(slab, frame->buf, frame->len);
+  return slab;
+}
+
+// Name and queue a frame. Takes ownership of buf: a slab unless release is set.
+static uint32_t queue_job(const uint8_t *buf, size_t len, CaptureNaming naming, time_t now, unsigned burst_index,
+                          void (*release)(void*) = NULL, void *arg = NULL, uint32_t wait_ms = 0) {
+  CaptureJob job;
+  job.buf = buf;
+  job.len = len;
+  job.release = release;
+  job.arg = arg;
+
+  // captures arrive from httpd, loop() and timers: number them under the lock
+  xSemaphoreTake(s_jobsLock, portMAX_DELAY);
+  job.id = s_nextId++;
+  String filename = naming == CAPTURE_NAME_NUMBERED ? make_numbered_filename() : make_dated_filename(naming, now, burst_index);
+  xSemaphoreGive(s_jobsLock);
+  strlcpy(job.path, filename.c_str(), sizeof(job.path));
+  CaptureJobInfo info;
+  info.id = job.id;
+  info.state = CAPTURE_JOB_QUEUED;
+  strlcpy(info.path, job.path, sizeof(info.path));
+  info.bytes = len;
+  info.when = now;
+  info.fingerprint = frame_fingerprint(buf, len);   // for the catalog record
+  set_job(info);
+
+  Serial.print("Taking picture: ");
+  Serial.println(job.path);
+  if (xQueueSend(s_queue, &job, pdMS_TO_TICKS(wait_ms)) != pdTRUE) {
+    Serial.println("capture: write queue full");
+    release_job(job);
+    info.state = CAPTURE_JOB_FAILED;
+    info.bytes = 0;
+    set_job(info);
+    return 0;
+  }
+  return job.id;
+}
+
+uint32_t capsvc_submit(CaptureNaming naming) {
+  if (!s_queue) return 0;
+  int64_t requested_at = esp_timer_get_time();
+  SharedFrame *frame = fbc_waitCapturedAfter(requested_at, CAPSVC_FRAME_TIMEOUT_MS);
+  if (!frame) {
+    Serial.println("capture: no fresh framebuffer");
+    return 0;
+  }
+
+  // copy out of the shared slot so the broadcaster can reuse it while the card is written
+  size_t len = frame->len;
+  uint8_t *buf = copy_to_slab(frame);
+  Serial.printf("Fresh frame #%u after %lld ms\n", (unsigned)frame->seq,
+                (long long)((esp_timer_get_time() - requested_at) / 1000));
+  fbc_release(frame);
+  if (!buf) {
+    Serial.println("capture: no free frame slab for the copy");
+    return 0;
+  }
+  return queue_job(buf, len, naming, time(NULL), 0);
+}
+
+size_t capsvc_submitBurst(CaptureNaming naming, size_t count, uint32_t interval_ms, uint32_t *job_ids) {
+  return capsvc_submitSequence(naming, time(NULL), 1, esp_timer_get_time(), count, interval_ms, job_ids);
+}
+
+size_t capsvc_submitSequence(CaptureNaming naming, time_t when, unsigned first_index,
+                             int64_t start_us, size_t count, uint32_t interval_ms, uint32_t *job_ids) {
+  if (!s_queue || count == 0) return 0;
+  if (count > CAPSVC_BURST_MAX) count = CAPSVC_BURST_MAX;
+
+  // Grab every frame into RAM before any of them is queued, so SD latency can
+  // never stretch the spacing between frames.
+  uint8_t *bufs[CAPSVC_BURST_MAX];
+  size_t lens[CAPSVC_BURST_MAX];
+  size_t grabbed = 0;
+  uint32_t last_seq = 0;
+  while (grabbed < count) {
+    SharedFrame *frame;
+    if (grabbed > 0 && interval_ms == 0) {
+      frame = fbc_waitNewer(last_seq, CAPSVC_FRAME_TIMEOUT_MS);
+    } else {
+      int64_t due_us = start_us + (int64_t)grabbed * interval_ms * 1000;
+      int64_t wait_us = due_us - esp_timer_get_time();
+      if (wait_us > 0) vTaskDelay(pdMS_TO_TICKS(wait_us / 1000));
+      frame = fbc_waitCapturedAfter(due_us, CAPSVC_FRAME_TIMEOUT_MS);
+    }
+    if (!frame) {
+      Serial.println("burst: no fresh framebuffer");
+      break;
+    }
+    last_seq = frame->seq;
+    lens[grabbed] = frame->len;
+    bufs[grabbed] = copy_to_slab(frame);
+    fbc_release(frame);
+    if (!bufs[grabbed]) {
+      Serial.println("burst: out of frame slabs");
+      break;
+    }
+    grabbed++;
+  }
+  Serial.printf("burst: %u frames in %lld ms\n", (unsigned)grabbed,
+                (long long)((esp_timer_get_time() - start_us) / 1000));
+
+  size_t queued = 0;
+  for (size_t i = 0; i < grabbed; ++i) {
+    uint32_t id = queue_job(bufs[i], lens[i], naming, when, first_index + i);
+    if (!id) continue;
+    if (job_ids) job_ids[queued] = id;
+    queued++;
+  }
+  return queued;
+}
+
+uint32_t capsvc_submitBuffer(const uint8_t *buf, size_t len, CaptureNaming naming, time_t when,
+                             unsigned index, void (*release)(void *arg), void *arg, uint32_t wait_ms) {
+  if (!s_queue) {
+    release(arg);
+    return 0;
+  }
+  return queue_job(buf, len, naming, when, index, release, arg, wait_ms);
+}
+
+bool capsvc_status(uint32_t job_id, CaptureJobInfo *info) {
+  if (!s_jobsLock || job_id == 0) return false;
+  xSemaphoreTake(s_jobsLock, portMAX_DELAY);
+  const CaptureJobInfo *j = &s_jobs[job_id % CAPSVC_JOB_HISTORY];
+  bool found = j->id == job_id;
+  if (found) *info = *j;
+  xSemaphoreGive(s_jobsLock);
+  return found;
+}
+
+bool capsvc_wait(uint32_t job_id, uint32_t timeout_ms, CaptureJobInfo *info) {
+  int64_t deadline = esp_timer_get_time() + (int64_t)timeout_ms * 1000;
+  while (true) {
+    if (!capsvc_status(job_id, info)) {
+      info->id = job_id;
+      info->state = CAPTURE_JOB_UNKNOWN;
+      return false;
+    }
+    if (info->state != CAPTURE_JOB_QUEUED) return true;
+    int64_t left_ms = (deadline - esp_timer_get_time()) / 1000;
+    if (left_ms <= 0) return false;
+    // woken on every finished job; a pulse missed between check and wait costs one job
+    xEventGroupWaitBits(s_events, CAPSVC_JOB_DONE_BIT, pdFALSE, pdFALSE, pdMS_TO_TICKS(left_ms > 200 ? 200 : left_ms));
+  }
+}
+
+String capsvc_relativePath(const char *path) {
+  String rel = String(path);
+  if (rel.startsWith("/sdcard/")) rel = rel.substring(strlen("/sdcard/"));
+  if (rel.startsWith("/")) rel = rel.substring(1);
+  return rel;
+}
+
+bool capsvc_otherLayout(const char *rel, char *out, size_t n) {
+  char y[5], mo[3], d[3], hms[7], tail[16];
+  int used = 0;
+  bool event = strncmp(rel, "event_", 6) == 0;
+  const char *flat = event ? rel + 6 : strncmp(rel, "capture_", 8) == 0 ? rel + 8 : NULL;
+  if (flat) {
+    // capture_YYYYMMDD_HHMMSS[_NN].jpg, event_YYYYMMDD_HHMMSS_NN.jpg
+    if (sscanf(flat, "%4[0-9]%2[0-9]%2[0-9]_%6[0-9]%15s", y, mo, d, hms, tail) != 5 ||
+        strlen(y) != 4 || strlen(mo) != 2 || strlen(d) != 2 || strlen(hms) != 6) {
+      return false;
+    }
+    return snprintf(out, n, "%s/%s/%s/%s%s%s", y, mo, d, event ? "event_" : "", hms, tail) < (int)n;
+  }
+  // YYYY/MM/DD/[event_]HHMMSS[_NN].jpg
+  if (sscanf(rel, "%4[0-9]/%2[0-9]/%2[0-9]/%n", y, mo, d, &used) != 3 || used != 11) return false;
+  const char *base = rel + used;
+  event = strncmp(base, "event_", 6) == 0;
+  if (event) base += 6;
+  if (sscanf(base, "%6[0-9]%15s", hms, tail) != 2 || strlen(hms) != 6) return false;
+  return snprintf(out, n, "%s_%s%s%s_%s%s", event ? "event" : "capture", y, mo, d, hms, tail) < (int)n;
+}
+
+// ---------- migration to the dated layout ----------
+static uint32_t s_migrateSeq = 0;   // catalog sequence the next batch starts at
+
+size_t capsvc_migrateFlat(size_t max_moves, size_t *remaining) {
+  size_t total = catalog_count();
+  size_t pos = catalog_findSeq(s_migrateSeq);
+  size_t moved = 0;
+  size_t budget = max_moves * CAPSVC_MIGRATE_SCAN;
+  CatalogRecord recs[16];
+  while (pos < total && moved < max_moves && budget) {
+    size_t k = catalog_read(pos, recs, min((size_t)16, min(total - pos, budget)));
+    if (!k) break;
+    size_t i = 0;
+    for (; i < k && moved < max_moves; ++i) {
+      const CatalogRecord &r = recs[i];
+      char dated[CATALOG_NAME_LEN];
+      if (strchr(r.name, '/') || !capsvc_otherLayout(r.name, dated, sizeof(dated))) continue;
+      char from[64], to[64];
+      snprintf(from, sizeof(from), "/sdcard/%s", r.name);
+      snprintf(to, sizeof(to), "/sdcard/%s", dated);
+      // A reset between the rename and the catalog update leaves a record
+      // with the old name; downloads still find it through capsvc_otherLayout().
+      if (!sdwr_makeDirs(to) || rename(from, to) != 0) {
+        Serial.printf("migrate: could not move %s\n", from);
+        continue;
+      }
+      catalog_rename(r.seq, dated);
+      thumb_remove(from);   // remade under the new name when next asked for
+      moved++;
+    }
+    pos += i;
+    budget -= i;
+  }
+
+  CatalogRecord next;
+  if (pos < total && catalog_read(pos, &next, 1) == 1) {
+    s_migrateSeq = next.seq;
+  } else {
+    CatalogInfo ci;
+    catalog_getInfo(&ci);
+    s_migrateSeq = ci.last_seq + 1;
+  }
+  if (remaining) *remaining = pos < total ? total - pos : 0;
+  Serial.printf("migrate: moved %u files, %u records left\n", (unsigned)moved, (unsigned)(pos < total ? total - pos : 0));
+  return moved;
+}
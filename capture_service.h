@@ -0,0 +1,93 @@
+#ifndef CAPTURE_SERVICE_H
+#define CAPTURE_SERVICE_H
+
+#include <Arduino.h>
+
+// Single capture-and-save path for the sketch. capsvc_submit() takes a frame
+// captured after the call from the frame broadcaster, copies it into a
+// frame_pool slab and releases the shared slot straight away; a writer task
+// then does all SD card I/O from a queue. Nothing here holds cameraLock, so
+// streaming keeps running while a slow card is being written.
+
+// Dated photos go into one directory per day, so no directory grows with the
+// archive and opening a file costs the same after a year as on day one.
+// Earlier versions wrote everything flat into /sdcard as
+// capture_YYYYMMDD_HHMMSS[_NN].jpg and event_YYYYMMDD_HHMMSS_NN.jpg;
+// capsvc_otherLayout() maps between the two and capsvc_migrateFlat() moves
+// old files across.
+enum CaptureNaming {
+  CAPTURE_NAME_DATED,     // /sdcard/YYYY/MM/DD/HHMMSS.jpg (HHMMSS_NN.jpg in a burst)
+  CAPTURE_NAME_NUMBERED,  // /sdcard/capture_N.jpg, used while the clock is not set
+  CAPTURE_NAME_EVENT      // /sdcard/YYYY/MM/DD/event_HHMMSS_NN.jpg, pre/post-trigger frames
+};
+
+enum CaptureJobState {
+  CAPTURE_JOB_UNKNOWN = 0,  // never submitted, or too old to be remembered
+  CAPTURE_JOB_QUEUED,
+  CAPTURE_JOB_DONE,
+  CAPTURE_JOB_FAILED
+};
+
+struct CaptureJobInfo {
+  uint32_t id;
+  CaptureJobState state;
+  char path[64];
+  size_t bytes;
+  time_t when;            // capture time the name was made from
+  uint32_t fingerprint;   // frame_fingerprint() of the JPEG
+};
+
+// Start the SD writer task.
+bool capsvc_begin();
+
+// Grab a fresh frame and queue it for writing. Returns the job id, or 0 if no
+// frame arrived or the write queue is full.
+uint32_t capsvc_submit(CaptureNaming naming);
+
+// Most frames a single burst can hold; each needs a free frame_pool slab.
+#define CAPSVC_BURST_MAX 8
+
+// Capture count frames into frame_pool slabs first, then queue them all for
+// writing with sequential names (HHMMSS_01.jpg, _02.jpg, ... for dated bursts).
+// interval_ms 0 takes every frame the sensor delivers; otherwise frame i is
+// the first one captured at least i * interval_ms after the call. Job ids
+// are written to job_ids (room for count); returns how many were queued,
+// which is less than count if slabs or queue space ran out.
+size_t capsvc_submitBurst(CaptureNaming naming, size_t count, uint32_t interval_ms, uint32_t *job_ids);
+
+// The general form of capsvc_submitBurst(): frame i is the first captured at
+// or after start_us + i * interval_ms, and is named with index first_index + i
+// and wall-clock time when. job_ids may be NULL.
+size_t capsvc_submitSequence(CaptureNaming naming, time_t when, unsigned first_index,
+                             int64_t start_us, size_t count, uint32_t interval_ms, uint32_t *job_ids);
+
+// Queue a JPEG that lives outside the frame pool without copying it. The
+// caller keeps buf intact until the writer calls release(arg), which happens
+// exactly once, even when 0 is returned. Waits up to wait_ms for queue space.
+uint32_t capsvc_submitBuffer(const uint8_t *buf, size_t len, CaptureNaming naming, time_t when,
+                             unsigned index, void (*release)(void *arg), void *arg, uint32_t wait_ms);
+
+// Look up a job. Returns false if the id is unknown (or has aged out).
+bool capsvc_status(uint32_t job_id, CaptureJobInfo *info);
+
+// Wait until the job is written (or failed) or timeout_ms passes; info holds
+// the last known state either way. Returns true once the job has finished.
+bool capsvc_wait(uint32_t job_id, uint32_t timeout_ms, CaptureJobInfo *info);
+
+// Download path for a saved file: "/sdcard/2025/01/02/x.jpg" -> "2025/01/02/x.jpg".
+String capsvc_relativePath(const char *path);
+
+// The same photo's name, relative to /sdcard, in the other layout:
+// "capture_20250102_103000_01.jpg" <-> "2025/01/02/103000_01.jpg". Returns
+// false for names that carry no date (capture_N.jpg) or do not fit in n.
+bool capsvc_otherLayout(const char *rel, char *out, size_t n);
+
+// Move up to max_moves flat dated photos into day directories, updating the
+// catalog as it goes. Each call carries on where the last one stopped and
+// looks at no more than CAPSVC_MIGRATE_SCAN records per move allowed.
+// Returns the number moved; remaining is set to the catalog records not yet
+// looked at.
+#define CAPSVC_MIGRATE_SCAN 16
+size_t capsvc_migrateFlat(size_t max_moves, size_t *remaining);
+
+#endif // CAPTURE_SERVICE_H
@@ -0,0 +1,234 @@
+#include "event_ring.h"
+#include "frame_broadcaster.h"
+#include "capture_service.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "time.h"
+#include <atomic>
+
+#define EVRING_GPIO_DEBOUNCE_US 200000
+#define EVRING_QUEUE_WAIT_MS 2000
+
+// Frames are stored back to back in the arena, oldest first. A frame that
+// does not fit before the end of the arena starts again at offset 0 and the
+// tail is left unused until the write position comes round again.
+struct RingEntry {
+  size_t offset;
+  size_t len;
+  uint32_t seq;
+  int64_t timestamp_us;
+};
+
+static uint8_t *s_arena = NULL;
+static RingEntry s_entries[EVRING_MAX_FRAMES];
+static size_t s_head = 0;       // oldest entry
+static size_t s_count = 0;
+static size_t s_write = 0;      // arena offset for the next frame
+static size_t s_bytes = 0;
+static bool s_frozen = false;   // an event owns the arena until its frames are written
+static int64_t s_triggerUs = 0;
+static time_t s_triggerTime = 0;
+static uint32_t s_evicted = 0;
+static uint32_t s_events = 0;
+static uint32_t s_busy = 0;
+static SemaphoreHandle_t s_lock = NULL;      // guards everything above
+static SemaphoreHandle_t s_drained = NULL;   // given when the last arena frame is written
+static std::atomic<int> s_outstanding(0);
+static TaskHandle_t s_eventTask = NULL;
+static volatile bool s_gpioPending = false;
+static volatile int64_t s_lastGpioUs = 0;
+
+// ---------- arena (s_lock held) ----------
+static void evict_oldest() {
+  s_bytes -= s_entries[s_head].len;
+  s_head = (s_head + 1) % EVRING_MAX_FRAMES;
+  s_count--;
+  s_evicted++;
+}
+
+// Where a frame of len bytes can go without touching a stored frame.
+static bool find_space(size_t len, size_t *at) {
+  if (s_count == 0) {
+    *at = 0;
+    return len <= EVRING_BUDGET_BYTES;
+  }
+  size_t tail = s_entries[s_head].offset;
+  if (s_write > tail) {
+    // free space is [s_write, end) and [0, tail)
+    if (s_write + len <= EVRING_BUDGET_BYTES) *at = s_write;
+    else if (len <= tail) *at = 0;
+    else return false;
+    return true;
+  }
+  // wrapped: free space is [s_write, tail)
+  if (s_write + len > tail) return false;
+  *at = s_write;
+  return true;
+}
+
+static void store_frame(const SharedFrame *frame) {
+  if (frame->len > EVRING_BUDGET_BYTES) return;
+  // keep only the pre-trigger window
+  while (s_count && frame->timestamp_us - s_entries[s_head].timestamp_us > (int64_t)EVRING_PRE_SECONDS * 1000000) {
+    evict_oldest();
+  }
+  if (s_count == EVRING_MAX_FRAMES) evict_oldest();
+  size_t at;
+  while (!find_space(frame->len, &at)) evict_oldest();
+
+  memcpy(s_arena + at, frame->buf, frame->len);
+  RingEntry *e = &s_entries[(s_head + s_count) % EVRING_MAX_FRAMES];
+  e->offset = at;
+  e->len = frame->len;
+  e->seq = frame->seq;
+  e->timestamp_us = frame->timestamp_us;
+  s_count++;
+  s_bytes += frame->len;
+  s_write = at + frame->len;
+}
+
+// ---------- tasks ----------
+// Samples the broadcaster at EVRING_FPS, like any other viewer.
+static void feeder_task(void *arg) {
+  (void)arg;
+  const int64_t period_us = 1000000 / EVRING_FPS;
+  uint32_t last_seq = 0;
+  int64_t next_due = 0;
+  while (true) {
+    SharedFrame *frame = fbc_waitNewer(last_seq, 1000);
+    if (!frame) continue;
+    last_seq = frame->seq;
+    if (frame->timestamp_us >= next_due) {
+      // hold the average rate, but never try to catch up after a gap
+      next_due = frame->timestamp_us - next_due < period_us ? next_due + period_us : frame->timestamp_us + period_us;
+      xSemaphoreTake(s_lock, portMAX_DELAY);
+      if (!s_frozen) store_frame(frame);
+      xSemaphoreGive(s_lock);
+    }
+    fbc_release(frame);
+  }
+}
+
+static void on_frame_written(void *arg) {
+  (void)arg;
+  if (s_outstanding.fetch_sub(1) == 1) xSemaphoreGive(s_drained);
+}
+
+static void save_event() {
+  // the feeder leaves a frozen arena alone, so the entries can be read unlocked
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  size_t head = s_head;
+  size_t count = s_count;
+  int64_t trigger_us = s_triggerUs;
+  time_t when = s_triggerTime;
+  xSemaphoreGive(s_lock);
+
+  int64_t t_start = esp_timer_get_time();
+  s_outstanding.store((int)count);
+  for (size_t i = 0; i < count; ++i) {
+    const RingEntry &e = s_entries[(head + i) % EVRING_MAX_FRAMES];
+    capsvc_submitBuffer(s_arena + e.offset, e.len, CAPTURE_NAME_EVENT, when, i + 1,
+                        on_frame_written, NULL, EVRING_QUEUE_WAIT_MS);
+  }
+  size_t post = capsvc_submitSequence(CAPTURE_NAME_EVENT, when, count + 1, trigger_us,
+                                      EVRING_POST_FRAMES, 1000 / EVRING_FPS, NULL);
+  if (count) xSemaphoreTake(s_drained, portMAX_DELAY);
+  Serial.printf("event: %u pre + %u post-trigger frames saved in %lld ms\n", (unsigned)count, (unsigned)post,
+                (long long)((esp_timer_get_time() - t_start) / 1000));
+
+  // start a fresh history so the next event does not repeat these frames
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  s_head = 0;
+  s_count = 0;
+  s_write = 0;
+  s_bytes = 0;
+  s_frozen = false;
+  s_events++;
+  xSemaphoreGive(s_lock);
+}
+
+static void event_task(void *arg) {
+  (void)arg;
+  while (true) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    if (s_gpioPending) {
+      s_gpioPending = false;
+      evring_trigger("gpio");
+    }
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    bool frozen = s_frozen;
+    xSemaphoreGive(s_lock);
+    if (frozen) save_event();
+  }
+}
+
+static void IRAM_ATTR trigger_isr() {
+  int64_t now = esp_timer_get_time();
+  if (now - s_lastGpioUs < EVRING_GPIO_DEBOUNCE_US) return;
+  s_lastGpioUs = now;
+  s_gpioPending = true;
+  BaseType_t woken = pdFALSE;
+  vTaskNotifyGiveFromISR(s_eventTask, &woken);
+  portYIELD_FROM_ISR(woken);
+}
+
+// ---------- public API ----------
+bool evring_begin(int trigger_gpio) {
+  if (s_arena) return true;
+  s_arena = (uint8_t*)heap_caps_malloc(EVRING_BUDGET_BYTES, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  if (!s_arena) {
+    Serial.println("evring: no PSRAM for the pre-trigger ring");
+    return false;
+  }
+  s_lock = xSemaphoreCreateMutex();
+  s_drained = xSemaphoreCreateBinary();
+  if (!s_lock || !s_drained ||
+      xTaskCreate(event_task, "evring_event", 4096, NULL, 2, &s_eventTask) != pdPASS ||
+      xTaskCreate(feeder_task, "evring_feed", 3072, NULL, 1, NULL) != pdPASS) {
+    Serial.println("evring: failed to start tasks");
+    return false;
+  }
+  if (trigger_gpio >= 0) {
+    pinMode(trigger_gpio, INPUT_PULLUP);
+    attachInterrupt(digitalPinToInterrupt(trigger_gpio), trigger_isr, FALLING);
+  }
+  Serial.printf("evring: %u KB for %d s before each trigger\n", (unsigned)(EVRING_BUDGET_BYTES / 1024), EVRING_PRE_SECONDS);
+  return true;
+}
+
+int evring_trigger(const char *source) {
+  if (!s_eventTask) return -1;
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  if (s_frozen) {
+    s_busy++;
+    xSemaphoreGive(s_lock);
+    Serial.printf("event: %s trigger ignored, previous event still saving\n", source);
+    return -1;
+  }
+  s_frozen = true;
+  s_triggerUs = esp_timer_get_time();
+  s_triggerTime = time(NULL);
+  int frames = (int)s_count;
+  xSemaphoreGive(s_lock);
+
+  Serial.printf("event: triggered by %s with %d pre-trigger frames\n", source, frames);
+  xTaskNotifyGive(s_eventTask);
+  return frames;
+}
+
+void evring_getStats(EventRingStats *stats) {
+  if (!s_lock) {
+    memset(stats, 0, sizeof(*stats));
+    return;
+  }
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  stats->frames = s_count;
+  stats->bytes = s_bytes;
+  stats->evicted = s_evicted;
+  stats->events = s_events;
+  stats->busy = s_busy;
+  xSemaphoreGive(s_lock);
+}
@@ -0,0 +1,39 @@
+#ifndef EVENT_RING_H
+#define EVENT_RING_H
+
+#include <Arduino.h>
+
+// Pre-trigger history. A low-priority task copies frames from the frame
+// broadcaster at EVRING_FPS into a byte-budgeted PSRAM arena, keeping the
+// last EVRING_PRE_SECONDS. A trigger freezes the arena, hands every stored
+// frame to capture_service without copying, and then adds EVRING_POST_FRAMES
+// frames taken after the trigger. The files are YYYY/MM/DD/event_HHMMSS_NN.jpg,
+// numbered oldest first, so the trigger moment sits between the pre- and
+// post-trigger frames.
+
+#define EVRING_BUDGET_BYTES (768 * 1024)  // arena size; JPEGs vary, so no frame count
+#define EVRING_PRE_SECONDS 3
+#define EVRING_FPS 4
+#define EVRING_POST_FRAMES 4
+#define EVRING_MAX_FRAMES 64              // descriptor slots; the byte budget is the real limit
+
+struct EventRingStats {
+  size_t frames;       // frames held right now
+  size_t bytes;        // bytes of JPEG data held right now
+  uint32_t evicted;    // frames dropped to stay within the budget or the time window
+  uint32_t events;     // triggers that were saved
+  uint32_t busy;       // triggers ignored because an event was still being saved
+};
+
+// Allocate the arena and start the feeder and event tasks. trigger_gpio >= 0
+// also arms a falling-edge interrupt on that pin (e.g. a PIR or reed switch).
+bool evring_begin(int trigger_gpio);
+
+// Save the ring plus the post-trigger frames in the background. Returns the
+// number of pre-trigger frames that will be saved, or -1 if the ring is not
+// running or the previous event is still being written.
+int evring_trigger(const char *source);
+
+void evring_getStats(EventRingStats *stats);
+
+#endif // EVENT_RING_H
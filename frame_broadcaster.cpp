@@ -0,0 +1,278 @@
+#include "frame_broadcaster.h"
+#include "esp_camera.h"
+#include "img_converters.h"
+#include "esp_timer.h"
+#include "freertos/task.h"
+#include "freertos/event_groups.h"
+#include "jpeg_scale.h"
+#include "frame_fingerprint.h"
+#include "frame_pool.h"
+
+// One producer task owns the camera. Each captured JPEG is copied into one of
+// a few shared slots and published as "latest"; any number of viewers can then
+// reference that slot at the same time without touching the camera or its lock.
+//
+// Slot buffers are frame_pool slabs, taken the first time a slot is used and
+// kept for good, so publishing a frame never allocates.
+//
+// Slot life cycle (all transitions under s_mux):
+//   free (refs == 0, not latest) -> claimed by producer (refs = 1)
+//   -> published as s_latest (producer's ref dropped) -> referenced by viewers
+//   -> free again once it is no longer latest and every viewer released it.
+
+#define FBC_SLOT_COUNT 4        // latest + slots still held by slow viewers + one being filled
+#define FBC_NEW_FRAME_BIT 0x01
+#define FBC_TIER_QUALITY 60     // fmt2jpg quality for reduced tiers (1..100, higher is better)
+
+static SharedFrame s_slots[FBC_SLOT_COUNT];
+static SharedFrame *s_latest = NULL;
+static portMUX_TYPE s_mux = portMUX_INITIALIZER_UNLOCKED;
+static EventGroupHandle_t s_events = NULL;
+static SemaphoreHandle_t s_cameraLock = NULL;
+static TaskHandle_t s_task = NULL;
+static uint32_t s_seq = 0;
+static uint32_t s_dropped = 0;
+static SemaphoreHandle_t s_tierLock = NULL;   // serializes tier encodes and their buffers
+
+// Pick the lowest free slot so that with few viewers only two buffers are ever allocated.
+static SharedFrame* claim_slot() {
+  SharedFrame *slot = NULL;
+  taskENTER_CRITICAL(&s_mux);
+  for (int i = 0; i < FBC_SLOT_COUNT; ++i) {
+    if (&s_slots[i] != s_latest && s_slots[i].refs == 0) {
+      slot = &s_slots[i];
+      slot->refs = 1;
+      break;
+    }
+  }
+  taskEXIT_CRITICAL(&s_mux);
+  return slot;
+}
+
+static void unclaim_slot(SharedFrame *slot) {
+  taskENTER_CRITICAL(&s_mux);
+  slot->refs = 0;
+  taskEXIT_CRITICAL(&s_mux);
+}
+
+static void publish_slot(SharedFrame *slot) {
+  taskENTER_CRITICAL(&s_mux);
+  slot->seq = ++s_seq;
+  slot->refs = 0;
+  s_latest = slot;
+  taskEXIT_CRITICAL(&s_mux);
+  // Waiters blocked in fbc_waitNewer() are released by the set; clearing
+  // straight away turns the bit into a broadcast pulse.
+  xEventGroupSetBits(s_events, FBC_NEW_FRAME_BIT);
+  xEventGroupClearBits(s_events, FBC_NEW_FRAME_BIT);
+}
+
+static bool slot_has_slab(SharedFrame *slot) {
+  if (slot->buf) return true;
+  slot->buf = fpool_acquire();
+  slot->cap = slot->buf ? fpool_slabSize() : 0;
+  return slot->buf != NULL;
+}
+
+// frame2jpg_cb sink writing straight into the slot's slab
+static size_t slot_out(void *arg, size_t index, const void *data, size_t len) {
+  SharedFrame *slot = (SharedFrame*)arg;
+  if (!data || index + len > slot->cap) return 0;
+  memcpy(slot->buf + index, data, len);
+  if (index + len > slot->len) slot->len = index + len;
+  return len;
+}
+
+// copy (or convert) the camera frame into the slot
+static bool fill_slot(SharedFrame *slot, camera_fb_t *fb) {
+  if (!slot_has_slab(slot)) return false;
+  if (fb->format == PIXFORMAT_JPEG) {
+    if (fb->len > slot->cap) {
+      Serial.printf("fbc: frame of %u bytes does not fit a slab\n", (unsigned)fb->len);
+      return false;
+    }
+    memcpy(slot->buf, fb->buf, fb->len);
+    slot->len = fb->len;
+  } else {
+    slot->len = 0;
+    if (!frame2jpg_cb(fb, 80, slot_out, slot)) {
+      Serial.println("fbc: JPEG compression failed");
+      return false;
+    }
+  }
+  slot->width = fb->width;
+  slot->height = fb->height;
+  slot->timestamp_us = (int64_t)fb->timestamp.tv_sec * 1000000LL + fb->timestamp.tv_usec;
+  return true;
+}
+
+static void producer_task(void *arg) {
+  (void)arg;
+  while (true) {
+    if (s_cameraLock && xSemaphoreTake(s_cameraLock, pdMS_TO_TICKS(2000)) != pdTRUE) {
+      // a capture is holding the camera; try again shortly
+      continue;
+    }
+
+    camera_fb_t *fb = esp_camera_fb_get();
+    if (!fb) {
+      if (s_cameraLock) xSemaphoreGive(s_cameraLock);
+      Serial.println("fbc: camera capture failed");
+      vTaskDelay(pdMS_TO_TICKS(100));
+      continue;
+    }
+
+    SharedFrame *slot = claim_slot();
+    bool filled = slot && fill_slot(slot, fb);
+    esp_camera_fb_return(fb);
+    if (s_cameraLock) xSemaphoreGive(s_cameraLock);
+
+    if (filled) {
+      slot->fingerprint = frame_fingerprint(slot->buf, slot->len);
+      publish_slot(slot);
+    } else {
+      if (slot) unclaim_slot(slot);
+      ++s_dropped;
+      vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    // let equal-priority tasks (and the lock waiters) in between frames
+    vTaskDelay(1);
+  }
+}
+
+bool fbc_begin(SemaphoreHandle_t cameraLock) {
+  if (s_task) return true;
+  s_cameraLock = cameraLock;
+  s_events = xEventGroupCreate();
+  s_tierLock = xSemaphoreCreateMutex();
+  if (!s_events || !s_tierLock) {
+    Serial.println("fbc: failed to create sync objects");
+    return false;
+  }
+  if (xTaskCreatePinnedToCore(producer_task, "fbc_producer", 4096, NULL, 4, &s_task, 1) != pdPASS) {
+    Serial.println("fbc: failed to start producer task");
+    s_task = NULL;
+    return false;
+  }
+  return true;
+}
+
+SharedFrame* fbc_acquireLatest() {
+  SharedFrame *f;
+  taskENTER_CRITICAL(&s_mux);
+  f = s_latest;
+  if (f) f->refs++;
+  taskEXIT_CRITICAL(&s_mux);
+  return f;
+}
+
+SharedFrame* fbc_waitNewer(uint32_t after_seq, uint32_t timeout_ms) {
+  int64_t deadline = esp_timer_get_time() + (int64_t)timeout_ms * 1000;
+  while (true) {
+    SharedFrame *f = fbc_acquireLatest();
+    if (f && (int32_t)(f->seq - after_seq) > 0) return f;
+    if (f) fbc_release(f);
+
+    int64_t left_us = deadline - esp_timer_get_time();
+    if (left_us <= 0 || !s_events) return NULL;
+    // A pulse that lands between the check above and this wait is missed;
+    // that only costs one frame interval, which the loop absorbs.
+    xEventGroupWaitBits(s_events, FBC_NEW_FRAME_BIT, pdFALSE, pdFALSE, pdMS_TO_TICKS(left_us / 1000 + 1));
+  }
+}
+
+SharedFrame* fbc_waitCapturedAfter(int64_t after_us, uint32_t timeout_ms) {
+  int64_t deadline = esp_timer_get_time() + (int64_t)timeout_ms * 1000;
+  uint32_t seen_seq = 0;
+  while (true) {
+    SharedFrame *f = fbc_acquireLatest();
+    if (f && f->timestamp_us > after_us) return f;
+    if (f) {
+      seen_seq = f->seq;
+      fbc_release(f);
+    }
+    int64_t left_ms = (deadline - esp_timer_get_time()) / 1000;
+    if (left_ms <= 0) return NULL;
+    // wait for the next publish, then re-check its capture time
+    f = fbc_waitNewer(seen_seq, (uint32_t)left_ms);
+    if (!f) return NULL;
+    if (f->timestamp_us > after_us) return f;
+    seen_seq = f->seq;
+    fbc_release(f);
+  }
+}
+
+void fbc_release(SharedFrame *frame) {
+  if (!frame) return;
+  taskENTER_CRITICAL(&s_mux);
+  if (frame->refs > 0) frame->refs--;
+  taskEXIT_CRITICAL(&s_mux);
+}
+
+uint32_t fbc_framesPublished() {
+  return s_seq;
+}
+
+uint32_t fbc_framesDropped() {
+  return s_dropped;
+}
+
+// fmt2jpg_cb sink that writes into a FrameVariant's fixed region
+static size_t variant_out(void *arg, size_t index, const void *data, size_t len) {
+  FrameVariant *v = (FrameVariant*)arg;
+  if (!data || index + len > v->cap) return 0;
+  memcpy(v->buf + index, data, len);
+  if (index + len > v->len) v->len = index + len;
+  return len;
+}
+
+// Give the slot one slab for its reduced tiers: 1/2 of it for the 1/2-scale
+// tier, 1/4 for 1/4 scale and 1/8 for 1/8 scale, each far more than a
+// re-encode at that size needs. Called with s_tierLock held.
+static bool slot_has_tier_slab(SharedFrame *slot) {
+  if (slot->tier_buf) return true;
+  slot->tier_buf = fpool_acquire();
+  if (!slot->tier_buf) return false;
+  size_t offset = 0;
+  for (int t = FRAME_TIER_HALF; t < FRAME_TIER_COUNT; ++t) {
+    FrameVariant *v = &slot->variants[t - 1];
+    v->buf = slot->tier_buf + offset;
+    v->cap = fpool_slabSize() >> t;
+    v->len = 0;
+    v->seq = 0;
+    offset += v->cap;
+  }
+  return true;
+}
+
+bool fbc_getTier(SharedFrame *frame, FrameTier tier, const uint8_t **buf, size_t *len) {
+  if (!frame) return false;
+  if (tier == FRAME_TIER_FULL) {
+    *buf = frame->buf;
+    *len = frame->len;
+    return true;
+  }
+  if (tier >= FRAME_TIER_COUNT || !s_tierLock) return false;
+
+  // The caller's reference keeps the producer from refilling this slot, so
+  // the encode below and the returned buffer both belong to frame->seq.
+  FrameVariant *v = &frame->variants[tier - 1];
+  xSemaphoreTake(s_tierLock, portMAX_DELAY);
+  bool ok = v->seq == frame->seq && v->len > 0;
+  if (!ok && !slot_has_tier_slab(frame)) {
+    xSemaphoreGive(s_tierLock);
+    return false;
+  }
+  if (!ok) {
+    v->len = 0;
+    v->seq = 0;
+    ok = jpgscale_downscale(frame->buf, frame->len, (jpg_scale_t)tier, FBC_TIER_QUALITY, variant_out, v);
+    if (ok) v->seq = frame->seq;
+    else Serial.printf("fbc: failed to encode tier %d\n", (int)tier);
+  }
+  xSemaphoreGive(s_tierLock);
+  if (!ok) return false;
+  *buf = v->buf;
+  *len = v->len;
+  return true;
+}
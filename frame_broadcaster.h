@@ -0,0 +1,74 @@
+#ifndef FRAME_BROADCASTER_H
+#define FRAME_BROADCASTER_H
+
+#include <Arduino.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+// Stream resolutions. Reduced tiers are produced from the full frame by
+// DCT-domain downscaling (jpeg_scale) at 1/2, 1/4 and 1/8 of the sensor size;
+// at SVGA that is 400x300, 200x150 and 100x75.
+enum FrameTier {
+  FRAME_TIER_FULL = 0,
+  FRAME_TIER_HALF,
+  FRAME_TIER_QUARTER,
+  FRAME_TIER_EIGHTH,
+  FRAME_TIER_COUNT
+};
+
+// One re-encoded tier of a frame; valid only while seq matches the frame's.
+struct FrameVariant {
+  uint8_t *buf;
+  size_t len;
+  size_t cap;
+  uint32_t seq;
+};
+
+// A JPEG frame published by the capture task. Viewers never own the memory:
+// they take a reference with fbc_acquireLatest()/fbc_waitNewer() and must
+// hand it back with fbc_release() once they are done sending it.
+struct SharedFrame {
+  uint8_t *buf;
+  size_t len;
+  size_t cap;
+  uint32_t seq;           // increments by one for every published frame
+  int64_t timestamp_us;   // capture time on the esp_timer clock
+  uint16_t width;
+  uint16_t height;
+  uint32_t fingerprint;   // frame_fingerprint() of the JPEG scan data
+  uint32_t refs;          // guarded by the broadcaster's spinlock
+  FrameVariant variants[FRAME_TIER_COUNT - 1]; // lazily encoded reduced tiers
+  uint8_t *tier_buf;      // frame_pool slab split between the reduced tiers
+};
+
+// Start the single producer task. cameraLock (may be NULL) is taken around
+// each esp_camera_fb_get()/esp_camera_fb_return() pair, so the producer is the
+// only streaming code that ever touches the camera.
+bool fbc_begin(SemaphoreHandle_t cameraLock);
+
+// Reference the newest published frame, or NULL if nothing was captured yet.
+SharedFrame* fbc_acquireLatest();
+
+// Reference the newest frame whose seq is greater than after_seq, waiting up
+// to timeout_ms for the producer to publish one. Returns NULL on timeout.
+SharedFrame* fbc_waitNewer(uint32_t after_seq, uint32_t timeout_ms);
+
+// Reference the newest frame captured after after_us (esp_timer clock), i.e.
+// a frame that is guaranteed to show the scene at or after that moment. With
+// the driver in CAMERA_GRAB_LATEST mode this takes at most about one frame
+// interval. Returns NULL if none arrives within timeout_ms.
+SharedFrame* fbc_waitCapturedAfter(int64_t after_us, uint32_t timeout_ms);
+
+void fbc_release(SharedFrame *frame);
+
+// Get the frame at the requested tier. The first caller encodes it; every
+// other viewer of the same tier reuses that encode. The returned buffer stays
+// valid while the caller holds its reference on frame.
+bool fbc_getTier(SharedFrame *frame, FrameTier tier, const uint8_t **buf, size_t *len);
+
+// Counters for debugging: published frames and frames dropped because every
+// slot was still referenced by a viewer.
+uint32_t fbc_framesPublished();
+uint32_t fbc_framesDropped();
+
+#endif // FRAME_BROADCASTER_H
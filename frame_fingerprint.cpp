@@ -0,0 +1,69 @@
+#include "frame_fingerprint.h"
+
+// offset of the first byte after the SOS segment, or 0 if there is none
+static size_t scan_data_offset(const uint8_t *p, size_t len) {
+  if (len < 4 || p[0] != 0xFF || p[1] != 0xD8) return 0;
+  size_t i = 2;
+  while (i + 4 <= len) {
+    if (p[i] != 0xFF) return 0;
+    uint8_t marker = p[i + 1];
+    if (marker == 0xFF) { ++i; continue; }
+    if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7)) { i += 2; continue; }
+    size_t seglen = ((size_t)p[i + 2] << 8) | p[i + 3];
+    if (marker == 0xDA) {
+      size_t start = i + 2 + seglen;
+      return start < len ? start : 0;
+    }
+    i += 2 + seglen;
+  }
+  return 0;
+}
+
+// Sampling plan: FP_WINDOWS windows of FP_WINDOW_WORDS aligned 32-bit words,
+// spread evenly over the scan data, plus the scan length. Huffman-coded data
+// is not byte aligned, so any change in the picture shifts every following
+// bit: the windows after the first changed MCU, the final window and usually
+// the length all differ. A window is half a PSRAM cache line, so a UXGA frame
+// costs 64 line fills instead of a pass over ~200 KB.
+#define FP_WINDOWS 64
+#define FP_WINDOW_WORDS 4
+
+static inline uint32_t mix32(uint32_t h, uint32_t w) {
+  w *= 0xcc9e2d51u;
+  w = (w << 15) | (w >> 17);
+  w *= 0x1b873593u;
+  h ^= w;
+  h = (h << 13) | (h >> 19);
+  return h * 5 + 0xe6546b64u;
+}
+
+uint32_t frame_fingerprint(const uint8_t *jpg, size_t len) {
+  if (!jpg || len == 0) return 0;
+  size_t start = scan_data_offset(jpg, len);
+
+  // word-align the start so every sample is a single aligned load
+  size_t misalign = (uintptr_t)(jpg + start) & 3;
+  if (misalign) start += 4 - misalign;
+  if (start >= len) start = len;
+  const uint32_t *words = (const uint32_t*)(jpg + start);
+  size_t nwords = (len - start) / 4;
+
+  uint32_t h = 2166136261u ^ (uint32_t)(len - start);
+  const size_t window_span = FP_WINDOWS * FP_WINDOW_WORDS;
+  if (nwords <= window_span) {
+    for (size_t i = 0; i < nwords; ++i) h = mix32(h, words[i]);
+  } else {
+    size_t stride = (nwords - FP_WINDOW_WORDS) / (FP_WINDOWS - 1);
+    for (size_t win = 0; win < FP_WINDOWS; ++win) {
+      const uint32_t *w = words + win * stride;
+      for (size_t i = 0; i < FP_WINDOW_WORDS; ++i) h = mix32(h, w[i]);
+    }
+  }
+  // trailing bytes that do not fill a word (end of scan, EOI)
+  for (size_t i = start + nwords * 4; i < len; ++i) h = mix32(h, jpg[i]);
+
+  h ^= h >> 16;
+  h *= 0x85ebca6bu;
+  h ^= h >> 13;
+  return h;
+}
@@ -0,0 +1,14 @@
+#ifndef FRAME_FINGERPRINT_H
+#define FRAME_FINGERPRINT_H
+
+#include <Arduino.h>
+
+// Fingerprint of a JPEG's entropy-coded scan data (everything after the SOS
+// segment). Headers and quantisation tables are identical from frame to frame,
+// so only the scan data says whether the picture changed. The scan data is
+// sampled in strided windows of aligned 32-bit words rather than hashed byte by
+// byte, so the cost is the same few dozen cache lines at any frame size.
+// Returns 0 for an empty buffer; non-JPEG input is sampled as a whole.
+uint32_t frame_fingerprint(const uint8_t *jpg, size_t len);
+
+#endif // FRAME_FINGERPRINT_H
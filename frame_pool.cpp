@@ -0,0 +1,84 @@
+#include "frame_pool.h"
+#include "esp_heap_caps.h"
+#include <atomic>
+
+// Slab ownership is one bit per slab in s_used; acquire claims the lowest
+// clear bit with compare-and-swap, release clears it. Nothing else is shared.
+
+static uint8_t *s_base = NULL;
+static size_t s_slabSize = 0;
+static size_t s_slabCount = 0;
+static std::atomic<uint32_t> s_used(0);
+static std::atomic<uint32_t> s_highWater(0);
+static std::atomic<uint32_t> s_failures(0);
+
+bool fpool_begin(framesize_t frame_size, size_t slab_count) {
+  if (s_base) return true;
+  if (slab_count == 0) return false;
+  if (slab_count > FPOOL_MAX_SLABS) slab_count = FPOOL_MAX_SLABS;
+
+  // The driver sizes JPEG frame buffers at width*height/5; allow a quarter
+  // so software-encoded frames at higher quality fit too. 4 KB aligned.
+  size_t size = (size_t)resolution[frame_size].width * resolution[frame_size].height / 4;
+  size = (size + 4095) & ~(size_t)4095;
+
+  s_base = (uint8_t*)heap_caps_malloc(size * slab_count, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  if (!s_base) {
+    // no PSRAM: fall back to internal RAM with as many slabs as fit
+    while (slab_count > 1 && !s_base) {
+      --slab_count;
+      s_base = (uint8_t*)heap_caps_malloc(size * slab_count, MALLOC_CAP_8BIT);
+    }
+  }
+  if (!s_base) {
+    Serial.println("fpool: no memory for frame slabs");
+    return false;
+  }
+  s_slabSize = size;
+  s_slabCount = slab_count;
+  Serial.printf("fpool: %u slabs of %u bytes\n", (unsigned)s_slabCount, (unsigned)s_slabSize);
+  return true;
+}
+
+uint8_t* fpool_acquire() {
+  if (!s_base) return NULL;
+  const uint32_t all = s_slabCount >= 32 ? 0xFFFFFFFFu : ((1u << s_slabCount) - 1);
+  uint32_t used = s_used.load(std::memory_order_relaxed);
+  while (true) {
+    uint32_t free_bits = ~used & all;
+    if (!free_bits) {
+      s_failures.fetch_add(1, std::memory_order_relaxed);
+      return NULL;
+    }
+    uint32_t bit = free_bits & (~free_bits + 1);  // lowest free slab
+    if (s_used.compare_exchange_weak(used, used | bit, std::memory_order_acquire, std::memory_order_relaxed)) {
+      uint32_t in_use = __builtin_popcount(used | bit);
+      uint32_t hw = s_highWater.load(std::memory_order_relaxed);
+      while (in_use > hw && !s_highWater.compare_exchange_weak(hw, in_use, std::memory_order_relaxed)) {
+      }
+      return s_base + (size_t)__builtin_ctz(bit) * s_slabSize;
+    }
+  }
+}
+
+void fpool_release(uint8_t *slab) {
+  if (!slab || !s_base) return;
+  size_t idx = slab < s_base ? s_slabCount : (size_t)(slab - s_base) / s_slabSize;
+  if (idx >= s_slabCount) {
+    Serial.println("fpool: release of a foreign buffer");
+    return;
+  }
+  s_used.fetch_and(~(1u << idx), std::memory_order_release);
+}
+
+size_t fpool_slabSize() {
+  return s_slabSize;
+}
+
+void fpool_getStats(FramePoolStats *stats) {
+  stats->slabs = s_slabCount;
+  stats->slab_size = s_slabSize;
+  stats->in_use = __builtin_popcount(s_used.load(std::memory_order_relaxed));
+  stats->high_water = s_highWater.load(std::memory_order_relaxed);
+  stats->failures = s_failures.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,32 @@
+#ifndef FRAME_POOL_H
+#define FRAME_POOL_H
+
+#include <Arduino.h>
+#include "esp_camera.h"
+
+// Fixed-size frame buffers carved out of one PSRAM allocation made at boot.
+// Every frame copy and conversion in the sketch uses a slab from here instead
+// of malloc/free per frame, so the heap layout never changes after setup().
+// fpool_acquire()/fpool_release() are lock-free and safe from any task.
+
+#define FPOOL_MAX_SLABS 32
+
+struct FramePoolStats {
+  size_t slabs;
+  size_t slab_size;
+  size_t in_use;
+  size_t high_water;   // most slabs ever in use at once
+  uint32_t failures;   // acquires that found the pool empty
+};
+
+// Allocate slab_count slabs, each large enough for one JPEG at frame_size.
+bool fpool_begin(framesize_t frame_size, size_t slab_count);
+
+// A free slab of fpool_slabSize() bytes, or NULL when all are in use.
+uint8_t* fpool_acquire();
+void fpool_release(uint8_t *slab);
+
+size_t fpool_slabSize();
+void fpool_getStats(FramePoolStats *stats);
+
+#endif // FRAME_POOL_H
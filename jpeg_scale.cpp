@@ -0,0 +1,155 @@
+#include "jpeg_scale.h"
+#include "esp_jpg_decode.h"
+#include "esp_heap_caps.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+// One RGB565 decode buffer is shared by every caller. It is sized once in
+// jpgscale_begin() for a 1/2-scale decode of the configured frame size (the
+// largest reduced image), so re-encoding never allocates. 1/2-scale SVGA
+// needs 240 KB.
+static SemaphoreHandle_t s_lock = NULL;
+static uint8_t *s_rgb = NULL;
+static size_t s_rgbCap = 0;
+
+struct DecodeCtx {
+  const uint8_t *src;
+  size_t len;
+  uint8_t *out;
+  size_t stride;     // luma rows only
+  uint16_t width;
+  uint16_t height;
+};
+
+static size_t mem_reader(void *arg, size_t index, uint8_t *buf, size_t len) {
+  DecodeCtx *ctx = (DecodeCtx*)arg;
+  if (index >= ctx->len) return 0;
+  if (index + len > ctx->len) len = ctx->len - index;
+  if (buf) memcpy(buf, ctx->src + index, len);
+  return len;
+}
+
+// TJpgDec hands over RGB888 blocks; store them as big-endian RGB565, the
+// layout fmt2jpg expects for camera RGB565 frames.
+static bool rgb565_writer(void *arg, uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint8_t *data) {
+  DecodeCtx *ctx = (DecodeCtx*)arg;
+  if (!data) return true; // start/end notifications
+  for (uint16_t row = 0; row < h && y + row < ctx->height; ++row) {
+    const uint8_t *in = data + (size_t)row * w * 3;
+    uint8_t *o = ctx->out + ((size_t)(y + row) * ctx->width + x) * 2;
+    for (uint16_t col = 0; col < w && x + col < ctx->width; ++col) {
+      uint16_t px = ((in[0] & 0xF8) << 8) | ((in[1] & 0xFC) << 3) | (in[2] >> 3);
+      o[0] = px >> 8;
+      o[1] = px & 0xFF;
+      o += 2;
+      in += 3;
+    }
+  }
+  return true;
+}
+
+// Y = 0.299 R + 0.587 G + 0.114 B in 8.8 fixed point
+static bool luma_writer(void *arg, uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint8_t *data) {
+  DecodeCtx *ctx = (DecodeCtx*)arg;
+  if (!data) return true;
+  for (uint16_t row = 0; row < h && y + row < ctx->height; ++row) {
+    const uint8_t *in = data + (size_t)row * w * 3;
+    uint8_t *o = ctx->out + (size_t)(y + row) * ctx->stride + x;
+    for (uint16_t col = 0; col < w && x + col < ctx->width; ++col) {
+      *o++ = (77 * in[0] + 150 * in[1] + 29 * in[2]) >> 8;
+      in += 3;
+    }
+  }
+  return true;
+}
+
+bool jpgscale_begin(framesize_t frame_size) {
+  if (!s_lock) s_lock = xSemaphoreCreateMutex();
+  if (!s_lock) return false;
+  if (s_rgb) return true;
+  size_t need = (size_t)(resolution[frame_size].width >> JPG_SCALE_2X) *
+                (resolution[frame_size].height >> JPG_SCALE_2X) * 2;
+  s_rgb = (uint8_t*)heap_caps_malloc(need, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  if (!s_rgb) {
+    Serial.printf("jpgscale: no memory for the %u byte decode buffer\n", (unsigned)need);
+    return false;
+  }
+  s_rgbCap = need;
+  return true;
+}
+
+bool jpgscale_getSize(const uint8_t *p, size_t len, uint16_t *width, uint16_t *height) {
+  if (len < 4 || p[0] != 0xFF || p[1] != 0xD8) return false;
+  size_t i = 2;
+  while (i + 4 <= len) {
+    if (p[i] != 0xFF) return false;
+    uint8_t marker = p[i + 1];
+    if (marker == 0xFF) { ++i; continue; }              // fill byte
+    if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7)) { i += 2; continue; }
+    if (marker == 0xDA || marker == 0xD9) return false; // scan data before any SOF
+    size_t seglen = ((size_t)p[i + 2] << 8) | p[i + 3];
+    bool sof = marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC;
+    if (sof) {
+      if (i + 9 > len) return false;
+      *height = ((uint16_t)p[i + 5] << 8) | p[i + 6];
+      *width = ((uint16_t)p[i + 7] << 8) | p[i + 8];
+      return *width && *height;
+    }
+    i += 2 + seglen;
+  }
+  return false;
+}
+
+bool jpgscale_downscale(const uint8_t *src, size_t len, jpg_scale_t scale, uint8_t quality,
+                        jpg_out_cb out, void *arg) {
+  uint16_t w, h;
+  if (!s_lock || !jpgscale_getSize(src, len, &w, &h)) return false;
+
+  DecodeCtx ctx;
+  ctx.src = src;
+  ctx.len = len;
+  ctx.width = w >> scale;
+  ctx.height = h >> scale;
+  if (!ctx.width || !ctx.height) return false;
+  size_t need = (size_t)ctx.width * ctx.height * 2;
+
+  if (need > s_rgbCap) {
+    // larger than the frame size jpgscale_begin() was given
+    Serial.printf("jpgscale: %ux%u does not fit the decode buffer\n", ctx.width, ctx.height);
+    return false;
+  }
+
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  ctx.out = s_rgb;
+
+  bool ok = esp_jpg_decode(len, scale, mem_reader, rgb565_writer, &ctx) == ESP_OK;
+  if (ok) ok = fmt2jpg_cb(s_rgb, need, ctx.width, ctx.height, PIXFORMAT_RGB565, quality, out, arg);
+  xSemaphoreGive(s_lock);
+  return ok;
+}
+
+bool jpgscale_luma(const uint8_t *src, size_t len, jpg_scale_t scale, uint8_t *out, size_t stride,
+                   uint16_t *out_w, uint16_t *out_h) {
+  uint16_t w, h;
+  if (!jpgscale_getSize(src, len, &w, &h)) return false;
+  w >>= scale;
+  h >>= scale;
+  if (!w || !h || w > *out_w || h > *out_h || w > stride) return false;
+
+  DecodeCtx ctx;
+  ctx.src = src;
+  ctx.len = len;
+  ctx.out = out;
+  ctx.stride = stride;
+  ctx.width = w;
+  ctx.height = h;
+  // esp_jpg_decode() works in a static buffer of its own: one decode at a time
+  if (!s_lock) return false;
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  bool ok = esp_jpg_decode(len, scale, mem_reader, luma_writer, &ctx) == ESP_OK;
+  xSemaphoreGive(s_lock);
+  if (!ok) return false;
+  *out_w = w;
+  *out_h = h;
+  return true;
+}
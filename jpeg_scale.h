@@ -0,0 +1,33 @@
+#ifndef JPEG_SCALE_H
+#define JPEG_SCALE_H
+
+#include <Arduino.h>
+#include "img_converters.h"
+#include "esp_camera.h"
+
+// Reduced-size JPEG re-encoding. Frames are decoded with the esp32-camera
+// TJpgDec wrapper at 1/2, 1/4 or 1/8 scale, which drops DCT coefficients
+// instead of decoding at full size and resampling, then encoded again.
+
+// Create the lock and allocate the shared decode buffer, sized for frames up
+// to frame_size. Call once from setup(), before anything scales.
+bool jpgscale_begin(framesize_t frame_size);
+
+// Read the frame dimensions from the SOFn marker.
+bool jpgscale_getSize(const uint8_t *jpg, size_t len, uint16_t *width, uint16_t *height);
+
+// Decode src at the given scale and stream the re-encoded JPEG to out (same
+// contract as fmt2jpg_cb). Calls are serialized; returns false if the input is
+// not a baseline JPEG or is larger than the frame size given to jpgscale_begin().
+bool jpgscale_downscale(const uint8_t *src, size_t len, jpg_scale_t scale, uint8_t quality,
+                        jpg_out_cb out, void *arg);
+
+// Decode src at the given scale into an 8-bit luma plane with rows stride
+// bytes apart. Fails if the scaled image is larger than out_w x out_h; on
+// success out_w/out_h hold the decoded size. Does not use the shared RGB
+// buffer, but esp_jpg_decode() keeps its work area in a static, so it is
+// serialized with jpgscale_downscale() on the same lock.
+bool jpgscale_luma(const uint8_t *src, size_t len, jpg_scale_t scale, uint8_t *out, size_t stride,
+                   uint16_t *out_w, uint16_t *out_h);
+
+#endif // JPEG_SCALE_H
@@ -0,0 +1,211 @@
+#include "motion_detector.h"
+#include "frame_broadcaster.h"
+#include "jpeg_scale.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+static uint8_t *s_cur = NULL;     // luma plane being decoded
+static uint8_t *s_prev = NULL;    // luma plane of the last compared frame
+static size_t s_stride = 0;
+static uint16_t s_maxW = 0;
+static uint16_t s_maxH = 0;
+static MotionCallback s_callback = NULL;
+static MotionConfig s_config;
+static MotionStats s_stats;
+static SemaphoreHandle_t s_lock = NULL;  // guards s_config and s_stats
+
+// ---------- SAD kernel ----------
+// a and b hold two pixels each, one per 16-bit lane (0x00XX00XX). Setting
+// bit 8 of every lane before subtracting keeps each lane's result in
+// 1..511, so no borrow crosses lanes; bit 8 is then set exactly where a >= b
+// and selects max - min per lane without a branch.
+static inline uint32_t absdiff_lanes(uint32_t a, uint32_t b) {
+  uint32_t d = (a | 0x01000100) - b;
+  uint32_t mask = ((d >> 8) & 0x00010001) * 0xFF;
+  uint32_t hi = (a & mask) | (b & ~mask);
+  uint32_t lo = (b & mask) | (a & ~mask);
+  return hi - lo;
+}
+
+uint32_t motion_blockSad8x8(const uint8_t *a, const uint8_t *b, size_t stride) {
+  // each 16-bit lane collects 32 differences of at most 255: no overflow
+  uint32_t acc = 0;
+  for (int row = 0; row < MOTION_BLOCK; ++row) {
+    const uint32_t *wa = (const uint32_t*)(a + row * stride);
+    const uint32_t *wb = (const uint32_t*)(b + row * stride);
+    for (int i = 0; i < MOTION_BLOCK / 4; ++i) {
+      uint32_t x = wa[i];
+      uint32_t y = wb[i];
+      acc += absdiff_lanes(x & 0x00FF00FF, y & 0x00FF00FF);
+      acc += absdiff_lanes((x >> 8) & 0x00FF00FF, (y >> 8) & 0x00FF00FF);
+    }
+  }
+  return (acc & 0xFFFF) + (acc >> 16);
+}
+
+// Changed blocks inside the mask between s_prev and s_cur.
+static uint16_t count_changed(const MotionConfig &cfg, uint16_t grid_w, uint16_t grid_h) {
+  const uint32_t limit = (uint32_t)cfg.threshold * MOTION_BLOCK * MOTION_BLOCK;
+  uint16_t changed = 0;
+  for (uint16_t by = 0; by < grid_h; ++by) {
+    uint32_t row_mask = cfg.mask[by];
+    if (!row_mask) continue;
+    size_t row_off = (size_t)by * MOTION_BLOCK * s_stride;
+    for (uint16_t bx = 0; bx < grid_w; ++bx) {
+      if (!(row_mask & (1u << bx))) continue;
+      size_t off = row_off + bx * MOTION_BLOCK;
+      if (motion_blockSad8x8(s_cur + off, s_prev + off, s_stride) > limit) changed++;
+    }
+  }
+  return changed;
+}
+
+// ---------- task ----------
+static void motion_task(void *arg) {
+  (void)arg;
+  uint32_t last_seq = 0;
+  bool have_prev = false;
+  uint16_t prev_w = 0, prev_h = 0;
+  int64_t next_allowed = 0;
+  int64_t last_event = 0;
+  int64_t last_report = esp_timer_get_time();
+  uint64_t busy_us = 0;   // since the last report
+  MotionConfig cfg;
+
+  while (true) {
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    bool enabled = s_config.enabled;
+    xSemaphoreGive(s_lock);
+    if (!enabled) {
+      have_prev = false;   // compare afresh once re-enabled
+      vTaskDelay(pdMS_TO_TICKS(500));
+      continue;
+    }
+
+    SharedFrame *frame = fbc_waitNewer(last_seq, 1000);
+    if (!frame) continue;
+    last_seq = frame->seq;
+    int64_t t0 = esp_timer_get_time();
+    if (t0 < next_allowed) {
+      fbc_release(frame);
+      xSemaphoreTake(s_lock, portMAX_DELAY);
+      s_stats.skipped++;
+      xSemaphoreGive(s_lock);
+      continue;
+    }
+
+    uint16_t w = s_maxW, h = s_maxH;
+    bool ok = jpgscale_luma(frame->buf, frame->len, JPG_SCALE_8X, s_cur, s_stride, &w, &h);
+    fbc_release(frame);
+    if (!ok) continue;
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    cfg = s_config;
+    xSemaphoreGive(s_lock);
+
+    uint16_t grid_w = min(w / MOTION_BLOCK, MOTION_GRID_MAX);
+    uint16_t grid_h = min(h / MOTION_BLOCK, MOTION_GRID_MAX);
+    bool compared = have_prev && w == prev_w && h == prev_h;
+    uint16_t changed = compared ? count_changed(cfg, grid_w, grid_h) : 0;
+    uint8_t *t = s_prev;
+    s_prev = s_cur;
+    s_cur = t;
+    have_prev = true;
+    prev_w = w;
+    prev_h = h;
+
+    // stay within the budget: a frame that took t us buys t * 100 / pct of wall time
+    int64_t now = esp_timer_get_time();
+    int64_t elapsed = now - t0;
+    next_allowed = t0 + elapsed * 100 / MOTION_CPU_BUDGET_PCT;
+    busy_us += elapsed;
+
+    bool fire = compared && changed >= cfg.min_blocks &&
+                (last_event == 0 || now - last_event >= (int64_t)cfg.cooldown_ms * 1000);
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if (compared) s_stats.frames++;
+    s_stats.avg_us = s_stats.avg_us ? (s_stats.avg_us * 7 + (uint32_t)elapsed) / 8 : (uint32_t)elapsed;
+    s_stats.grid_w = grid_w;
+    s_stats.grid_h = grid_h;
+    s_stats.last_changed = changed;
+    if (fire) s_stats.events++;
+    MotionStats snapshot = s_stats;
+    xSemaphoreGive(s_lock);
+
+    if (fire) {
+      last_event = now;
+      Serial.printf("motion: %u of %u blocks changed in frame #%u\n", changed, grid_w * grid_h, (unsigned)last_seq);
+      if (s_callback) s_callback(changed);
+    }
+
+    if (now - last_report >= (int64_t)MOTION_STATS_INTERVAL_MS * 1000) {
+      Serial.printf("motion: %u frames, %u skipped for budget, %u us/frame, %u%% CPU, %u events\n",
+                    (unsigned)snapshot.frames, (unsigned)snapshot.skipped, (unsigned)snapshot.avg_us,
+                    (unsigned)(busy_us * 100 / (now - last_report)), (unsigned)snapshot.events);
+      last_report = now;
+      busy_us = 0;
+    }
+  }
+}
+
+// ---------- public API ----------
+bool motion_begin(framesize_t frame_size, MotionCallback on_motion, bool enabled) {
+  if (s_lock) return true;
+  s_maxW = resolution[frame_size].width / 8;
+  s_maxH = resolution[frame_size].height / 8;
+  s_stride = (s_maxW + 3) & ~(size_t)3;   // keeps every block row word aligned
+  // internal RAM: the compare touches every byte of both planes per frame
+  s_cur = (uint8_t*)heap_caps_malloc(s_stride * s_maxH, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+  s_prev = (uint8_t*)heap_caps_malloc(s_stride * s_maxH, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+  s_lock = xSemaphoreCreateMutex();
+  if (!s_cur || !s_prev || !s_lock) {
+    Serial.println("motion: no memory for luma planes");
+    return false;
+  }
+  s_callback = on_motion;
+  s_config.enabled = enabled;
+  s_config.threshold = 12;
+  s_config.min_blocks = 3;
+  s_config.cooldown_ms = 30000;
+  for (int i = 0; i < MOTION_GRID_MAX; ++i) s_config.mask[i] = 0xFFFFFFFFu;
+  memset(&s_stats, 0, sizeof(s_stats));
+
+  if (xTaskCreate(motion_task, "motion", 4096, NULL, 1, NULL) != pdPASS) {
+    Serial.println("motion: failed to start task");
+    return false;
+  }
+  Serial.printf("motion: %ux%u luma, %ux%u blocks, %s\n", s_maxW, s_maxH,
+                min(s_maxW / MOTION_BLOCK, MOTION_GRID_MAX), min(s_maxH / MOTION_BLOCK, MOTION_GRID_MAX),
+                enabled ? "enabled" : "disabled");
+  return true;
+}
+
+void motion_getConfig(MotionConfig *config) {
+  if (!s_lock) {
+    memset(config, 0, sizeof(*config));
+    return;
+  }
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  *config = s_config;
+  xSemaphoreGive(s_lock);
+}
+
+void motion_setConfig(const MotionConfig *config) {
+  if (!s_lock) return;
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  s_config = *config;
+  xSemaphoreGive(s_lock);
+}
+
+void motion_getStats(MotionStats *stats) {
+  if (!s_lock) {
+    memset(stats, 0, sizeof(*stats));
+    return;
+  }
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  *stats = s_stats;
+  xSemaphoreGive(s_lock);
+}
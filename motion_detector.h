@@ -0,0 +1,52 @@
+#ifndef MOTION_DETECTOR_H
+#define MOTION_DETECTOR_H
+
+#include <Arduino.h>
+#include "esp_camera.h"
+
+// Motion detection on the stream frames. Each frame is decoded at 1/8 scale
+// straight into a luma plane (no full-size decode), split into 8x8 blocks and
+// compared with the previous plane by sum of absolute differences. A block
+// whose mean difference exceeds the threshold counts as changed; enough
+// changed blocks inside the region mask fire the callback, at most once per
+// cooldown. The detector runs at stream rate but skips frames whenever it
+// would use more than MOTION_CPU_BUDGET_PCT of a core.
+
+#define MOTION_BLOCK 8                 // block edge in luma pixels
+#define MOTION_GRID_MAX 32             // blocks per row and column the mask can describe
+#define MOTION_CPU_BUDGET_PCT 15
+#define MOTION_STATS_INTERVAL_MS 60000 // Serial summary period
+
+struct MotionConfig {
+  bool enabled;                   // off: no decoding, no events
+  uint8_t threshold;              // mean absolute luma difference per pixel for a changed block
+  uint16_t min_blocks;            // changed blocks inside the mask that make an event
+  uint32_t cooldown_ms;           // minimum time between events
+  uint32_t mask[MOTION_GRID_MAX]; // bit x of mask[y] enables block (x, y)
+};
+
+struct MotionStats {
+  uint32_t frames;         // frames compared
+  uint32_t skipped;        // frames skipped to stay within the CPU budget
+  uint32_t events;
+  uint32_t avg_us;         // decode + compare time per frame, running average
+  uint16_t grid_w;         // blocks per row / column at the current frame size
+  uint16_t grid_h;
+  uint16_t last_changed;   // changed blocks in the most recent frame
+};
+
+typedef void (*MotionCallback)(uint16_t changed_blocks);
+
+// Allocate the luma planes for frame_size and start the detector task.
+// enabled is the initial MotionConfig::enabled; /motion can change it.
+bool motion_begin(framesize_t frame_size, MotionCallback on_motion, bool enabled);
+
+void motion_getConfig(MotionConfig *config);
+void motion_setConfig(const MotionConfig *config);
+void motion_getStats(MotionStats *stats);
+
+// SAD of one 8x8 block. a and b must be 4-byte aligned and stride a multiple
+// of 4; pixels are processed two per 16-bit lane, four per 32-bit load.
+uint32_t motion_blockSad8x8(const uint8_t *a, const uint8_t *b, size_t stride);
+
+#endif // MOTION_DETECTOR_H
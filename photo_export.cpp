@@ -0,0 +1,391 @@
+#include "photo_export.h"
+#include "capture_catalog.h"
+#include "frame_pool.h"
+#include "esp_heap_caps.h"
+#include "esp_rom_crc.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define EXPORT_SECTOR 512            // card sector, and the TAR block size
+#define EXPORT_BATCH 16              // catalog records read at a time
+#define EXPORT_SKIPPED 0xFFFFFFFFu   // table size of a photo that was not written
+#define ZIP_MAX_ENTRIES 0xFFFF
+#define ZIP_MAX_OFFSET 0xFFFFFFFFull
+#define ZIP_LOCAL_SIZE 30
+#define ZIP_DESCRIPTOR_SIZE 16
+#define ZIP_CENTRAL_SIZE 46
+#define ZIP_END_SIZE 22
+#define ZIP_VERSION 20               // 2.0: data descriptors
+#define ZIP_FLAG_DESCRIPTOR 0x0008   // CRC and sizes follow the data
+
+struct ExportTask {
+  httpd_req_t *req;
+  ExportRun run;
+  void *arg;
+};
+
+struct ExportEntry {
+  uint32_t crc;
+  uint32_t size;
+  uint32_t offset;   // of the local header
+};
+
+// The archive as it goes out: bytes collect in buf and go to the sink when
+// it is full. total counts what the sink has taken, so the archive offset of
+// the next byte is total + len.
+struct ExportOut {
+  ExportSink sink;
+  void *arg;
+  uint8_t *buf;
+  size_t cap;
+  size_t len;
+  uint64_t total;
+  bool ok;
+};
+
+static SemaphoreHandle_t s_lock = NULL;   // held for a whole export
+static QueueHandle_t s_queue = NULL;      // detached requests for the export task
+static SemaphoreHandle_t s_idle = NULL;   // taken while the export task has a request
+static ExportStats s_stats;
+static portMUX_TYPE s_statsMux = portMUX_INITIALIZER_UNLOCKED;
+static const uint8_t s_zeros[EXPORT_SECTOR] = { 0 };
+
+static void put16(uint8_t *p, uint16_t v) {
+  p[0] = v; p[1] = v >> 8;
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+  p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+}
+
+static void out_flush(ExportOut &o) {
+  if (o.ok && o.len) o.ok = o.sink(o.arg, o.buf, o.len);
+  o.total += o.len;
+  o.len = 0;
+}
+
+static void out_put(ExportOut &o, const void *data, size_t n) {
+  const uint8_t *p = (const uint8_t*)data;
+  while (n && o.ok) {
+    if (o.len == o.cap) out_flush(o);
+    size_t k = n < o.cap - o.len ? n : o.cap - o.len;
+    memcpy(o.buf + o.len, p, k);
+    o.len += k;
+    p += k;
+    n -= k;
+  }
+}
+
+// Append size bytes of fd, reading straight into the chunk. Reads start at a
+// word-aligned address and cover whole sectors, so FatFs passes them to the
+// SDMMC driver as multi-sector DMA instead of one bounced sector at a time.
+static bool out_file(ExportOut &o, int fd, uint32_t size, uint32_t *crc) {
+  uint32_t c = 0;
+  while (size && o.ok) {
+    if ((o.len & 3) || o.cap - o.len < EXPORT_SECTOR) out_flush(o);
+    size_t k = (o.cap - o.len) & ~(size_t)(EXPORT_SECTOR - 1);
+    if (k > size) k = size;
+    if (read(fd, o.buf + o.len, k) != (ssize_t)k) return false;
+    c = esp_rom_crc32_le(c, o.buf + o.len, k);
+    o.len += k;
+    size -= k;
+  }
+  *crc = c;
+  return o.ok;
+}
+
+static void dos_time(int64_t t, uint16_t *time_out, uint16_t *date_out) {
+  time_t tt = (time_t)t;
+  struct tm tm;
+  localtime_r(&tt, &tm);
+  if (tm.tm_year < 80) {   // before the DOS epoch, e.g. a capture_N.jpg taken before NTP
+    *time_out = 0;
+    *date_out = (1 << 5) | 1;
+    return;
+  }
+  *time_out = (tm.tm_hour << 11) | (tm.tm_min << 5) | (tm.tm_sec / 2);
+  *date_out = ((tm.tm_year - 80) << 9) | ((tm.tm_mon + 1) << 5) | tm.tm_mday;
+}
+
+static void tar_header(uint8_t *h, const CatalogRecord &r, uint32_t size) {
+  memset(h, 0, EXPORT_SECTOR);
+  strlcpy((char*)h, r.name, 100);
+  memcpy(h + 100, "0000644", 8);
+  memcpy(h + 108, "0000000", 8);
+  memcpy(h + 116, "0000000", 8);
+  snprintf((char*)h + 124, 12, "%011o", (unsigned)size);
+  snprintf((char*)h + 136, 12, "%011llo", (unsigned long long)(r.time > 0 ? r.time : 0));
+  h[156] = '0';
+  memcpy(h + 257, "ustar", 6);
+  memcpy(h + 263, "00", 2);
+  memset(h + 148, ' ', 8);   // the checksum counts its own field as spaces
+  unsigned sum = 0;
+  for (int i = 0; i < EXPORT_SECTOR; ++i) sum += h[i];
+  snprintf((char*)h + 148, 8, "%06o", sum);   // six digits, NUL, and the space left above
+}
+
+// Add one photo. Returns false if it was skipped (missing, or it would take
+// a ZIP past 4 GB) or the export failed, which clears o.ok.
+static bool add_file(ExportOut &o, const CatalogRecord &r, ExportFormat fmt, ExportEntry *e) {
+  char path[16 + CATALOG_NAME_LEN];
+  snprintf(path, sizeof(path), "/sdcard/%s", r.name);
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return false;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (uint64_t)st.st_size > UINT32_MAX) {
+    close(fd);
+    return false;
+  }
+  uint32_t size = st.st_size;
+  size_t nl = strlen(r.name);
+  uint64_t offset = o.total + o.len;
+  uint32_t crc;
+
+  if (fmt == EXPORT_ZIP) {
+    if (offset + ZIP_LOCAL_SIZE + nl + size + ZIP_DESCRIPTOR_SIZE >= ZIP_MAX_OFFSET) {
+      close(fd);
+      return false;
+    }
+    uint8_t h[ZIP_LOCAL_SIZE + CATALOG_NAME_LEN];
+    uint16_t t, d;
+    dos_time(r.time, &t, &d);
+    put32(h, 0x04034b50);
+    put16(h + 4, ZIP_VERSION);
+    put16(h + 6, ZIP_FLAG_DESCRIPTOR);
+    put16(h + 8, 0);              // stored
+    put16(h + 10, t);
+    put16(h + 12, d);
+    memset(h + 14, 0, 12);        // CRC and sizes are in the descriptor
+    put16(h + 26, nl);
+    put16(h + 28, 0);
+    memcpy(h + ZIP_LOCAL_SIZE, r.name, nl);
+    out_put(o, h, ZIP_LOCAL_SIZE + nl);
+    bool ok = out_file(o, fd, size, &crc);
+    close(fd);
+    if (!ok) {
+      o.ok = false;
+      return false;
+    }
+    uint8_t dd[ZIP_DESCRIPTOR_SIZE];
+    put32(dd, 0x08074b50);
+    put32(dd + 4, crc);
+    put32(dd + 8, size);
+    put32(dd + 12, size);
+    out_put(o, dd, sizeof(dd));
+    e->crc = crc;
+    e->size = size;
+    e->offset = (uint32_t)offset;
+  } else {
+    uint8_t h[EXPORT_SECTOR];
+    tar_header(h, r, size);
+    out_put(o, h, sizeof(h));
+    bool ok = out_file(o, fd, size, &crc);
+    close(fd);
+    if (!ok) {
+      o.ok = false;
+      return false;
+    }
+    out_put(o, s_zeros, (EXPORT_SECTOR - size % EXPORT_SECTOR) % EXPORT_SECTOR);
+  }
+  return o.ok;
+}
+
+static void zip_central(ExportOut &o, const CatalogRecord &r, const ExportEntry &e) {
+  size_t nl = strlen(r.name);
+  uint8_t h[ZIP_CENTRAL_SIZE + CATALOG_NAME_LEN];
+  uint16_t t, d;
+  dos_time(r.time, &t, &d);
+  put32(h, 0x02014b50);
+  put16(h + 4, ZIP_VERSION);      // made by: 2.0, MS-DOS attributes
+  put16(h + 6, ZIP_VERSION);
+  put16(h + 8, ZIP_FLAG_DESCRIPTOR);
+  put16(h + 10, 0);
+  put16(h + 12, t);
+  put16(h + 14, d);
+  put32(h + 16, e.crc);
+  put32(h + 20, e.size);
+  put32(h + 24, e.size);
+  put16(h + 28, nl);
+  memset(h + 30, 0, 12);          // extra, comment, disk, attributes
+  put32(h + 42, e.offset);
+  memcpy(h + ZIP_CENTRAL_SIZE, r.name, nl);
+  out_put(o, h, ZIP_CENTRAL_SIZE + nl);
+}
+
+static void zip_end(ExportOut &o, uint16_t entries, uint32_t cd_offset, uint32_t cd_size) {
+  uint8_t h[ZIP_END_SIZE];
+  put32(h, 0x06054b50);
+  put16(h + 4, 0);
+  put16(h + 6, 0);
+  put16(h + 8, entries);
+  put16(h + 10, entries);
+  put32(h + 12, cd_size);
+  put32(h + 16, cd_offset);
+  put16(h + 20, 0);
+  out_put(o, h, sizeof(h));
+}
+
+static void export_task(void *arg) {
+  (void)arg;
+  while (true) {
+    ExportTask t;
+    if (xQueueReceive(s_queue, &t, portMAX_DELAY) != pdTRUE) continue;
+    // an archive cut short has no final chunk: close so the client sees the error
+    if (t.run(t.req, t.arg) != ESP_OK) httpd_sess_trigger_close(t.req->handle, httpd_req_to_sockfd(t.req));
+    httpd_req_async_handler_complete(t.req);
+    xSemaphoreGive(s_idle);
+  }
+}
+
+bool export_begin() {
+  if (s_queue) return true;
+  if (!s_lock) s_lock = xSemaphoreCreateMutex();
+  s_queue = xQueueCreate(1, sizeof(ExportTask));
+  s_idle = xSemaphoreCreateBinary();
+  if (!s_lock || !s_queue || !s_idle) return false;
+  xSemaphoreGive(s_idle);
+  // below the httpd task, like the stream workers, so control requests win the CPU
+  return xTaskCreate(export_task, "export", EXPORT_TASK_STACK, NULL, 3, NULL) == pdPASS;
+}
+
+esp_err_t export_submit(httpd_req_t *req, ExportRun run, void *arg) {
+  if (!s_queue) return ESP_ERR_INVALID_STATE;
+  if (xSemaphoreTake(s_idle, 0) != pdTRUE) return ESP_ERR_NO_MEM;
+  ExportTask t = { NULL, run, arg };
+  esp_err_t err = httpd_req_async_handler_begin(req, &t.req);
+  if (err != ESP_OK) {
+    xSemaphoreGive(s_idle);
+    return err;
+  }
+  if (xQueueSend(s_queue, &t, 0) != pdTRUE) {
+    // cannot happen while the task is idle
+    httpd_req_async_handler_complete(t.req);
+    xSemaphoreGive(s_idle);
+    return ESP_FAIL;
+  }
+  return ESP_OK;
+}
+
+size_t export_fit(uint32_t first_seq, uint32_t end_seq, ExportFormat fmt) {
+  if (end_seq <= first_seq) return 0;
+  if (fmt == EXPORT_TAR) return end_seq - first_seq;
+
+  size_t max_files = fpool_slabSize() / sizeof(ExportEntry);
+  if (max_files > ZIP_MAX_ENTRIES) max_files = ZIP_MAX_ENTRIES;
+  uint64_t bytes = ZIP_END_SIZE;
+  CatalogRecord recs[EXPORT_BATCH];
+  size_t n = 0;
+  for (uint32_t seq = first_seq; seq < end_seq && n < max_files; ) {
+    size_t k = end_seq - seq < EXPORT_BATCH ? end_seq - seq : EXPORT_BATCH;
+    size_t got = catalog_readSeq(seq, recs, k);
+    if (got == 0) break;
+    for (size_t j = 0; j < got && n < max_files; ++j) {
+      // a record removed meanwhile still counts towards the range, at no size
+      if (recs[j].seq >= end_seq) return end_seq - first_seq;
+      size_t nl = strlen(recs[j].name);
+      bytes += ZIP_LOCAL_SIZE + nl + recs[j].size + ZIP_DESCRIPTOR_SIZE + ZIP_CENTRAL_SIZE + nl;
+      if (bytes >= ZIP_MAX_OFFSET) return recs[j].seq - first_seq;
+      n = recs[j].seq - first_seq + 1;
+    }
+    seq = recs[got - 1].seq + 1;
+  }
+  return n < max_files ? n : max_files;
+}
+
+ExportResult export_write(uint32_t first_seq, size_t count, ExportFormat fmt, ExportSink sink, void *arg) {
+  if (!s_lock || xSemaphoreTake(s_lock, 0) != pdTRUE) return EXPORT_BUSY;
+
+  // internal, DMA-capable memory; shrink towards 4 KB if it is short
+  ExportOut o = { sink, arg, NULL, 0, 0, 0, true };
+  for (o.cap = EXPORT_CHUNK; o.cap >= 4096; o.cap /= 2) {
+    o.buf = (uint8_t*)heap_caps_malloc(o.cap, MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL);
+    if (o.buf) break;
+  }
+  ExportEntry *table = NULL;
+  if (o.buf && fmt == EXPORT_ZIP) {
+    table = (ExportEntry*)fpool_acquire();
+    size_t max_files = fpool_slabSize() / sizeof(ExportEntry);
+    if (count > max_files) count = max_files;
+  }
+  if (!o.buf || (fmt == EXPORT_ZIP && !table)) {
+    if (o.buf) heap_caps_free(o.buf);
+    xSemaphoreGive(s_lock);
+    return EXPORT_BUSY;
+  }
+
+  int64_t t0 = esp_timer_get_time();
+  CatalogRecord recs[EXPORT_BATCH];
+  uint32_t end_seq = first_seq + count;
+  if (table) {
+    for (size_t i = 0; i < count; ++i) table[i].size = EXPORT_SKIPPED;
+  }
+
+  // Walk by sequence rather than position: retention may drop the oldest
+  // records while the archive is going out, which shifts positions.
+  uint32_t files = 0;
+  for (uint32_t seq = first_seq; seq < end_seq && o.ok; ) {
+    size_t k = end_seq - seq < EXPORT_BATCH ? end_seq - seq : EXPORT_BATCH;
+    size_t got = catalog_readSeq(seq, recs, k);
+    if (got == 0) break;
+    for (size_t j = 0; j < got && o.ok && seq < end_seq; ++j) {
+      const CatalogRecord &r = recs[j];
+      seq = r.seq + 1;
+      if (r.seq >= end_seq) break;
+      if (add_file(o, r, fmt, table ? &table[r.seq - first_seq] : NULL)) files++;
+    }
+  }
+
+  if (fmt == EXPORT_ZIP) {
+    // A photo whose record went before this pass is in the archive but not
+    // in the directory, so unzip skips it.
+    uint32_t cd_offset = (uint32_t)(o.total + o.len);
+    uint16_t entries = 0;
+    for (uint32_t seq = first_seq; seq < end_seq && o.ok; ) {
+      size_t k = end_seq - seq < EXPORT_BATCH ? end_seq - seq : EXPORT_BATCH;
+      size_t got = catalog_readSeq(seq, recs, k);
+      if (got == 0) break;
+      for (size_t j = 0; j < got && seq < end_seq; ++j) {
+        const CatalogRecord &r = recs[j];
+        seq = r.seq + 1;
+        if (r.seq >= end_seq) break;
+        const ExportEntry &e = table[r.seq - first_seq];
+        if (e.size == EXPORT_SKIPPED) continue;
+        zip_central(o, r, e);
+        entries++;
+      }
+    }
+    zip_end(o, entries, cd_offset, (uint32_t)(o.total + o.len - cd_offset));
+    fpool_release((uint8_t*)table);
+  } else {
+    out_put(o, s_zeros, EXPORT_SECTOR);   // end of archive: two zero blocks
+    out_put(o, s_zeros, EXPORT_SECTOR);
+  }
+  out_flush(o);
+  heap_caps_free(o.buf);
+
+  int64_t us = esp_timer_get_time() - t0;
+  uint32_t kbps = us > 0 ? (uint32_t)(o.total * 1000000 / us / 1024) : 0;
+  taskENTER_CRITICAL(&s_statsMux);
+  if (o.ok) s_stats.exports++;
+  else s_stats.failures++;
+  s_stats.files += files;
+  s_stats.bytes += o.total;
+  s_stats.last_kbps = kbps;
+  taskEXIT_CRITICAL(&s_statsMux);
+  Serial.printf("export: %u files, %u KB in %u ms (%u KB/s)%s\n", (unsigned)files, (unsigned)(o.total / 1024),
+                (unsigned)(us / 1000), (unsigned)kbps, o.ok ? "" : ", aborted");
+  xSemaphoreGive(s_lock);
+  return o.ok ? EXPORT_OK : EXPORT_FAILED;
+}
+
+void export_getStats(ExportStats *stats) {
+  taskENTER_CRITICAL(&s_statsMux);
+  *stats = s_stats;
+  taskEXIT_CRITICAL(&s_statsMux);
+}
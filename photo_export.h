@@ -0,0 +1,76 @@
+#ifndef PHOTO_EXPORT_H
+#define PHOTO_EXPORT_H
+
+#include <Arduino.h>
+#include "esp_http_server.h"
+
+// Archives of a range of catalog records, built while they are sent: a
+// store-only ZIP (local headers with a data descriptor after each file,
+// CRC-32 computed while the file streams through, central directory at the
+// end) or a ustar TAR. Nothing is written to the card and nothing is
+// buffered beyond one read chunk, so a day or a week of photos comes off in
+// one request at close to the card's read speed.
+//
+// Files are read into one internal, DMA-capable chunk (EXPORT_CHUNK, smaller
+// if internal memory is short), in whole sectors at word-aligned addresses,
+// so SDMMC transfers straight into it. A ZIP also borrows a frame_pool slab
+// for its per-file table (CRC, size, offset) until the central directory is
+// out. One export runs at a time.
+//
+// esp_http_server runs every handler on its one worker task, so an archive
+// sent from a handler would hold up every other request until it is out.
+// export_submit() detaches the request (httpd_req_async_handler_begin(), as
+// stream sessions do) and sends it from the export task instead.
+
+#define EXPORT_CHUNK (16 * 1024)
+#define EXPORT_TASK_STACK 6144
+
+enum ExportFormat {
+  EXPORT_ZIP,
+  EXPORT_TAR
+};
+
+// Receives the archive in order; returning false aborts the export.
+typedef bool (*ExportSink)(void *arg, const uint8_t *data, size_t len);
+
+enum ExportResult {
+  EXPORT_OK,
+  EXPORT_BUSY,       // another export is running, or no memory; nothing was sent
+  EXPORT_FAILED      // the sink or a read failed part way; the archive is cut short
+};
+
+struct ExportStats {
+  uint32_t exports;     // completed
+  uint32_t failures;
+  uint32_t files;
+  uint64_t bytes;
+  uint32_t last_kbps;   // archive bytes per second of the last export
+};
+
+// Sends one detached request on the export task. ESP_OK when the whole
+// response went out; otherwise the connection is closed.
+typedef esp_err_t (*ExportRun)(httpd_req_t *req, void *arg);
+
+// Create the lock and start the export task.
+bool export_begin();
+
+// Hand req to the export task, which calls run(req, arg). On ESP_OK req has
+// been detached from the httpd worker and run owns arg; the caller must
+// return without touching req again. ESP_ERR_NO_MEM means an export is
+// already running and the caller still owns req and arg.
+esp_err_t export_submit(httpd_req_t *req, ExportRun run, void *arg);
+
+// How many of the catalog sequences [first_seq, end_seq) fit in one archive,
+// from the first. A ZIP is limited by its table (one slab), 65535 entries
+// and 32-bit offsets (no ZIP64); a TAR holds them all.
+size_t export_fit(uint32_t first_seq, uint32_t end_seq, ExportFormat fmt);
+
+// Write the archive of the count sequences from first_seq to sink. Photos
+// are named as in the catalog ("2025/01/02/103000.jpg"); one that has gone
+// missing since it was catalogued, or whose record retention has removed,
+// is left out.
+ExportResult export_write(uint32_t first_seq, size_t count, ExportFormat fmt, ExportSink sink, void *arg);
+
+void export_getStats(ExportStats *stats);
+
+#endif // PHOTO_EXPORT_H
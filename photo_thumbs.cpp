@@ -0,0 +1,128 @@
+#include "photo_thumbs.h"
+#include "frame_pool.h"
+#include "jpeg_scale.h"
+#include "sd_writer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include <fcntl.h>
+#include <unistd.h>
+
+// An eager thumbnail is written before its photo is closed (and dated) in
+// group mode, so it may look a little older than the photo.
+#define THUMB_MTIME_SLACK_S 10
+
+static bool s_eager = false;
+static ThumbStats s_stats;
+static SemaphoreHandle_t s_lock = NULL;   // one thumbnail at a time; guards s_stats
+
+struct ThumbOut {
+  uint8_t *buf;
+  size_t cap;
+  size_t len;
+};
+
+static size_t thumb_out(void *arg, size_t index, const void *data, size_t len) {
+  ThumbOut *o = (ThumbOut*)arg;
+  if (!data || index + len > o->cap) return 0;
+  memcpy(o->buf + index, data, len);
+  if (index + len > o->len) o->len = index + len;
+  return len;
+}
+
+// Encode the thumbnail of jpg and write it to path (s_lock held). The file is
+// written under a temporary name and renamed, so a reset never leaves a torn
+// thumbnail that looks newer than its photo.
+static bool make_thumb(const char *path, const uint8_t *jpg, size_t len) {
+  uint8_t *slab = fpool_acquire();
+  if (!slab) return false;
+  ThumbOut o = { slab, fpool_slabSize(), 0 };
+  bool ok = jpgscale_downscale(jpg, len, JPG_SCALE_8X, THUMB_QUALITY, thumb_out, &o) && o.len;
+
+  char tmp[80];
+  snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+  if (ok) ok = sdwr_makeDirs(tmp);
+  int fd = ok ? open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644) : -1;
+  if (fd >= 0) {
+    ok = write(fd, o.buf, o.len) == (ssize_t)o.len;
+    if (close(fd) != 0) ok = false;
+    // FatFs rename does not replace an existing file
+    unlink(path);
+    if (ok) ok = rename(tmp, path) == 0;
+    if (!ok) unlink(tmp);
+  } else {
+    ok = false;
+  }
+  fpool_release(slab);
+  return ok;
+}
+
+bool thumb_begin(bool eager) {
+  if (!s_lock) s_lock = xSemaphoreCreateMutex();
+  if (!s_lock) return false;
+  s_eager = eager;
+  memset(&s_stats, 0, sizeof(s_stats));
+  return true;
+}
+
+void thumb_path(const char *photo_path, char *out, size_t n) {
+  const char *rel = photo_path;
+  if (strncmp(rel, "/sdcard/", 8) == 0) rel += 8;
+  while (*rel == '/') rel++;
+  snprintf(out, n, "%s/%s", THUMB_DIR, rel);
+}
+
+void thumb_store(const char *photo_path, const uint8_t *jpg, size_t len) {
+  if (!s_eager || !s_lock) return;
+  char path[80];
+  thumb_path(photo_path, path, sizeof(path));
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  bool ok = make_thumb(path, jpg, len);
+  if (ok) s_stats.eager++;
+  else s_stats.failures++;
+  xSemaphoreGive(s_lock);
+}
+
+bool thumb_get(const char *photo_path, char *out, size_t n, struct stat *st) {
+  if (!s_lock) return false;
+  struct stat photo;
+  if (stat(photo_path, &photo) != 0) return false;
+  thumb_path(photo_path, out, n);
+
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  // numbered names are reused after a reboot: a newer photo needs a new thumbnail
+  bool ok = stat(out, st) == 0 && st->st_mtime + THUMB_MTIME_SLACK_S >= photo.st_mtime;
+  if (ok) {
+    s_stats.hits++;
+  } else if ((size_t)photo.st_size <= fpool_slabSize()) {
+    uint8_t *jpg = fpool_acquire();
+    int fd = jpg ? open(photo_path, O_RDONLY) : -1;
+    if (fd >= 0) {
+      ok = read(fd, jpg, photo.st_size) == (ssize_t)photo.st_size;
+      close(fd);
+    }
+    if (ok) ok = make_thumb(out, jpg, photo.st_size) && stat(out, st) == 0;
+    if (jpg) fpool_release(jpg);
+    if (ok) s_stats.made++;
+    else s_stats.failures++;
+  } else {
+    s_stats.failures++;
+  }
+  xSemaphoreGive(s_lock);
+  return ok;
+}
+
+void thumb_remove(const char *photo_path) {
+  char path[80];
+  thumb_path(photo_path, path, sizeof(path));
+  unlink(path);
+}
+
+void thumb_getStats(ThumbStats *stats) {
+  if (!s_lock) {
+    memset(stats, 0, sizeof(*stats));
+    return;
+  }
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  *stats = s_stats;
+  xSemaphoreGive(s_lock);
+}
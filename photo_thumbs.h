@@ -0,0 +1,46 @@
+#ifndef PHOTO_THUMBS_H
+#define PHOTO_THUMBS_H
+
+#include <Arduino.h>
+#include <sys/stat.h>
+
+// Thumbnail cache for the photo archive. A thumbnail is the photo decoded at
+// 1/8 scale in the DCT domain (jpgscale_downscale(), so no full-size decode)
+// and encoded again: 100x75 and a few KB for an SVGA photo. Thumbnails live
+// under THUMB_DIR with the photo's relative path, are made the first time
+// they are asked for, or straight away by the capture writer in eager mode,
+// and are remade when the photo is newer than its thumbnail.
+//
+// The photo and the encoded thumbnail each borrow a frame_pool slab while a
+// thumbnail is made; nothing is malloc'ed. Thread-safe.
+
+#define THUMB_DIR "/sdcard/.thumbs"
+#define THUMB_QUALITY 70
+
+struct ThumbStats {
+  uint32_t hits;       // served from the cache
+  uint32_t made;       // made on request
+  uint32_t eager;      // made by the capture writer
+  uint32_t failures;
+};
+
+bool thumb_begin(bool eager);
+
+// Cache path for a photo: "/sdcard/2025/01/02/x.jpg" -> THUMB_DIR "/2025/01/02/x.jpg".
+void thumb_path(const char *photo_path, char *out, size_t n);
+
+// Capture writer hook: in eager mode, make the thumbnail from the JPEG that
+// is being saved, while it is still in memory. Does nothing otherwise.
+void thumb_store(const char *photo_path, const uint8_t *jpg, size_t len);
+
+// The thumbnail of a photo on the card, from the cache or made now. out gets
+// its path and st its stat(). False if the photo is missing or not a JPEG
+// that can be scaled, or no slab was free.
+bool thumb_get(const char *photo_path, char *out, size_t n, struct stat *st);
+
+// Delete a photo's thumbnail, e.g. when retention deletes the photo.
+void thumb_remove(const char *photo_path);
+
+void thumb_getStats(ThumbStats *stats);
+
+#endif // PHOTO_THUMBS_H
@@ -4,9 +4,11 @@
 
   Minimal changes to reliably avoid stale saved images:
   - single FreeRTOS mutex (cameraLock) to serialize camera access
-  - improved flush_and_get_new_fb() which compares a small checksum to ensure a new frame
+  - one capture task publishes frames that all stream viewers share
+  - captures pick a frame by capture timestamp/sequence (grab-latest mode)
+  - capture_service copies the frame and writes it to SD on its own task
   - binary writes + fflush+fsync
-  - save_photo(bool) to provide a single safe API
+  - save_photo(bool, event) to provide a single safe API
 */
 
 #include "esp_camera.h"
@@ -29,17 +31,29 @@
 #include "esp_vfs_fat.h"
 
 #include <ESPmDNS.h>
-#include <dirent.h>
 
 // semaphore + fsync
 #include "freertos/FreeRTOS.h"
 #include "freertos/semphr.h"
 #include <unistd.h>
+#include <sys/stat.h>
+
+#include "frame_broadcaster.h"
+#include "stream_sessions.h"
+#include "capture_service.h"
+#include "frame_pool.h"
+#include "jpeg_scale.h"
+#include "event_ring.h"
+#include "motion_detector.h"
+#include "capture_scheduler.h"
+#include "sd_writer.h"
+#include "capture_catalog.h"
+#include "photo_thumbs.h"
+#include "photo_export.h"
 
 #include "secrets_34.h"
 #include "secrets_roy.h"
 
-#define PART_BOUNDARY "123456789000000000000987654321"
 #define CAMERA_MODEL_AI_THINKER
 
 // Camera Pin definition for AI Thinker module
@@ -60,17 +74,47 @@
 #define HREF_GPIO_NUM     23
 #define PCLK_GPIO_NUM     22
 
-static const char* _STREAM_CONTENT_TYPE = "multipart/x-mixed-replace;boundary=" PART_BOUNDARY;
-static const char* _STREAM_BOUNDARY = "\r\n--" PART_BOUNDARY "\r\n";
-static const char* _STREAM_PART = "Content-Type: image/jpeg\r\nContent-Length: %u\r\n\r\n";
+// Optional external trigger (PIR, reed switch, ...) to ground; -1 disables it
+#define EVENT_TRIGGER_GPIO -1
+
+// Captures that also save the pre-event ring (event_ring.h). /capture?event=0
+// or ?event=1 overrides EVENT_ON_CAPTURE for one request. Each event adds the
+// ring's frames and EVRING_POST_FRAMES more to the photo; leave
+// EVENT_ON_SCHEDULE out for a timelapse of single photos.
+#define EVENT_ON_SCHEDULE 0x01
+#define EVENT_ON_CAPTURE 0x02
+#define EVENT_ON_MOTION 0x04
+#define EVENT_ON_GPIO 0x08
+#define EVENT_TRIGGERS (EVENT_ON_SCHEDULE | EVENT_ON_CAPTURE | EVENT_ON_MOTION | EVENT_ON_GPIO)
+
+// Scheduled captures, see capture_scheduler.h; "0 *" is on the hour
+#define CAPTURE_SCHEDULE "0 *"
+#define CAPTURE_CATCHUP SCHED_CATCHUP_ONE
+
+// How capture files are committed to the card, see sd_writer.h
+#define SD_DURABILITY SDWR_SYNC_GROUP
+
+// 1: the capture writer makes each photo's thumbnail while saving it;
+// 0: thumbnails are made on the first /thumb request
+#define THUMBNAILS_EAGER 1
+
+// Motion-triggered captures. Off by default: a clock's hands or pendulum can
+// trip the detector on every cooldown. /motion?enabled=1 turns it on until
+// the next reboot.
+#define MOTION_ENABLED 0
+
+// Retention: after each capture the oldest photos are deleted until the
+// archive is within every limit set here (0 turns a limit off). All are off
+// by default, so no photo is ever deleted unless a limit is set; keeping some
+// space free (e.g. 32 MB) stops a full card from failing every capture.
+#define RETENTION_MAX_FILES 0
+#define RETENTION_MAX_MB 0
+#define RETENTION_MIN_FREE_MB 0
 
 httpd_handle_t stream_httpd = NULL;
 camera_config_t config;
 
-int file_number = 0;
 bool internet_connected = false;
-unsigned long lastNtpSync = 0;
-int lastPhotoHour = -1;
 
 // single camera mutex
 static SemaphoreHandle_t cameraLock = NULL;
@@ -79,207 +123,255 @@ static SemaphoreHandle_t cameraLock = NULL;
 bool sd_mounted = false;
 
 // ---------- helpers ----------
-String make_dated_filename() {
+// save_photo: public helper used by scheduled and motion captures. It only
+// queues the frame; capture_service writes it to SD on its own task. A
+// trigger named in event also saves the pre-event ring; NULL saves just the
+// photo.
+void save_photo(bool time_known, const char *event = NULL) {
+  if (event) evring_trigger(event);
+  uint32_t job = capsvc_submit(time_known ? CAPTURE_NAME_DATED : CAPTURE_NAME_NUMBERED);
+  if (!job) Serial.println("save_photo: capture failed");
+}
+
+// Motion detector callback; runs on the detector task.
+static void on_motion(uint16_t changed_blocks) {
+  (void)changed_blocks;
   time_t now;
   struct tm timeinfo;
   time(&now);
   localtime_r(&now, &timeinfo);
+  save_photo((timeinfo.tm_year >= (2016 - 1900)) && internet_connected,
+             (EVENT_TRIGGERS & EVENT_ON_MOTION) ? "motion" : NULL);
+}
 
-  char strftime_buf[32];
-  strftime(strftime_buf, sizeof(strftime_buf), "%Y%m%d_%H%M%S", &timeinfo);
-  char filename[64];
-  snprintf(filename, sizeof(filename), "/sdcard/capture_%s.jpg", strftime_buf);
-  return String(filename);
-}
-
-String make_numbered_filename() {
-  file_number++;
-  char filename[32];
-  snprintf(filename, sizeof(filename), "/sdcard/capture_%d.jpg", file_number);
-  return String(filename);
-}
-
-// small, cheap checksum over the first sample_size bytes
-static uint32_t fb_sample_checksum(camera_fb_t *fb, size_t sample_size = 64) {
-  if (!fb || fb->len == 0) return 0;
-  size_t n = fb->len < sample_size ? fb->len : sample_size;
-  uint32_t h = 2166136261u; // FNV-1a 32-bit start
-  for (size_t i = 0; i < n; ++i) {
-    h ^= fb->buf[i];
-    h *= 16777619u;
-  }
-  return h;
-}
-
-// Improved flush-and-get-new-fb:
-// 1) grab a frame (if any) and compute a small checksum
-// 2) discard it, then repeatedly grab new frames and compare checksum
-// 3) return the first frame that differs (or last frame if retries exhausted)
-static camera_fb_t* flush_and_get_new_fb(int retries = 10, int delay_ms = 80, size_t sample_size = 64) {
-  camera_fb_t *fb = NULL;
-  uint32_t prev_hash = 0;
-
-  // Try to get a current frame to determine the "previous" hash.
-  fb = esp_camera_fb_get();
-  if (fb) {
-    prev_hash = fb_sample_checksum(fb, sample_size);
-    esp_camera_fb_return(fb);
-    fb = NULL;
-    // short pause for the camera to advance to next buffer
-    delay(delay_ms);
-  }
-
-  // Now try to get a fresh frame that differs from prev_hash
-  for (int i = 0; i < retries; ++i) {
-    fb = esp_camera_fb_get();
-    if (!fb) {
-      delay(delay_ms);
-      continue;
-    }
-    // If we had no previous frame (prev_hash==0) we accept the first valid fb
-    if (prev_hash == 0) {
-      if (fb->len > 0) return fb;
-      esp_camera_fb_return(fb);
-      fb = NULL;
-      delay(delay_ms);
-      continue;
-    }
-
-    uint32_t h = fb_sample_checksum(fb, sample_size);
-    if (h != prev_hash && fb->len > 0) {
-      // different from previous — consider it fresh
-      return fb;
-    }
+// Scheduler callbacks; both run on the scheduler task.
+static void on_schedule(bool time_known) {
+  save_photo(time_known, (EVENT_TRIGGERS & EVENT_ON_SCHEDULE) ? "schedule" : NULL);
+}
 
-    // same as previous: return and retry (discard)
-    esp_camera_fb_return(fb);
-    fb = NULL;
-    delay(delay_ms);
-  }
+void setup_time(); // forward
 
-  // last-ditch: try one final get without comparison
-  fb = esp_camera_fb_get();
-  if (fb && fb->len > 0) return fb;
-  if (fb) {
-    esp_camera_fb_return(fb);
-    fb = NULL;
-  }
-  return NULL;
+static void ntp_resync() {
+  if (internet_connected) setup_time();
 }
 
-// save_photo implementation - performs safe capture+write with locking
-void save_photo(bool time_known) {
-  // Acquire lock
-  if (cameraLock) {
-    if (xSemaphoreTake(cameraLock, pdMS_TO_TICKS(3000)) != pdTRUE) {
-      Serial.println("save_photo: camera busy");
-      return;
-    }
-  }
+// Used by the /snap handler in sd_http_server: capture and wait for the write.
+String captureAndSave() {
+  CaptureJobInfo info;
+  uint32_t job = capsvc_submit(CAPTURE_NAME_DATED);
+  if (!job || !capsvc_wait(job, 10000, &info) || info.state != CAPTURE_JOB_DONE) return String();
+  return String(info.path);
+}
 
-  camera_fb_t *fb = flush_and_get_new_fb(/*retries=*/10, /*delay_ms=*/80, /*sample_size=*/64);
-  if (!fb) {
-    Serial.println("save_photo: no fresh framebuffer");
-    if (cameraLock) xSemaphoreGive(cameraLock);
-    return;
-  }
+// ---------- Streaming handler (hands the connection to a stream worker) ----------
+// The MJPEG loop itself lives in stream_sessions.cpp and sends frames shared by
+// the capture task in frame_broadcaster; this handler returns immediately so the
+// httpd worker stays free for /files, /download and /capture.
+static esp_err_t stream_handler(httpd_req_t *req) {
+  esp_err_t err = strm_submit(req);
+  if (err == ESP_OK) return ESP_OK;
 
-  String filename;
-  if (time_known) filename = make_dated_filename();
-  else filename = make_numbered_filename();
+  Serial.printf("stream: rejected, %d streams already open\n", strm_activeCount());
+  const char* msg = "Too many stream viewers, try again later\n";
+  httpd_resp_set_status(req, "503 Service Unavailable");
+  httpd_resp_set_type(req, "text/plain");
+  httpd_resp_send(req, msg, strlen(msg));
+  return ESP_OK;
+}
 
-  Serial.print("Taking picture: ");
-  Serial.println(filename);
+// ---------- /latest.jpg handler: newest frame straight from the capture task ----------
+// Never touches the camera, cameraLock or the SD card. Pollers can send the
+// previous ETag back in If-None-Match and get 304 until a new frame is published.
+static esp_err_t latest_get_handler(httpd_req_t *req) {
+  SharedFrame *frame = fbc_acquireLatest();
+  if (!frame) {
+    const char* msg = "No frame captured yet\n";
+    httpd_resp_set_status(req, "503 Service Unavailable");
+    httpd_resp_set_type(req, "text/plain");
+    httpd_resp_send(req, msg, strlen(msg));
+    return ESP_OK;
+  }
 
-  FILE *file = fopen(filename.c_str(), "wb");
-  if (file != NULL) {
-    size_t written = fwrite(fb->buf, 1, fb->len, file);
-    fflush(file);
-    int fd = fileno(file);
-    if (fd >= 0) fsync(fd);
-    Serial.printf("File saved: %s (bytes: %u)\n", filename.c_str(), (unsigned)written);
-    fclose(file);
-  } else {
-    Serial.println("Could not open file for writing");
-    esp_camera_fb_return(fb);
-    if (cameraLock) xSemaphoreGive(cameraLock);
-    return;
+  char seq_str[16];
+  char etag[20];
+  char ts_str[32];
+  snprintf(seq_str, sizeof(seq_str), "%u", (unsigned)frame->seq);
+  snprintf(etag, sizeof(etag), "\"%u\"", (unsigned)frame->seq);
+
+  // capture time is on the esp_timer clock; express it as wall-clock time for clients
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  int64_t wall_us = (int64_t)tv.tv_sec * 1000000LL + tv.tv_usec - (esp_timer_get_time() - frame->timestamp_us);
+  snprintf(ts_str, sizeof(ts_str), "%lld.%06lld", (long long)(wall_us / 1000000LL), (long long)(wall_us % 1000000LL));
+
+  httpd_resp_set_hdr(req, "X-Frame-Seq", seq_str);
+  httpd_resp_set_hdr(req, "X-Timestamp", ts_str);
+  httpd_resp_set_hdr(req, "ETag", etag);
+  httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+
+  char inm[24];
+  if (httpd_req_get_hdr_value_str(req, "If-None-Match", inm, sizeof(inm)) == ESP_OK && strcmp(inm, etag) == 0) {
+    fbc_release(frame);
+    httpd_resp_set_status(req, "304 Not Modified");
+    httpd_resp_send(req, NULL, 0);
+    return ESP_OK;
   }
 
-  esp_camera_fb_return(fb);
-  if (cameraLock) xSemaphoreGive(cameraLock);
+  httpd_resp_set_type(req, "image/jpeg");
+  esp_err_t res = httpd_resp_send(req, (const char*)frame->buf, frame->len);
+  fbc_release(frame);
+  return res;
 }
 
-// ---------- Streaming handler (serialize camera access) ----------
-static esp_err_t stream_handler(httpd_req_t *req) {
-  camera_fb_t *fb = NULL;
-  esp_err_t res = ESP_OK;
-  size_t _jpg_buf_len = 0;
-  uint8_t *_jpg_buf = NULL;
-  char part_buf[64];
-
-  res = httpd_resp_set_type(req, _STREAM_CONTENT_TYPE);
-  if (res != ESP_OK) return res;
-
-  while (true) {
-    // take mutex to prevent concurrent esp_camera_fb_get()
-    if (cameraLock) {
-      if (xSemaphoreTake(cameraLock, pdMS_TO_TICKS(2000)) != pdTRUE) {
-        Serial.println("stream: camera locked, skipping frame");
-        delay(200);
-        continue;
-      }
-    }
+// ---------- /stats handler: frame pool and heap health ----------
+// The largest free block next to the total free heap shows fragmentation over long runs.
+static esp_err_t stats_get_handler(httpd_req_t *req) {
+  FramePoolStats ps;
+  fpool_getStats(&ps);
+  EventRingStats es;
+  evring_getStats(&es);
+  MotionStats ms;
+  motion_getStats(&ms);
+  SdWriterStats ws;
+  sdwr_getStats(&ws);
+  CatalogInfo ci;
+  catalog_getInfo(&ci);
+  ThumbStats ts;
+  thumb_getStats(&ts);
+  ExportStats xs;
+  export_getStats(&xs);
+  char buf[1536];
+  int n = snprintf(buf, sizeof(buf),
+    "Frame pool: %u/%u slabs in use (high water %u), %u bytes each, %u failed acquires\n"
+    "Frames published: %u, dropped: %u\n"
+    "Open streams: %d\n"
+    "Pre-event ring: %u frames, %u bytes, %u evicted, %u events, %u busy triggers\n"
+    "Motion: %u frames, %u skipped for CPU budget, %u us/frame, %u events\n"
+    "SD writer: %u files in %u commits, %u failed, %u KB blocks, %u KB/s, last %u us, max %u us\n"
+    "Catalog: %u photos, %llu MB, %u rebuilds (last %u ms)\n"
+    "Retention: %u deleted, %llu MB free (limits: %u files, %llu MB, %llu MB free)\n"
+    "Thumbnails: %u cache hits, %u made on request, %u made eagerly, %u failed\n"
+    "Exports: %u done, %u failed, %u files, %llu MB, last %u KB/s\n"
+    "Internal heap: %u free, largest block %u\n"
+    "PSRAM: %u free, largest block %u\n",
+    (unsigned)ps.in_use, (unsigned)ps.slabs, (unsigned)ps.high_water, (unsigned)ps.slab_size, (unsigned)ps.failures,
+    (unsigned)fbc_framesPublished(), (unsigned)fbc_framesDropped(),
+    strm_activeCount(),
+    (unsigned)es.frames, (unsigned)es.bytes, (unsigned)es.evicted, (unsigned)es.events, (unsigned)es.busy,
+    (unsigned)ms.frames, (unsigned)ms.skipped, (unsigned)ms.avg_us, (unsigned)ms.events,
+    (unsigned)ws.files, (unsigned)ws.commits, (unsigned)ws.failures, (unsigned)(ws.block_size / 1024), (unsigned)ws.kbps,
+    (unsigned)ws.last_us, (unsigned)ws.max_us,
+    (unsigned)ci.records, (unsigned long long)(ci.bytes >> 20), (unsigned)ci.rebuilds, (unsigned)ci.rebuild_ms,
+    (unsigned)ci.retired, (unsigned long long)(ci.free_bytes >> 20), (unsigned)ci.retention.max_files,
+    (unsigned long long)(ci.retention.max_bytes >> 20), (unsigned long long)(ci.retention.min_free >> 20),
+    (unsigned)ts.hits, (unsigned)ts.made, (unsigned)ts.eager, (unsigned)ts.failures,
+    (unsigned)xs.exports, (unsigned)xs.failures, (unsigned)xs.files, (unsigned long long)(xs.bytes >> 20),
+    (unsigned)xs.last_kbps,
+    (unsigned)heap_caps_get_free_size(MALLOC_CAP_INTERNAL), (unsigned)heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL),
+    (unsigned)heap_caps_get_free_size(MALLOC_CAP_SPIRAM), (unsigned)heap_caps_get_largest_free_block(MALLOC_CAP_SPIRAM));
+  httpd_resp_set_type(req, "text/plain");
+  httpd_resp_send(req, buf, n);
+  return ESP_OK;
+}
 
-    fb = esp_camera_fb_get();
-    if (!fb) {
-      Serial.println("Camera capture failed (stream)");
-      res = ESP_FAIL;
-    } else {
-      if (fb->width > 400) {
-        if (fb->format != PIXFORMAT_JPEG) {
-          bool jpeg_converted = frame2jpg(fb, 80, &_jpg_buf, &_jpg_buf_len);
-          esp_camera_fb_return(fb);
-          fb = NULL;
-          if (!jpeg_converted) {
-            Serial.println("JPEG compression failed (stream)");
-            res = ESP_FAIL;
-          }
-        } else {
-          _jpg_buf_len = fb->len;
-          _jpg_buf = fb->buf;
-        }
+// ---------- /motion handler: detector settings and state ----------
+// /motion?threshold=12&blocks=3&cooldown=30&mask=ffffffff,0000fff0,...
+// mask gives one hex bitmap per block row, top row first (bit 0 = left
+// column); rows not listed are cleared. No parameters just reports.
+static esp_err_t motion_get_handler(httpd_req_t *req) {
+  MotionConfig cfg;
+  motion_getConfig(&cfg);
+  char query[400];
+  char value[340];
+  if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+    if (httpd_query_key_value(query, "enabled", value, sizeof(value)) == ESP_OK) cfg.enabled = atoi(value) != 0;
+    if (httpd_query_key_value(query, "threshold", value, sizeof(value)) == ESP_OK) cfg.threshold = constrain(atoi(value), 1, 255);
+    if (httpd_query_key_value(query, "blocks", value, sizeof(value)) == ESP_OK) cfg.min_blocks = constrain(atoi(value), 1, 1024);
+    if (httpd_query_key_value(query, "cooldown", value, sizeof(value)) == ESP_OK) cfg.cooldown_ms = strtoul(value, NULL, 10) * 1000;
+    if (httpd_query_key_value(query, "mask", value, sizeof(value)) == ESP_OK) {
+      char *p = value;
+      for (int row = 0; row < MOTION_GRID_MAX; ++row) {
+        cfg.mask[row] = *p ? strtoul(p, &p, 16) : 0;
+        if (*p == ',') ++p;
       }
     }
+    motion_setConfig(&cfg);
+  }
 
-    // release lock early — we have either taken ownership of fb pointer or converted/copied
-    if (cameraLock) xSemaphoreGive(cameraLock);
+  MotionStats st;
+  motion_getStats(&st);
+  String resp = "Enabled: " + String(cfg.enabled ? "yes" : "no") + "\nThreshold: " + String(cfg.threshold) + "\nBlocks: " + String(cfg.min_blocks) +
+                "\nCooldown: " + String((unsigned)(cfg.cooldown_ms / 1000)) + " s\nGrid: " + String(st.grid_w) + "x" + String(st.grid_h) +
+                "\nLast changed: " + String(st.last_changed) + "\nEvents: " + String((unsigned)st.events) + "\nMask:\n";
+  char row[12];
+  for (int y = 0; y < st.grid_h; ++y) {
+    snprintf(row, sizeof(row), "%08x\n", (unsigned)cfg.mask[y]);
+    resp += row;
+  }
+  httpd_resp_set_type(req, "text/plain");
+  httpd_resp_send(req, resp.c_str(), resp.length());
+  return ESP_OK;
+}
 
-    if (res == ESP_OK) {
-      size_t hlen = snprintf((char *)part_buf, 64, _STREAM_PART, _jpg_buf_len);
-      res = httpd_resp_send_chunk(req, (const char *)part_buf, hlen);
-    }
-    if (res == ESP_OK) {
-      res = httpd_resp_send_chunk(req, (const char *)_jpg_buf, _jpg_buf_len);
-    }
-    if (res == ESP_OK) {
-      res = httpd_resp_send_chunk(req, _STREAM_BOUNDARY, strlen(_STREAM_BOUNDARY));
+// ---------- /schedule handler: capture schedule and timing ----------
+// /schedule?set=0%20*;sunrise%2B30&catchup=skip|one|all
+static void url_decode(char *s) {
+  char *o = s;
+  for (; *s; ++s) {
+    if (*s == '+') *o++ = ' ';
+    else if (*s == '%' && isxdigit((unsigned char)s[1]) && isxdigit((unsigned char)s[2])) {
+      char hex[3] = { s[1], s[2], 0 };
+      *o++ = (char)strtol(hex, NULL, 16);
+      s += 2;
+    } else *o++ = *s;
+  }
+  *o = 0;
+}
+
+static esp_err_t schedule_get_handler(httpd_req_t *req) {
+  char query[200];
+  char value[160];
+  String resp;
+  if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+    if (httpd_query_key_value(query, "set", value, sizeof(value)) == ESP_OK) {
+      url_decode(value);
+      if (sched_setSpecs(value)) sched_rearm();
+      else resp += "Rejected schedule: " + String(value) + "\n";
     }
-    if (fb) {
-      esp_camera_fb_return(fb);
-      fb = NULL;
-      _jpg_buf = NULL;
-    } else if (_jpg_buf) {
-      free(_jpg_buf);
-      _jpg_buf = NULL;
+    if (httpd_query_key_value(query, "catchup", value, sizeof(value)) == ESP_OK) {
+      if (!strcmp(value, "skip")) sched_setPolicy(SCHED_CATCHUP_SKIP);
+      else if (!strcmp(value, "one")) sched_setPolicy(SCHED_CATCHUP_ONE);
+      else if (!strcmp(value, "all")) sched_setPolicy(SCHED_CATCHUP_ALL);
     }
-    if (res != ESP_OK) break;
-    delay(1000);
   }
-  return res;
+
+  static const char *policies[] = { "skip", "one", "all" };
+  SchedStats st;
+  sched_getStats(&st);
+  char next[32] = "clock not set";
+  if (st.next) {
+    struct tm timeinfo;
+    localtime_r(&st.next, &timeinfo);
+    strftime(next, sizeof(next), "%Y-%m-%d %H:%M:%S", &timeinfo);
+  }
+  resp += "Schedule: " + sched_getSpecs() + "\nCatch-up: " + policies[sched_getPolicy()] +
+          "\nNext: " + next + "\nCaptures: " + String((unsigned)st.captures) +
+          "\nMissed: " + String((unsigned)st.missed) + " (" + String((unsigned)st.caught_up) + " caught up)" +
+          "\nJitter: last " + String((int)st.last_jitter_ms) + " ms, max " + String((int)st.max_jitter_ms) + " ms\n";
+  httpd_resp_set_type(req, "text/plain");
+  httpd_resp_send(req, resp.c_str(), resp.length());
+  return ESP_OK;
 }
 
 // ---------- /files handler ----------
+// Lists from the capture catalog, newest first, FILES_PAGE photos per page;
+// /files?before=SEQ pages back, /files?rescan=1 rebuilds the catalog from a
+// directory scan, /files?thumbs=1 shows the page as a grid of /thumb images.
+// Nothing here walks the directory, so a page costs the same at 50 photos or
+// 50,000.
+#define FILES_PAGE 100
+#define FILES_BATCH 16
+
 static esp_err_t files_get_handler(httpd_req_t *req) {
   Serial.println("/files handler called");
   if (!sd_mounted) {
@@ -289,33 +381,373 @@ static esp_err_t files_get_handler(httpd_req_t *req) {
     return ESP_OK;
   }
 
+  char query[64];
+  char val[16];
+  uint32_t before = 0;
+  bool thumbs = false;
+  if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+    if (httpd_query_key_value(query, "before", val, sizeof(val)) == ESP_OK) before = strtoul(val, NULL, 10);
+    if (httpd_query_key_value(query, "thumbs", val, sizeof(val)) == ESP_OK) thumbs = atoi(val) != 0;
+    if (httpd_query_key_value(query, "rescan", val, sizeof(val)) == ESP_OK && atoi(val)) catalog_rebuild();
+  }
+
   const char* header = "<!doctype html><html><head><meta charset='utf-8'><title>ESP32-CAM SD Files</title></head><body><h2>Files on SD card</h2>";
   httpd_resp_send_chunk(req, header, strlen(header));
 
-  DIR *dir = opendir("/sdcard");
-  if (!dir) {
-    const char* no = "<p>Unable to open /sdcard. Is the card mounted?</p></body></html>";
+  CatalogInfo ci;
+  catalog_getInfo(&ci);
+  if (!ci.ready) {
+    const char* no = "<p>Photo catalog unavailable; try /files?rescan=1.</p></body></html>";
     httpd_resp_send_chunk(req, no, strlen(no));
     httpd_resp_send_chunk(req, NULL, 0);
     return ESP_OK;
   }
 
-  struct dirent *ent;
-  while ((ent = readdir(dir)) != NULL) {
-    if (ent->d_type == DT_DIR) continue;
-    String name = String(ent->d_name);
-    String line = "<a href=\"/download?file=" + name + "\">" + name + "</a><br>\n";
-    httpd_resp_send_chunk(req, line.c_str(), line.length());
+  char line[256];
+  int n = snprintf(line, sizeof(line), "<p>%u photos, %llu MB</p>\n", (unsigned)ci.records,
+                   (unsigned long long)(ci.bytes >> 20));
+  httpd_resp_send_chunk(req, line, n);
+
+  size_t end = before ? catalog_findSeq(before) : catalog_count();
+  size_t start = end > FILES_PAGE ? end - FILES_PAGE : 0;
+  CatalogRecord recs[FILES_BATCH];
+  String page;
+  page.reserve(FILES_BATCH * (thumbs ? 200 : 160));
+  for (size_t hi = end; hi > start; ) {
+    size_t k = hi - start < FILES_BATCH ? hi - start : FILES_BATCH;
+    size_t got = catalog_read(hi - k, recs, k);
+    if (got != k) break;
+    page = "";
+    for (size_t i = k; i-- > 0; ) {
+      const CatalogRecord &r = recs[i];
+      if (thumbs) {
+        snprintf(line, sizeof(line),
+                 "<a href=\"/download?file=%s\"><img src=\"/thumb?file=%s\" loading=\"lazy\" title=\"%s\"></a>\n",
+                 r.name, r.name, r.name);
+        page += line;
+        continue;
+      }
+      time_t t = (time_t)r.time;
+      struct tm tm;
+      localtime_r(&t, &tm);
+      char when[24];
+      strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", &tm);
+      snprintf(line, sizeof(line), "<a href=\"/download?file=%s\">%s</a> %s, %u bytes<br>\n",
+               r.name, r.name, when, (unsigned)r.size);
+      page += line;
+    }
+    if (httpd_resp_send_chunk(req, page.c_str(), page.length()) != ESP_OK) return ESP_FAIL;
+    hi -= k;
   }
-  closedir(dir);
 
+  if (start > 0) {
+    CatalogRecord oldest;
+    if (catalog_read(start, &oldest, 1) == 1) {
+      n = snprintf(line, sizeof(line), "<p><a href=\"/files?before=%u%s\">Older</a></p>", (unsigned)oldest.seq,
+                   thumbs ? "&thumbs=1" : "");
+      httpd_resp_send_chunk(req, line, n);
+    }
+  }
   const char* footer = "<hr><small>Use /download?file=FILENAME to download. Use /capture to take a photo now.</small></body></html>";
   httpd_resp_send_chunk(req, footer, strlen(footer));
   httpd_resp_send_chunk(req, NULL, 0);
   return ESP_OK;
 }
 
+// ---------- /api/files handler: catalog as JSON for collectors ----------
+// /api/files?since=SEQ&limit=N&order=asc|desc&from=T&to=T
+//   since  only photos with a higher sequence number (the previous cursor)
+//   limit  photos per response, default 100, at most API_FILES_MAX
+//   order  asc (default) returns the oldest matches first; desc the newest
+//   from, to  capture time range in Unix seconds, both inclusive
+// The reply carries "cursor", the highest sequence returned (or since if
+// nothing matched), and "more" when matches were left out by the limit. A
+// collector polls with order=asc&since=<cursor> and gets only new photos.
+// Records are found by catalog position and written into one static buffer
+// that goes out in API_FILES_BUF sized chunks.
+#define API_FILES_DEFAULT 100
+#define API_FILES_MAX 1000
+#define API_FILES_BUF 8192
+#define API_FILES_ENTRY_MAX 160   // longest entry: seq, name, time, size, fp
+
+static char api_files_buf[API_FILES_BUF];      // httpd runs one handler at a time
+static CatalogRecord api_files_recs[32];
+
+static long query_long(const char *query, const char *key, long dflt) {
+  char val[24];
+  if (!query || httpd_query_key_value(query, key, val, sizeof(val)) != ESP_OK) return dflt;
+  return strtol(val, NULL, 10);
+}
+
+static esp_err_t api_files_get_handler(httpd_req_t *req) {
+  CatalogInfo ci;
+  catalog_getInfo(&ci);
+  if (!sd_mounted || !ci.ready) {
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "photo catalog unavailable");
+    return ESP_FAIL;
+  }
+
+  char query[128];
+  const char *q = httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK ? query : NULL;
+  uint32_t since = (uint32_t)query_long(q, "since", 0);
+  long limit = constrain(query_long(q, "limit", API_FILES_DEFAULT), 1, API_FILES_MAX);
+  long from = query_long(q, "from", -1);
+  long to = query_long(q, "to", -1);
+  char order[8] = "asc";
+  if (q) httpd_query_key_value(q, "order", order, sizeof(order));
+  bool desc = strcmp(order, "desc") == 0;
+
+  // Matches are the sequences [lo, hi), which retention cannot shift the way
+  // it shifts positions; records it removes meanwhile are just left out.
+  uint32_t lo, hi;
+  catalog_findRange(since, from, to, &lo, &hi);
+  size_t matches = hi - lo;
+  size_t take = min(matches, (size_t)limit);
+  uint32_t first = desc ? hi - take : lo;   // the slice returned, read in ascending batches
+
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+
+  // sequences have no gaps, so the cursor is the slice's last sequence
+  uint32_t cursor = take ? max(since, (uint32_t)(first + take - 1)) : since;
+  size_t len = snprintf(api_files_buf, API_FILES_BUF,
+                        "{\"total\":%u,\"matches\":%u,\"count\":%u,\"cursor\":%u,\"more\":%s,\"files\":[",
+                        (unsigned)ci.records, (unsigned)matches, (unsigned)take, (unsigned)cursor,
+                        matches > take ? "true" : "false");
+
+  // FAT names cannot contain '"' or a backslash, so names go out unescaped
+  bool comma = false;
+  const size_t batch = sizeof(api_files_recs) / sizeof(api_files_recs[0]);
+  for (size_t done = 0; done < take; ) {
+    // desc walks batches from the newest end and each batch backwards
+    size_t k = min(batch, take - done);
+    uint32_t at = desc ? first + take - done - k : first + done;
+    size_t got = catalog_readSeq(at, api_files_recs, k);
+    for (size_t j = 0; j < got; ++j) {
+      const CatalogRecord &r = api_files_recs[desc ? got - 1 - j : j];
+      if (r.seq >= at + k) continue;   // the batch started after removed records
+      if (len + API_FILES_ENTRY_MAX > API_FILES_BUF) {
+        if (httpd_resp_send_chunk(req, api_files_buf, len) != ESP_OK) return ESP_FAIL;
+        len = 0;
+      }
+      len += snprintf(api_files_buf + len, API_FILES_BUF - len,
+                      "%s{\"seq\":%u,\"name\":\"%s\",\"time\":%lld,\"size\":%u,\"fp\":\"%08x\"}",
+                      comma ? "," : "", (unsigned)r.seq, r.name, (long long)r.time, (unsigned)r.size,
+                      (unsigned)r.fingerprint);
+      comma = true;
+    }
+    done += k;
+  }
+  len += snprintf(api_files_buf + len, API_FILES_BUF - len, "]}\n");
+  if (httpd_resp_send_chunk(req, api_files_buf, len) != ESP_OK) return ESP_FAIL;
+  httpd_resp_send_chunk(req, NULL, 0);
+  return ESP_OK;
+}
+
+// ---------- /export handler: a range of photos as one archive ----------
+// /export?from=T&to=T&since=SEQ&fmt=zip|tar takes the same range parameters
+// as /api/files (all optional, default everything) and streams the photos as
+// one uncompressed ZIP (default) or TAR, built while it is sent
+// (photo_export.cpp). A ZIP holds as many photos as its table allows;
+// X-Export-Files says how many went in, and when X-Export-More is true the
+// next request continues with since=<X-Export-Cursor>. The archive is sent
+// from the export task, so the httpd worker keeps answering other requests;
+// a second export while one is running gets 503.
+struct ExportReply {
+  httpd_req_t *req;
+  bool started;
+  uint32_t since;
+  uint32_t lo, hi;        // catalog sequences matching the query
+  ExportFormat fmt;
+  size_t take;
+  char disposition[80];
+  char files[12];
+  char cursor[12];
+};
+
+// Headers go on with the first chunk, so a busy export can still answer 503.
+static bool export_sink(void *arg, const uint8_t *data, size_t len) {
+  ExportReply *r = (ExportReply*)arg;
+  if (!r->started) {
+    httpd_resp_set_type(r->req, r->fmt == EXPORT_TAR ? "application/x-tar" : "application/zip");
+    httpd_resp_set_hdr(r->req, "Content-Disposition", r->disposition);
+    httpd_resp_set_hdr(r->req, "Cache-Control", "no-store");
+    httpd_resp_set_hdr(r->req, "X-Export-Files", r->files);
+    httpd_resp_set_hdr(r->req, "X-Export-Cursor", r->cursor);
+    httpd_resp_set_hdr(r->req, "X-Export-More", r->hi - r->lo > r->take ? "true" : "false");
+    r->started = true;
+  }
+  return httpd_resp_send_chunk(r->req, (const char*)data, len) == ESP_OK;
+}
+
+static void export_busy(httpd_req_t *req) {
+  const char* msg = "Export busy or out of memory, try again later\n";
+  httpd_resp_set_status(req, "503 Service Unavailable");
+  httpd_resp_set_type(req, "text/plain");
+  httpd_resp_send(req, msg, strlen(msg));
+}
+
+// Runs on the export task with the detached request; owns and frees arg.
+static esp_err_t export_run(httpd_req_t *req, void *arg) {
+  ExportReply *r = (ExportReply*)arg;
+  r->req = req;
+  r->take = export_fit(r->lo, r->hi, r->fmt);
+
+  // name the archive after the first and last capture days it holds
+  CatalogRecord first, last;
+  char filename[48] = "photos";
+  uint32_t cursor = r->take ? r->lo + r->take - 1 : r->since;
+  if (r->take && catalog_readSeq(r->lo, &first, 1) == 1 && first.seq <= cursor &&
+      catalog_readSeq(cursor, &last, 1) == 1) {
+    char a[12], b[12];
+    struct tm tm;
+    time_t t = (time_t)first.time;
+    localtime_r(&t, &tm);
+    strftime(a, sizeof(a), "%Y%m%d", &tm);
+    t = (time_t)last.time;
+    localtime_r(&t, &tm);
+    strftime(b, sizeof(b), "%Y%m%d", &tm);
+    snprintf(filename, sizeof(filename), "photos_%s-%s", a, b);
+  }
+  snprintf(r->disposition, sizeof(r->disposition), "attachment; filename=\"%s.%s\"", filename,
+           r->fmt == EXPORT_TAR ? "tar" : "zip");
+  snprintf(r->files, sizeof(r->files), "%u", (unsigned)r->take);
+  snprintf(r->cursor, sizeof(r->cursor), "%u", (unsigned)cursor);
+
+  ExportResult res = export_write(r->lo, r->take, r->fmt, export_sink, r);
+  free(r);
+  if (res == EXPORT_BUSY) {
+    export_busy(req);
+    return ESP_OK;
+  }
+  if (res != EXPORT_OK) return ESP_FAIL;   // cut short: the client sees no final chunk
+  return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+static esp_err_t export_get_handler(httpd_req_t *req) {
+  CatalogInfo ci;
+  catalog_getInfo(&ci);
+  if (!sd_mounted || !ci.ready) {
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "photo catalog unavailable");
+    return ESP_FAIL;
+  }
+
+  char query[128];
+  const char *q = httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK ? query : NULL;
+  ExportReply *r = (ExportReply*)calloc(1, sizeof(ExportReply));
+  if (!r) {
+    export_busy(req);
+    return ESP_OK;
+  }
+  r->since = (uint32_t)query_long(q, "since", 0);
+  long from = query_long(q, "from", -1);
+  long to = query_long(q, "to", -1);
+  char fmt_param[8] = "zip";
+  if (q) httpd_query_key_value(q, "fmt", fmt_param, sizeof(fmt_param));
+  r->fmt = strcmp(fmt_param, "tar") == 0 ? EXPORT_TAR : EXPORT_ZIP;
+  catalog_findRange(r->since, from, to, &r->lo, &r->hi);
+
+  if (export_submit(req, export_run, r) != ESP_OK) {
+    free(r);
+    export_busy(req);
+  }
+  return ESP_OK;
+}
+
 // ---------- /download handler ----------
+// Serves whole files or one byte range (Range: bytes=a-b, a- or -n), with a
+// Content-Length rather than chunked encoding, so interrupted transfers can be
+// resumed and HEAD gives the size without the body. The status line and
+// headers are written raw with httpd_send(), which is the only way
+// esp_http_server lets a streamed body carry a Content-Length.
+//
+// Photos never change once written, so every response carries a strong ETag
+// (size, mtime and the catalog fingerprint) and Last-Modified, and a matching
+// If-None-Match or If-Modified-Since gets 304 from a stat() and a catalog
+// lookup, before the file is opened. Dated names are unique and cached for a
+// year; numbered capture_N.jpg names restart after a reboot, so those are
+// revalidated on every use.
+#define DOWNLOAD_CHUNK 4096
+#define DOWNLOAD_MAX_AGE 31536000   // one year
+
+// Photos are found under either layout, so links made before a migration
+// keep working after it and vice versa. Fills path and st; false if missing.
+static bool resolve_photo(const String &requested, char *path, size_t n, struct stat *st) {
+  String rel = capsvc_relativePath(requested.c_str());
+  snprintf(path, n, "/sdcard/%s", rel.c_str());
+  if (stat(path, st) == 0) return S_ISREG(st->st_mode);
+  char other[CATALOG_NAME_LEN];
+  if (!capsvc_otherLayout(rel.c_str(), other, sizeof(other))) return false;
+  snprintf(path, n, "/sdcard/%s", other);
+  return stat(path, st) == 0 && S_ISREG(st->st_mode);
+}
+
+// Parse a single range against size. Returns 200 (no usable Range: whole
+// file), 206 with [*first, *last] set, or 416. Multiple ranges get the whole
+// file, which RFC 9110 allows.
+static int parse_range(const char *hdr, size_t size, size_t *first, size_t *last) {
+  *first = 0;
+  *last = size ? size - 1 : 0;
+  if (strncmp(hdr, "bytes=", 6) != 0 || strchr(hdr, ',')) return 200;
+  const char *spec = hdr + 6;
+  char *end;
+  if (*spec == '-') {
+    // suffix: the last n bytes
+    unsigned long n = strtoul(spec + 1, &end, 10);
+    if (end == spec + 1 || *end) return 200;
+    if (n == 0 || size == 0) return 416;
+    *first = n >= size ? 0 : size - n;
+    return 206;
+  }
+  unsigned long a = strtoul(spec, &end, 10);
+  if (end == spec || *end != '-') return 200;
+  const char *b_str = end + 1;
+  unsigned long b = *last;
+  if (*b_str) {
+    b = strtoul(b_str, &end, 10);
+    if (*end || b < a) return 200;
+  }
+  if (a >= size) return 416;
+  *first = a;
+  if (b < *last) *last = b;
+  return 206;
+}
+
+// Strong validator for a photo. The fingerprint tells apart two files that
+// got the same name, size and (2 s FAT) mtime across a reboot.
+static void photo_etag(const char *path, const struct stat &st, char *etag, size_t n) {
+  CatalogRecord rec;
+  uint32_t fp = catalog_lookup(path, &rec) ? rec.fingerprint : 0;
+  snprintf(etag, n, "\"%lx-%lx-%08x\"", (unsigned long)st.st_size, (unsigned long)st.st_mtime, (unsigned)fp);
+}
+
+// If-None-Match wins over If-Modified-Since. The date is compared as sent
+// back, byte for byte, like nginx's default "if_modified_since exact".
+static bool not_modified(httpd_req_t *req, const char *etag, const char *last_modified) {
+  char val[128];
+  if (httpd_req_get_hdr_value_str(req, "If-None-Match", val, sizeof(val)) == ESP_OK) {
+    return strcmp(val, "*") == 0 || strstr(val, etag) != NULL;
+  }
+  if (httpd_req_get_hdr_value_str(req, "If-Modified-Since", val, sizeof(val)) == ESP_OK) {
+    return strcmp(val, last_modified) == 0;
+  }
+  return false;
+}
+
+// httpd_send() until everything is out; lwIP may take part of a buffer
+static bool send_all(httpd_req_t *req, const char *buf, size_t len) {
+  while (len) {
+    int n = httpd_send(req, buf, len);
+    if (n <= 0) return false;
+    buf += n;
+    len -= n;
+  }
+  return true;
+}
+
+static esp_err_t send_file(httpd_req_t *req, const char *path, const struct stat &st, const char *ctype,
+                           const char *disposition, bool immutable);
+
 static esp_err_t download_get_handler(httpd_req_t *req) {
   char query[256];
   if (httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK) {
@@ -329,19 +761,18 @@ static esp_err_t download_get_handler(httpd_req_t *req) {
   }
 
   String requested = String(file_param);
-  String path;
-  if (requested.startsWith("/sdcard/") || requested.startsWith("/")) path = requested;
-  else path = "/sdcard/" + requested;
-
-  FILE *f = fopen(path.c_str(), "rb");
-  if (!f) {
+  char path[256];
+  struct stat st;
+  if (!resolve_photo(requested, path, sizeof(path), &st)) {
     httpd_resp_send_404(req);
     return ESP_FAIL;
   }
 
-  String filename = requested;
+  // "2025/01/02/103000.jpg" saves as "2025-01-02_103000.jpg"
+  String filename = capsvc_relativePath(requested.c_str());
   int pos = filename.lastIndexOf('/');
-  if (pos >= 0) filename = filename.substring(pos + 1);
+  if (pos >= 0) filename.setCharAt(pos, '_');
+  filename.replace("/", "-");
 
   String ctype = "application/octet-stream";
   String p = filename; p.toLowerCase();
@@ -349,80 +780,270 @@ static esp_err_t download_get_handler(httpd_req_t *req) {
   else if (p.endsWith(".png")) ctype = "image/png";
   else if (p.endsWith(".htm") || p.endsWith(".html")) ctype = "text/html";
 
-  httpd_resp_set_type(req, ctype.c_str());
-  httpd_resp_set_hdr(req, "Cache-Control", "no-store, no-cache, must-revalidate");
-  httpd_resp_set_hdr(req, "Pragma", "no-cache");
-  String disp = "attachment; filename=\"" + filename + "\"";
-  httpd_resp_set_hdr(req, "Content-Disposition", disp.c_str());
-
-  const size_t chunk_size = 1024;
-  static uint8_t chunk[chunk_size];
-  size_t r;
-  while ((r = fread(chunk, 1, chunk_size, f)) > 0) {
-    if (httpd_resp_send_chunk(req, (const char*)chunk, r) != ESP_OK) {
+  String disposition = "attachment; filename=\"" + filename + "\"";
+  char other[CATALOG_NAME_LEN];
+  bool immutable = capsvc_otherLayout(capsvc_relativePath(path).c_str(), other, sizeof(other));
+  return send_file(req, path, st, ctype.c_str(), disposition.c_str(), immutable);
+}
+
+// Send path (validators, ranges, HEAD) as described above. immutable selects
+// the long max-age.
+static esp_err_t send_file(httpd_req_t *req, const char *path, const struct stat &st, const char *ctype,
+                           const char *disposition, bool immutable) {
+  size_t size = st.st_size;
+  char etag[48];
+  photo_etag(path, st, etag, sizeof(etag));
+  char last_modified[32];
+  struct tm tm;
+  gmtime_r(&st.st_mtime, &tm);
+  strftime(last_modified, sizeof(last_modified), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+  char cache_control[64];
+  if (immutable) snprintf(cache_control, sizeof(cache_control), "public, max-age=%u, immutable", DOWNLOAD_MAX_AGE);
+  else strlcpy(cache_control, "no-cache", sizeof(cache_control));
+
+  char hdr[512];
+  int n;
+  if (not_modified(req, etag, last_modified)) {
+    n = snprintf(hdr, sizeof(hdr),
+                 "HTTP/1.1 304 Not Modified\r\n"
+                 "ETag: %s\r\n"
+                 "Last-Modified: %s\r\n"
+                 "Cache-Control: %s\r\n\r\n", etag, last_modified, cache_control);
+    return send_all(req, hdr, n) ? ESP_OK : ESP_FAIL;
+  }
+
+  size_t first = 0, last = size ? size - 1 : 0;
+  int status = 200;
+  char range[64];
+  if (httpd_req_get_hdr_value_str(req, "Range", range, sizeof(range)) == ESP_OK) {
+    // If-Range: resume only if the client's copy is this version of the file
+    char if_range[64];
+    if (httpd_req_get_hdr_value_str(req, "If-Range", if_range, sizeof(if_range)) != ESP_OK ||
+        strcmp(if_range, etag) == 0 || strcmp(if_range, last_modified) == 0) {
+      status = parse_range(range, size, &first, &last);
+    }
+  }
+  size_t len = size ? last - first + 1 : 0;
+  if (status == 416) {
+    n = snprintf(hdr, sizeof(hdr),
+                 "HTTP/1.1 416 Range Not Satisfiable\r\n"
+                 "Content-Range: bytes */%u\r\n"
+                 "Content-Length: 0\r\n\r\n", (unsigned)size);
+    return send_all(req, hdr, n) ? ESP_OK : ESP_FAIL;
+  }
+  char content_range[64] = "";
+  if (status == 206) {
+    snprintf(content_range, sizeof(content_range), "Content-Range: bytes %u-%u/%u\r\n",
+             (unsigned)first, (unsigned)last, (unsigned)size);
+  }
+  n = snprintf(hdr, sizeof(hdr),
+               "HTTP/1.1 %s\r\n"
+               "Content-Type: %s\r\n"
+               "Content-Length: %u\r\n"
+               "Accept-Ranges: bytes\r\n"
+               "%s"
+               "Content-Disposition: %s\r\n"
+               "ETag: %s\r\n"
+               "Last-Modified: %s\r\n"
+               "Cache-Control: %s\r\n\r\n",
+               status == 206 ? "206 Partial Content" : "200 OK", ctype, (unsigned)len,
+               content_range, disposition, etag, last_modified, cache_control);
+
+  FILE *f = req->method == HTTP_HEAD ? NULL : fopen(path, "rb");
+  if (req->method != HTTP_HEAD && (!f || fseek(f, first, SEEK_SET) != 0)) {
+    if (f) fclose(f);
+    httpd_resp_send_500(req);
+    return ESP_FAIL;
+  }
+  if (!send_all(req, hdr, n)) {
+    if (f) fclose(f);
+    return ESP_FAIL;
+  }
+  if (!f) return ESP_OK;   // HEAD
+
+  static uint8_t chunk[DOWNLOAD_CHUNK];
+  while (len) {
+    size_t r = fread(chunk, 1, len < DOWNLOAD_CHUNK ? len : DOWNLOAD_CHUNK, f);
+    if (r == 0 || !send_all(req, (const char*)chunk, r)) {
+      // headers promised len bytes: the client sees a short body and can resume
       fclose(f);
       return ESP_FAIL;
     }
+    len -= r;
   }
   fclose(f);
-  httpd_resp_send_chunk(req, NULL, 0);
   return ESP_OK;
 }
 
-// ---------- capture handler: take fresh frame with exclusive access ----------
-static esp_err_t capture_get_handler(httpd_req_t *req) {
-  Serial.println("/capture handler called");
+// ---------- /thumb handler: small JPEG of a photo for galleries ----------
+// /thumb?file=NAME takes the same names as /download. The thumbnail comes from
+// the cache under /sdcard/.thumbs, or is made now (photo_thumbs.cpp), and is
+// sent with the same validators and caching as the photo.
+static esp_err_t thumb_get_handler(httpd_req_t *req) {
+  char query[256];
+  char file_param[224];
+  if (httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK ||
+      httpd_query_key_value(query, "file", file_param, sizeof(file_param)) != ESP_OK) {
+    httpd_resp_send_404(req);
+    return ESP_FAIL;
+  }
+  String requested = String(file_param);
+  char path[256];
+  struct stat st;
+  if (!resolve_photo(requested, path, sizeof(path), &st)) {
+    httpd_resp_send_404(req);
+    return ESP_FAIL;
+  }
+  char thumb[96];
+  struct stat tst;
+  if (!thumb_get(path, thumb, sizeof(thumb), &tst)) {
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "thumbnail unavailable");
+    return ESP_FAIL;
+  }
+  char other[CATALOG_NAME_LEN];
+  bool immutable = capsvc_otherLayout(capsvc_relativePath(path).c_str(), other, sizeof(other));
+  return send_file(req, thumb, tst, "image/jpeg", "inline", immutable);
+}
 
-  // Acquire mutex so stream can't access camera while capturing
-  if (cameraLock) {
-    if (xSemaphoreTake(cameraLock, pdMS_TO_TICKS(3000)) != pdTRUE) {
-      Serial.println("capture: failed to take camera lock");
-      httpd_resp_set_type(req, "text/plain");
-      httpd_resp_send(req, "Capture failed: busy\n", strlen("Capture failed: busy\n"));
-      return ESP_FAIL;
-    }
+// ---------- /migrate handler: move flat photos into day directories ----------
+// /migrate?batch=N moves up to N (default 50) old capture_YYYYMMDD_HHMMSS.jpg
+// files per call; call it until nothing is left. Each call is bounded, so it
+// never holds the card for long.
+#define MIGRATE_BATCH_MAX 500
+
+static esp_err_t migrate_get_handler(httpd_req_t *req) {
+  if (!sd_mounted) {
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "SD card not mounted");
+    return ESP_FAIL;
   }
+  char query[32];
+  char val[8];
+  int batch = 50;
+  if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+      httpd_query_key_value(query, "batch", val, sizeof(val)) == ESP_OK) {
+    batch = constrain(atoi(val), 1, MIGRATE_BATCH_MAX);
+  }
+  size_t remaining = 0;
+  size_t moved = capsvc_migrateFlat(batch, &remaining);
+  char resp[128];
+  int n = snprintf(resp, sizeof(resp), remaining ? "Moved %u files, %u catalog records left to check; call again\n"
+                                                 : "Moved %u files, migration complete\n",
+                   (unsigned)moved, (unsigned)remaining);
+  httpd_resp_set_type(req, "text/plain");
+  httpd_resp_send(req, resp, n);
+  return ESP_OK;
+}
+
+// ---------- /capture?burst=N&interval_ms=M ----------
+#define BURST_MAX_INTERVAL_MS 2000
 
-  // flush and get a fresh fb that differs from the previously-held one
-  camera_fb_t *fb = flush_and_get_new_fb(/*retries=*/10, /*delay_ms=*/80, /*sample_size=*/64);
-  if (!fb) {
-    Serial.println("capture: no fresh framebuffer");
-    if (cameraLock) xSemaphoreGive(cameraLock);
+// one line naming the pre-event files that evring_trigger() is saving alongside
+static String event_note(int pre) {
+  if (pre < 0) return "";
+  return "Event: " + String(pre) + " pre-trigger + " + String(EVRING_POST_FRAMES) + " post-trigger frames saving as YYYY/MM/DD/event_*.jpg\n";
+}
+
+static esp_err_t capture_burst(httpd_req_t *req, int count, uint32_t interval_ms, bool async, int pre, int64_t t_start) {
+  if (count > CAPSVC_BURST_MAX) count = CAPSVC_BURST_MAX;
+  if (interval_ms > BURST_MAX_INTERVAL_MS) interval_ms = BURST_MAX_INTERVAL_MS;
+
+  uint32_t jobs[CAPSVC_BURST_MAX];
+  size_t queued = capsvc_submitBurst(CAPTURE_NAME_DATED, count, interval_ms, jobs);
+  if (queued == 0) {
     httpd_resp_set_type(req, "text/plain");
     httpd_resp_send(req, "Capture failed: no frame\n", strlen("Capture failed: no frame\n"));
     return ESP_FAIL;
   }
 
-  String filename = make_dated_filename();
-  Serial.print("Taking picture: ");
-  Serial.println(filename);
+  String resp = "Burst: " + String((unsigned)queued) + " of " + String(count) + " frames\n" + event_note(pre);
+  for (size_t i = 0; i < queued; ++i) {
+    CaptureJobInfo info;
+    if (async) {
+      resp += "Status URL: /capture/status?id=" + String((unsigned)jobs[i]) + "\n";
+    } else if (capsvc_wait(jobs[i], 10000, &info) && info.state == CAPTURE_JOB_DONE) {
+      resp += "Download URL: /download?file=" + capsvc_relativePath(info.path) + "\n";
+    } else {
+      resp += "Failed: job " + String((unsigned)jobs[i]) + "\n";
+    }
+  }
+  if (async) httpd_resp_set_status(req, "202 Accepted");
+  httpd_resp_set_type(req, "text/plain");
+  httpd_resp_send(req, resp.c_str(), resp.length());
+  Serial.printf("/capture burst of %u took %lld ms\n", (unsigned)queued,
+                (long long)((esp_timer_get_time() - t_start) / 1000));
+  return ESP_OK;
+}
+
+// ---------- capture handler: save a frame captured after the request ----------
+// The frame is grabbed and copied before this returns; the SD write happens on
+// the capture_service writer task. By default the handler waits for the write
+// and replies with the download URL; /capture?async=1 replies 202 with a job id
+// that can be polled at /capture/status?id=N. It also saves the pre-event ring
+// when EVENT_TRIGGERS has EVENT_ON_CAPTURE; ?event=0 or ?event=1 overrides that.
+static esp_err_t capture_get_handler(httpd_req_t *req) {
+  Serial.println("/capture handler called");
+  int64_t t_start = esp_timer_get_time();
+
+  bool async = false;
+  bool event = (EVENT_TRIGGERS & EVENT_ON_CAPTURE) != 0;
+  int burst = 0;
+  uint32_t interval_ms = 0;
+  char query[96];
+  char value[8];
+  if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+    if (httpd_query_key_value(query, "async", value, sizeof(value)) == ESP_OK) async = atoi(value) != 0;
+    if (httpd_query_key_value(query, "event", value, sizeof(value)) == ESP_OK) event = atoi(value) != 0;
+    if (httpd_query_key_value(query, "burst", value, sizeof(value)) == ESP_OK) burst = atoi(value);
+    if (httpd_query_key_value(query, "interval_ms", value, sizeof(value)) == ESP_OK) interval_ms = strtoul(value, NULL, 10);
+  }
+  int pre = event ? evring_trigger("http") : -1;
+  if (burst > 1) return capture_burst(req, burst, interval_ms, async, pre, t_start);
 
-  FILE *file = fopen(filename.c_str(), "wb");
-  if (file != NULL) {
-    size_t written = fwrite(fb->buf, 1, fb->len, file);
-    fflush(file);
-    int fd = fileno(file);
-    if (fd >= 0) fsync(fd);
-    Serial.printf("File saved: %s (bytes: %u)\n", filename.c_str(), (unsigned)written);
-    fclose(file);
+  uint32_t job = capsvc_submit(CAPTURE_NAME_DATED);
+  if (!job) {
+    httpd_resp_set_type(req, "text/plain");
+    httpd_resp_send(req, "Capture failed: no frame\n", strlen("Capture failed: no frame\n"));
+    return ESP_FAIL;
+  }
+
+  String resp;
+  CaptureJobInfo info;
+  if (async) {
+    resp = "Job: " + String((unsigned)job) + "\nStatus URL: /capture/status?id=" + String((unsigned)job) + "\n" + event_note(pre);
+    httpd_resp_set_status(req, "202 Accepted");
+  } else if (capsvc_wait(job, 10000, &info) && info.state == CAPTURE_JOB_DONE) {
+    // respond with a download link (relative)
+    resp = "Saved: " + String(info.path) + "\nDownload URL: /download?file=" + capsvc_relativePath(info.path) + "\n" + event_note(pre);
   } else {
-    Serial.println("Could not open file for writing");
-    esp_camera_fb_return(fb);
-    if (cameraLock) xSemaphoreGive(cameraLock);
     httpd_resp_set_type(req, "text/plain");
     httpd_resp_send(req, "Capture failed: file error\n", strlen("Capture failed: file error\n"));
     return ESP_FAIL;
   }
+  httpd_resp_set_type(req, "text/plain");
+  httpd_resp_send(req, resp.c_str(), resp.length());
+  Serial.printf("/capture took %lld ms with %d open streams\n",
+                (long long)((esp_timer_get_time() - t_start) / 1000), strm_activeCount());
+  return ESP_OK;
+}
 
-  esp_camera_fb_return(fb);
-  // release lock
-  if (cameraLock) xSemaphoreGive(cameraLock);
-
-  // respond with a download link (relative)
-  String rel = filename;
-  if (rel.startsWith("/sdcard/")) rel = rel.substring(strlen("/sdcard/"));
-  if (rel.startsWith("/")) rel = rel.substring(1);
-  String resp = "Saved: " + filename + "\nDownload URL: /download?file=" + rel + "\n";
+// ---------- /capture/status handler: state of an asynchronous capture job ----------
+static esp_err_t capture_status_get_handler(httpd_req_t *req) {
+  char query[32];
+  char value[12];
+  if (httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK ||
+      httpd_query_key_value(query, "id", value, sizeof(value)) != ESP_OK) {
+    httpd_resp_send_404(req);
+    return ESP_FAIL;
+  }
+  CaptureJobInfo info;
+  if (!capsvc_status(strtoul(value, NULL, 10), &info)) {
+    httpd_resp_send_404(req);
+    return ESP_FAIL;
+  }
+  String resp = "Job: " + String((unsigned)info.id) + "\nState: ";
+  if (info.state == CAPTURE_JOB_QUEUED) resp += "queued\n";
+  else if (info.state == CAPTURE_JOB_DONE) resp += "done\nDownload URL: /download?file=" + capsvc_relativePath(info.path) + "\n";
+  else resp += "failed\n";
   httpd_resp_set_type(req, "text/plain");
   httpd_resp_send(req, resp.c_str(), resp.length());
   return ESP_OK;
@@ -483,7 +1104,7 @@ static esp_err_t init_sdcard() {
   sdmmc_slot_config_t slot_config = SDMMC_SLOT_CONFIG_DEFAULT();
   esp_vfs_fat_sdmmc_mount_config_t mount_config = {
     .format_if_mount_failed = false,
-    .max_files = 5,
+    .max_files = 8,   // SDWR_GROUP_FILES held open by the writer plus downloads
   };
   sdmmc_card_t *card;
   Serial.println("Mounting SD card...");
@@ -501,6 +1122,12 @@ static esp_err_t init_sdcard() {
 void startCameraServer() {
   httpd_config_t config_http = HTTPD_DEFAULT_CONFIG();
   config_http.server_port = 80;
+  // every open stream keeps its socket; leave room for control requests
+  config_http.max_open_sockets = STRM_MAX_SESSIONS + 3;
+  config_http.max_uri_handlers = 20;
+  // download validation and catalog reads keep a few KB of buffers on the stack
+  config_http.stack_size = 8192;
+  if (!strm_begin()) Serial.println("Failed to start stream workers");
   if (httpd_start(&stream_httpd, &config_http) == ESP_OK) {
     httpd_uri_t index_uri = { .uri = "/", .method = HTTP_GET, .handler = stream_handler, .user_ctx = NULL };
     httpd_register_uri_handler(stream_httpd, &index_uri);
@@ -508,8 +1135,30 @@ void startCameraServer() {
     httpd_register_uri_handler(stream_httpd, &files_uri);
     httpd_uri_t download_uri = { .uri = "/download", .method = HTTP_GET, .handler = download_get_handler, .user_ctx = NULL };
     httpd_register_uri_handler(stream_httpd, &download_uri);
+    httpd_uri_t download_head_uri = { .uri = "/download", .method = HTTP_HEAD, .handler = download_get_handler, .user_ctx = NULL };
+    httpd_register_uri_handler(stream_httpd, &download_head_uri);
     httpd_uri_t capture_uri = { .uri = "/capture", .method = HTTP_GET, .handler = capture_get_handler, .user_ctx = NULL };
     httpd_register_uri_handler(stream_httpd, &capture_uri);
+    httpd_uri_t capture_status_uri = { .uri = "/capture/status", .method = HTTP_GET, .handler = capture_status_get_handler, .user_ctx = NULL };
+    httpd_register_uri_handler(stream_httpd, &capture_status_uri);
+    httpd_uri_t latest_uri = { .uri = "/latest.jpg", .method = HTTP_GET, .handler = latest_get_handler, .user_ctx = NULL };
+    httpd_register_uri_handler(stream_httpd, &latest_uri);
+    httpd_uri_t jpg_uri = { .uri = "/jpg", .method = HTTP_GET, .handler = latest_get_handler, .user_ctx = NULL };
+    httpd_register_uri_handler(stream_httpd, &jpg_uri);
+    httpd_uri_t stats_uri = { .uri = "/stats", .method = HTTP_GET, .handler = stats_get_handler, .user_ctx = NULL };
+    httpd_register_uri_handler(stream_httpd, &stats_uri);
+    httpd_uri_t motion_uri = { .uri = "/motion", .method = HTTP_GET, .handler = motion_get_handler, .user_ctx = NULL };
+    httpd_register_uri_handler(stream_httpd, &motion_uri);
+    httpd_uri_t schedule_uri = { .uri = "/schedule", .method = HTTP_GET, .handler = schedule_get_handler, .user_ctx = NULL };
+    httpd_register_uri_handler(stream_httpd, &schedule_uri);
+    httpd_uri_t thumb_uri = { .uri = "/thumb", .method = HTTP_GET, .handler = thumb_get_handler, .user_ctx = NULL };
+    httpd_register_uri_handler(stream_httpd, &thumb_uri);
+    httpd_uri_t api_files_uri = { .uri = "/api/files", .method = HTTP_GET, .handler = api_files_get_handler, .user_ctx = NULL };
+    httpd_register_uri_handler(stream_httpd, &api_files_uri);
+    httpd_uri_t export_uri = { .uri = "/export", .method = HTTP_GET, .handler = export_get_handler, .user_ctx = NULL };
+    httpd_register_uri_handler(stream_httpd, &export_uri);
+    httpd_uri_t migrate_uri = { .uri = "/migrate", .method = HTTP_GET, .handler = migrate_get_handler, .user_ctx = NULL };
+    httpd_register_uri_handler(stream_httpd, &migrate_uri);
   } else {
     Serial.println("Failed to start HTTP server");
   }
@@ -548,6 +1197,8 @@ void setup() {
     config.frame_size = FRAMESIZE_SVGA;
     config.jpeg_quality = 12;
     config.fb_count = 2;
+    // always hand out the newest frame; capture timestamps then decide freshness
+    config.grab_mode = CAMERA_GRAB_LATEST;
   } else {
     config.frame_size = FRAMESIZE_VGA;
     config.jpeg_quality = 15;
@@ -572,9 +1223,33 @@ void setup() {
     Serial.printf("Camera init failed with error 0x%x\n", err);
     return;
   }
+  // every frame buffer after this point comes from the fixed slab pool:
+  // 4 broadcaster slots, 4 tier slabs and the capture write queue
+  if (!fpool_begin(config.frame_size, psramFound() ? 16 : 3)) Serial.println("Failed to allocate frame pool");
+
+  // the shared decode buffer for stream tiers, thumbnails and motion
+  if (!jpgscale_begin(config.frame_size)) Serial.println("Reduced stream tiers and thumbnails disabled");
+
+  // single producer for all stream viewers
+  if (!fbc_begin(cameraLock)) Serial.println("Failed to start frame capture task");
+  if (!sdwr_begin(SD_DURABILITY)) Serial.println("Failed to allocate SD write buffer");
+  if (!thumb_begin(THUMBNAILS_EAGER)) Serial.println("Thumbnails disabled");
+  if (!export_begin()) Serial.println("Export disabled");
+  if (!capsvc_begin()) Serial.println("Failed to start capture writer");
+  if (!evring_begin((EVENT_TRIGGERS & EVENT_ON_GPIO) ? EVENT_TRIGGER_GPIO : -1)) Serial.println("Pre-event ring disabled");
+  if (!motion_begin(config.frame_size, on_motion, MOTION_ENABLED)) Serial.println("Motion detection disabled");
+  if (!sched_begin(CAPTURE_SCHEDULE, CAPTURE_CATCHUP, on_schedule, ntp_resync)) Serial.println("Failed to start capture scheduler");
+
   esp_err_t sd_err = init_sdcard();
   if (sd_err != ESP_OK) {
     Serial.printf("SD Card init failed with error 0x%x\n", sd_err);
+  } else if (!catalog_begin()) {
+    Serial.println("Photo catalog unavailable");
+  } else {
+    CatalogRetention limits = { RETENTION_MAX_FILES, (uint64_t)RETENTION_MAX_MB << 20,
+                                (uint64_t)RETENTION_MIN_FREE_MB << 20 };
+    catalog_setRetention(limits);
+    catalog_enforceRetention();
   }
 
   Serial.print("Camera Stream Ready! Go to: http://");
@@ -584,83 +1259,6 @@ void setup() {
 }
 
 void loop() {
-  if (internet_connected && millis() - lastNtpSync > 3600000UL) {
-    setup_time();
-    lastNtpSync = millis();
-  }
-
-  time_t now;
-  struct tm timeinfo;
-  time(&now);
-  localtime_r(&now, &timeinfo);
-
-  bool time_known = (timeinfo.tm_year >= (2016 - 1900)) && internet_connected;
-
-  if (time_known && timeinfo.tm_min == 0 && timeinfo.tm_sec == 0 && timeinfo.tm_hour != lastPhotoHour) {
-    Serial.printf("Camera taking photo at %02d:00:00\n", timeinfo.tm_hour);
-    // Acquire lock and save via capture handler would do same; call save directly with lock to avoid duplicate code
-    if (cameraLock) {
-      if (xSemaphoreTake(cameraLock, pdMS_TO_TICKS(3000)) == pdTRUE) {
-        camera_fb_t *fb = flush_and_get_new_fb();
-        if (fb) {
-          String filename = make_dated_filename();
-          FILE *file = fopen(filename.c_str(), "wb");
-          if (file) {
-            size_t written = fwrite(fb->buf, 1, fb->len, file);
-            fflush(file);
-            int fd = fileno(file);
-            if (fd >= 0) fsync(fd);
-            fclose(file);
-            Serial.printf("File saved: %s (bytes: %u)\n", filename.c_str(), (unsigned)written);
-          } else {
-            Serial.println("Could not open file for writing (hourly)");
-          }
-          esp_camera_fb_return(fb);
-        } else {
-          Serial.println("No fresh fb for hourly capture");
-        }
-        xSemaphoreGive(cameraLock);
-      } else {
-        Serial.println("Hourly capture: camera busy");
-      }
-    } else {
-      // fallback if no lock
-      save_photo(true);
-    }
-    lastPhotoHour = timeinfo.tm_hour;
-    delay(2000);
-  } else if (!time_known && lastPhotoHour != -1) {
-    // Fall back: save numbered if time unknown
-    if (cameraLock) {
-      if (xSemaphoreTake(cameraLock, pdMS_TO_TICKS(3000)) == pdTRUE) {
-        camera_fb_t *fb = flush_and_get_new_fb();
-        if (fb) {
-          String filename = make_numbered_filename();
-          FILE *file = fopen(filename.c_str(), "wb");
-          if (file) {
-            size_t written = fwrite(fb->buf, 1, fb->len, file);
-            fflush(file);
-            int fd = fileno(file);
-            if (fd >= 0) fsync(fd);
-            fclose(file);
-            Serial.printf("File saved: %s (bytes: %u)\n", filename.c_str(), (unsigned)written);
-          } else {
-            Serial.println("Could not open file for writing (numbered)");
-          }
-          esp_camera_fb_return(fb);
-        } else {
-          Serial.println("No fresh fb for numbered capture");
-        }
-        xSemaphoreGive(cameraLock);
-      } else {
-        Serial.println("Numbered capture: camera busy");
-      }
-    } else {
-      save_photo(false);
-    }
-    lastPhotoHour = -1;
-    delay(2000);
-  } else {
-    delay(200);
-  }
+  // captures, NTP resync and motion all run on their own tasks
+  vTaskDelay(portMAX_DELAY);
 }
@@ -2,16 +2,38 @@
 #include <WebServer.h>
 #include <FS.h>
 #include "SD_MMC.h"
-#include <vector>
-#include <algorithm>
+#include "capture_catalog.h"
+#include "capture_service.h"
 
 // Note: this module does not assume a specific mountpoint. It tries to detect whether
 // files live at "/" or "/sdcard" (common on ESP32 boards) and will list/download from
 // whichever location contains image files. This makes the web UI work even if SD was
 // mounted at root or at /sdcard.
+// When the capture catalog is open, listing and retention come from it instead
+// of walking the directory; the scans below are the fallback listing and the
+// root detection.
 
 static WebServer server(80);
-static size_t s_maxFilesToKeep = 0;
+
+// Download names resolved to an opened path, or to nothing. A hit costs one
+// SD_MMC.open() (none for a recent miss) instead of trying every prefix.
+// Found paths are kept until they stop opening; misses expire after
+// SDWS_NEGATIVE_TTL_MS, since a photo may be written under a name that was
+// just asked for.
+#define SDWS_PATH_CACHE 8
+#define SDWS_NEGATIVE_TTL_MS 5000
+
+struct PathCacheEntry {
+  char key[64];       // the requested name, "" when the slot is free
+  char path[80];      // where it opened, "" if nowhere
+  uint32_t at;        // millis() when stored
+};
+
+static PathCacheEntry s_pathCache[SDWS_PATH_CACHE];
+static size_t s_pathNext = 0;     // next slot to replace, round robin
+static uint32_t s_pathHits = 0;
+static uint32_t s_pathMissHits = 0;
+static uint32_t s_pathResolves = 0;
 
 // helper: get best mount root by trying "/" then "/sdcard" and returning the one
 // that has files (prefers "/" if both have files).
@@ -58,6 +80,22 @@ static String detectSdRoot() {
   return String("/sdcard");
 }
 
+static PathCacheEntry* findCachedPath(const String &key) {
+  for (size_t i = 0; i < SDWS_PATH_CACHE; ++i) {
+    if (s_pathCache[i].key[0] && key == s_pathCache[i].key) return &s_pathCache[i];
+  }
+  return NULL;
+}
+
+static void cachePath(const String &key, const char *path) {
+  if (key.length() >= sizeof(s_pathCache[0].key) || strlen(path) >= sizeof(s_pathCache[0].path)) return;
+  PathCacheEntry &e = s_pathCache[s_pathNext];
+  s_pathNext = (s_pathNext + 1) % SDWS_PATH_CACHE;
+  strlcpy(e.key, key.c_str(), sizeof(e.key));
+  strlcpy(e.path, path, sizeof(e.path));
+  e.at = millis();
+}
+
 // helper: produce content type
 static String getContentType(const String& path){
   if(path.endsWith(".htm") || path.endsWith(".html")) return "text/html";
@@ -89,12 +127,32 @@ static void printDirectoryHtmlAt(File dir, String &out){
   }
 }
 
+// newest ROOT_PAGE photos from the catalog, newest first
+#define ROOT_PAGE 200
+static void printCatalogHtml(String &out){
+  size_t total = catalog_count();
+  size_t start = total > ROOT_PAGE ? total - ROOT_PAGE : 0;
+  out += "<p>Newest " + String((unsigned)(total - start)) + " of " + String((unsigned)total) + " photos</p>";
+  CatalogRecord recs[16];
+  for (size_t hi = total; hi > start; ) {
+    size_t k = hi - start < 16 ? hi - start : 16;
+    if (catalog_read(hi - k, recs, k) != k) break;
+    for (size_t i = k; i-- > 0; ) {
+      String rel = String(recs[i].name);
+      out += "<a href=\"/download?file=" + rel + "\">" + rel + "</a> (" + String((unsigned)recs[i].size) + " bytes)<br>";
+    }
+    hi -= k;
+  }
+}
+
 static void handleRoot(){
   String html = "<!doctype html><html><head><meta charset='utf-8'><title>ESP32-CAM SD</title></head><body>";
   html += "<h2>Files on SD card</h2>";
 
   if (SD_MMC.cardType() == CARD_NONE) {
     html += "SD card not mounted.<br>";
+  } else if (catalog_count() > 0) {
+    printCatalogHtml(html);
   } else {
     String root = detectSdRoot();
     if (root.length() == 0) {
@@ -115,8 +173,61 @@ static void handleRoot(){
   server.send(200, "text/html", html);
 }
 
-// Attempt to open the requested filePath using a few candidate prefixes.
-// Accepts incoming file param like "img_..." or "/img_..." or "/sdcard/img_..."
+// Open the requested file trying a few candidate paths, most likely first.
+// Accepts incoming file param like "img_..." or "/img_..." or "/sdcard/img_...";
+// path gets the one that opened.
+static File resolveFile(const String& f, String &path) {
+  String rel = f;
+  while (rel.startsWith("/")) rel = rel.substring(1);
+  String base = rel.startsWith("sdcard/") ? rel.substring(strlen("sdcard/")) : rel;
+
+  // Candidate list, without repeats:
+  // 1) as provided, if absolute
+  // 2) /<f> and /sdcard/<f>
+  // 3) without a leading sdcard/
+  // 4) the same photo in the other layout (flat capture_YYYYMMDD_HHMMSS.jpg
+  //    or dated YYYY/MM/DD/HHMMSS.jpg), for links made before a migration
+  // 5) under the detected mount root, which scans / and /sdcard, so only if
+  //    none of the direct opens worked
+  String candidates[7];
+  size_t n = 0;
+  auto add = [&](const String &c) {
+    for (size_t i = 0; i < n; ++i) if (candidates[i] == c) return;
+    candidates[n++] = c;
+  };
+  if (f.startsWith("/")) add(f);
+  add("/" + rel);
+  add("/sdcard/" + rel);
+  add("/" + base);
+  char other[CATALOG_NAME_LEN];
+  bool has_other = capsvc_otherLayout(base.c_str(), other, sizeof(other));
+  if (has_other) add(String("/") + other);
+
+  for (size_t i = 0; i < n; ++i) {
+    File file = SD_MMC.open(candidates[i].c_str());
+    if (file) {
+      path = candidates[i];
+      return file;
+    }
+  }
+
+  size_t tried = n;
+  String root = detectSdRoot();
+  if (root.length() && root != "/") {
+    add(root + "/" + rel);
+    if (has_other) add(root + "/" + other);
+  }
+  for (size_t i = tried; i < n; ++i) {
+    File file = SD_MMC.open(candidates[i].c_str());
+    if (file) {
+      path = candidates[i];
+      return file;
+    }
+  }
+  // nothing found
+  return File();
+}
+
 static File openFileWithPrefixes(const String& reqFile) {
   String f = reqFile;
   if (f.length() == 0) return File();
@@ -124,59 +235,28 @@ static File openFileWithPrefixes(const String& reqFile) {
   // normalize: remove leading "./"
   while (f.startsWith("./")) f = f.substring(2);
 
-  // if user passed with leading slash keep it
-  bool startsSlash = f.startsWith("/");
-
-  // Candidate list:
-  // 1) as-provided
-  // 2) if it doesn't start with / and /sdcard exists -> "/sdcard/" + f
-  // 3) if it doesn't start with / -> "/" + f
-  // 4) / + f (if not yet tried)
-  // 5) try root guess from detectSdRoot + f
-  File file;
-
-  // 1) try as-provided
-  file = SD_MMC.open(f.c_str());
-  if (file) return file;
-
-  // 2) try /sdcard/<f> (if not already)
-  if (!f.startsWith("/")) {
-    String candidate = String("/sdcard/") + f;
-    file = SD_MMC.open(candidate.c_str());
-    if (file) return file;
-  }
-
-  // 3) try /<f>
-  if (!f.startsWith("/")) {
-    String candidate = String("/") + f;
-    file = SD_MMC.open(candidate.c_str());
-    if (file) return file;
-  }
-
-  // 4) if user supplied absolute path but file open failed, try trimming leading slash and prefixing /sdcard/
-  if (f.startsWith("/")) {
-    String trim = f.substring(1);
-    String candidate = String("/sdcard/") + trim;
-    file = SD_MMC.open(candidate.c_str());
-    if (file) return file;
-    candidate = String("/") + trim;
-    file = SD_MMC.open(candidate.c_str());
-    if (file) return file;
-  }
-
-  // 5) try detectSdRoot + "/" + basename
-  String root = detectSdRoot();
-  if (root.length()) {
-    String base = f;
-    // if f includes path separators, keep them (user might pass path). Otherwise use base
-    if (base.startsWith("/")) base = base.substring(1);
-    String candidate = root + "/" + base;
-    file = SD_MMC.open(candidate.c_str());
-    if (file) return file;
+  PathCacheEntry *e = findCachedPath(f);
+  if (e) {
+    if (!e->path[0]) {
+      if (millis() - e->at < SDWS_NEGATIVE_TTL_MS) {
+        s_pathMissHits++;
+        return File();
+      }
+    } else {
+      File file = SD_MMC.open(e->path);
+      if (file) {
+        s_pathHits++;
+        return file;
+      }
+    }
+    e->key[0] = '\0';   // stale: the file moved, went or may have appeared
   }
 
-  // nothing found
-  return File();
+  s_pathResolves++;
+  String path;
+  File file = resolveFile(f, path);
+  cachePath(f, file ? path.c_str() : "");
+  return file;
 }
 
 static void handleDownload(){
@@ -241,42 +321,17 @@ void sdws_handleClient() {
   server.handleClient();
 }
 
+// Retention lives in the capture catalog, which keeps photos in capture order
+// with their sizes: enforcing it deletes only the excess from the front.
 void sdws_setMaxFilesToKeep(size_t maxFiles) {
-  s_maxFilesToKeep = maxFiles;
+  CatalogInfo ci;
+  catalog_getInfo(&ci);
+  ci.retention.max_files = maxFiles;
+  catalog_setRetention(ci.retention);
 }
 
 void sdws_enforceRetentionPolicy() {
-  if (s_maxFilesToKeep == 0) return;
-
-  // detect best root to remove from
-  String root = detectSdRoot();
-  if (root.length() == 0) return;
-
-  File dir = SD_MMC.open(root.c_str());
-  if(!dir) return;
-  std::vector<String> files;
-  while(true){
-    File entry = dir.openNextFile();
-    if(!entry) break;
-    if(!entry.isDirectory()){
-      // entry.name() can be relative to mount; save basename only
-      String n = String(entry.name());
-      int lastSlash = n.lastIndexOf('/');
-      if (lastSlash >= 0) n = n.substring(lastSlash + 1);
-      files.push_back(n);
-    }
-    entry.close();
-  }
-  dir.close();
-
-  if(files.size() <= s_maxFilesToKeep) return;
-  std::sort(files.begin(), files.end()); // timestamp-style names sort chronologically
-  size_t toRemove = files.size() - s_maxFilesToKeep;
-  for(size_t i=0;i<toRemove;i++){
-    String p = root + "/" + files[i];
-    Serial.printf("Removing old file: %s\n", p.c_str());
-    SD_MMC.remove(p.c_str());
-  }
+  catalog_enforceRetention();
 }
 
 String sdws_getStatus() {
@@ -294,6 +349,8 @@ String sdws_getStatus() {
   else if (ct == CARD_SD) out += "SDSC\n";
   else if (ct == CARD_SDHC) out += "SDHC/SDXC\n";
   else out += "UNKNOWN\n";
+  out += "Path cache: " + String(s_pathHits) + " hits, " + String(s_pathMissHits) + " cached misses, " +
+         String(s_pathResolves) + " resolved\n";
   return out;
 }
 
@@ -7,7 +7,7 @@
 void sdws_begin();
 void sdws_handleClient();
 
-// Retention policy control: set 0 to disable
+// Retention policy control (the catalog's max_files limit): set 0 to disable
 void sdws_setMaxFilesToKeep(size_t maxFiles);
 void sdws_enforceRetentionPolicy();
 
@@ -0,0 +1,165 @@
+#include "sd_writer.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+struct PendingFile {
+  int fd;
+  size_t bytes;
+  SdCommitCallback done;
+  void *arg;
+};
+
+static uint8_t *s_block = NULL;
+static size_t s_blockSize = 0;
+static SdDurability s_mode = SDWR_SYNC_EACH;
+static PendingFile s_pending[SDWR_GROUP_FILES];
+static size_t s_pendingCount = 0;
+static int64_t s_groupStart = 0;
+static SdWriterStats s_stats;          // written by the writer task, read by /stats
+static portMUX_TYPE s_statsMux = portMUX_INITIALIZER_UNLOCKED;
+static uint64_t s_busyUs = 0;
+
+static void account(int64_t t0) {
+  s_busyUs += esp_timer_get_time() - t0;
+  taskENTER_CRITICAL(&s_statsMux);
+  if (s_busyUs) s_stats.kbps = (uint32_t)(s_stats.bytes * 1000000 / s_busyUs / 1024);
+  taskEXIT_CRITICAL(&s_statsMux);
+}
+
+// close, and report, one file
+static void finish(int fd, size_t bytes, bool ok, SdCommitCallback done, void *arg) {
+  if (fd >= 0 && close(fd) != 0) ok = false;
+  taskENTER_CRITICAL(&s_statsMux);
+  if (ok) {
+    s_stats.files++;
+    s_stats.bytes += bytes;
+  } else {
+    s_stats.failures++;
+  }
+  taskEXIT_CRITICAL(&s_statsMux);
+  if (done) done(arg, ok, bytes);
+}
+
+bool sdwr_begin(SdDurability mode) {
+  if (s_block) return true;
+  // internal, DMA-capable memory; shrink towards 4 KB if it is short
+  for (s_blockSize = SDWR_BLOCK_SIZE; s_blockSize >= 4096 && !s_block; s_blockSize /= 2) {
+    s_block = (uint8_t*)heap_caps_malloc(s_blockSize, MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL);
+    if (s_block) break;
+  }
+  if (!s_block) {
+    Serial.println("sdwr: no DMA memory for the write block");
+    return false;
+  }
+  s_mode = mode;
+  memset(&s_stats, 0, sizeof(s_stats));
+  s_stats.block_size = s_blockSize;
+  Serial.printf("sdwr: %u KB blocks, durability %d\n", (unsigned)(s_blockSize / 1024), (int)mode);
+  return true;
+}
+
+void sdwr_setDurability(SdDurability mode) {
+  sdwr_commit();
+  s_mode = mode;
+}
+
+SdDurability sdwr_getDurability() {
+  return s_mode;
+}
+
+void sdwr_write(const char *path, const uint8_t *data, size_t len, SdCommitCallback done, void *arg) {
+  int64_t t0 = esp_timer_get_time();
+  if (!s_block) {
+    if (done) done(arg, false, 0);
+    return;
+  }
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  // first file of a new day directory
+  if (fd < 0 && errno == ENOENT && sdwr_makeDirs(path)) fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    Serial.printf("Could not open file for writing: %s\n", path);
+    finish(-1, 0, false, done, arg);
+    return;
+  }
+
+  size_t written = 0;
+  bool ok = true;
+  while (written < len) {
+    size_t n = len - written < s_blockSize ? len - written : s_blockSize;
+    memcpy(s_block, data + written, n);
+    ssize_t w = ::write(fd, s_block, n);
+    if (w != (ssize_t)n) {
+      ok = false;
+      if (w > 0) written += w;
+      break;
+    }
+    written += n;
+  }
+  uint32_t us = (uint32_t)(esp_timer_get_time() - t0);
+  taskENTER_CRITICAL(&s_statsMux);
+  s_stats.last_us = us;
+  if (us > s_stats.max_us) s_stats.max_us = us;
+  taskEXIT_CRITICAL(&s_statsMux);
+
+  if (!ok || s_mode != SDWR_SYNC_GROUP) {
+    if (ok && s_mode == SDWR_SYNC_EACH && fsync(fd) != 0) ok = false;
+    finish(fd, written, ok, done, arg);
+    taskENTER_CRITICAL(&s_statsMux);
+    s_stats.commits++;
+    taskEXIT_CRITICAL(&s_statsMux);
+    account(t0);
+    return;
+  }
+
+  if (s_pendingCount == 0) s_groupStart = esp_timer_get_time();
+  s_pending[s_pendingCount++] = { fd, written, done, arg };
+  account(t0);
+  if (s_pendingCount == SDWR_GROUP_FILES) sdwr_commit();
+}
+
+bool sdwr_makeDirs(const char *path) {
+  char dir[96];
+  strlcpy(dir, path, sizeof(dir));
+  char *last = strrchr(dir, '/');
+  if (!last || last == dir) return true;
+  *last = '\0';
+  // the mount point itself cannot be created; only the final result matters
+  for (char *p = strchr(dir + 1, '/'); p; p = strchr(p + 1, '/')) {
+    *p = '\0';
+    mkdir(dir, 0755);
+    *p = '/';
+  }
+  struct stat st;
+  return mkdir(dir, 0755) == 0 || (stat(dir, &st) == 0 && S_ISDIR(st.st_mode));
+}
+
+void sdwr_commit() {
+  if (!s_pendingCount) return;
+  int64_t t0 = esp_timer_get_time();
+  for (size_t i = 0; i < s_pendingCount; ++i) {
+    const PendingFile &p = s_pending[i];
+    finish(p.fd, p.bytes, true, p.done, p.arg);
+  }
+  s_pendingCount = 0;
+  taskENTER_CRITICAL(&s_statsMux);
+  s_stats.commits++;
+  taskEXIT_CRITICAL(&s_statsMux);
+  account(t0);
+}
+
+uint32_t sdwr_commitDueMs() {
+  if (!s_pendingCount) return UINT32_MAX;
+  int64_t left = SDWR_GROUP_MS - (esp_timer_get_time() - s_groupStart) / 1000;
+  return left > 0 ? (uint32_t)left : 0;
+}
+
+void sdwr_getStats(SdWriterStats *stats) {
+  taskENTER_CRITICAL(&s_statsMux);
+  *stats = s_stats;
+  taskEXIT_CRITICAL(&s_statsMux);
+}
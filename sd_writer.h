@@ -0,0 +1,70 @@
+#ifndef SD_WRITER_H
+#define SD_WRITER_H
+
+#include <Arduino.h>
+
+// Block write engine for the capture files. Data is copied into a DMA-capable
+// buffer and written in SDWR_BLOCK_SIZE pieces, so every full write starts on
+// a block boundary of the file (and so of its clusters) and reaches the SDMMC
+// driver in one multi-sector transfer instead of being bounced 512 bytes at a
+// time out of PSRAM.
+//
+// Durability modes:
+//   SDWR_SYNC_EACH   fsync() and close every file before reporting it
+//   SDWR_SYNC_GROUP  leave files open and close them together: every
+//                    SDWR_GROUP_FILES files, after SDWR_GROUP_MS, or when the
+//                    caller calls sdwr_commit() because it has nothing queued
+//   SDWR_SYNC_NONE   close without fsync()
+// FatFs writes the directory entry and FAT sectors when a file is closed, so
+// a reported file is on the card in every mode; the modes decide how often
+// that metadata is written between data blocks.
+//
+// Not thread-safe apart from sdwr_getStats(): call from a single task (the
+// capture writer).
+
+#define SDWR_BLOCK_SIZE (16 * 1024)   // 4, 16 or 32 KB; falls back to smaller if DMA memory is short
+#define SDWR_GROUP_FILES 4            // keep below the mount's max_files
+#define SDWR_GROUP_MS 1000
+
+enum SdDurability {
+  SDWR_SYNC_EACH,
+  SDWR_SYNC_GROUP,
+  SDWR_SYNC_NONE
+};
+
+struct SdWriterStats {
+  uint32_t files;
+  uint32_t failures;
+  uint32_t commits;      // close batches (one per file unless grouping)
+  uint64_t bytes;
+  uint32_t block_size;
+  uint32_t last_us;      // open to last data block of the newest file
+  uint32_t max_us;
+  uint32_t kbps;         // bytes over time spent in open/write/fsync/close
+};
+
+// Called once a file is committed (or has failed). bytes is what reached the card.
+typedef void (*SdCommitCallback)(void *arg, bool ok, size_t bytes);
+
+bool sdwr_begin(SdDurability mode);
+void sdwr_setDurability(SdDurability mode);   // commits anything pending first
+SdDurability sdwr_getDurability();
+
+// Write a whole file, creating missing parent directories. The data is no
+// longer needed when this returns; done is called now or, in group mode, at
+// the next commit.
+void sdwr_write(const char *path, const uint8_t *data, size_t len, SdCommitCallback done, void *arg);
+
+// Create the directories leading to path ("/sdcard/2025/01/02/x.jpg" makes
+// 2025, 2025/01 and 2025/01/02). Returns false if the last one is missing.
+bool sdwr_makeDirs(const char *path);
+
+// Close every pending file now.
+void sdwr_commit();
+
+// Milliseconds until the pending group must be committed, UINT32_MAX if none is pending.
+uint32_t sdwr_commitDueMs();
+
+void sdwr_getStats(SdWriterStats *stats);
+
+#endif // SD_WRITER_H
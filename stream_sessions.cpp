@@ -0,0 +1,287 @@
+#include "stream_sessions.h"
+#include "frame_broadcaster.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "esp_timer.h"
+#include "lwip/sockets.h"
+#include <sys/uio.h>
+#include <errno.h>
+
+// esp_http_server runs every handler on its single worker task, so a stream
+// that loops inside its handler blocks /files, /download and /capture for as
+// long as someone is watching. Stream requests are therefore detached with
+// httpd_req_async_handler_begin() and served by a small pool of tasks here;
+// the httpd worker is back to handling control requests straight away.
+
+// The response is written straight to the socket rather than through
+// httpd_resp_send_chunk(): no chunked transfer encoding (each part carries its
+// own Content-Length and the body ends when the connection closes), and the
+// part header, JPEG and trailing boundary leave in a single writev() so lwIP
+// can pack them into full segments instead of three separate sends.
+#define PART_BOUNDARY "123456789000000000000987654321"
+static const char* _STREAM_RESPONSE_HEADER =
+  "HTTP/1.1 200 OK\r\n"
+  "Content-Type: multipart/x-mixed-replace;boundary=" PART_BOUNDARY "\r\n"
+  "Cache-Control: no-store\r\n"
+  "Connection: close\r\n"
+  "\r\n"
+  "--" PART_BOUNDARY "\r\n";
+static const char* _STREAM_BOUNDARY = "\r\n--" PART_BOUNDARY "\r\n";
+static const char* _STREAM_PART = "Content-Type: image/jpeg\r\nContent-Length: %u\r\n\r\n";
+
+// ?fps= is clamped to this range; the OV2640 delivers about 25 fps at SVGA in JPEG mode
+#define STRM_DEFAULT_FPS 1.0f
+#define STRM_MIN_FPS 0.1f
+#define STRM_MAX_FPS 25.0f
+// with ?suppress=1 an unchanged frame is still sent at least this often (?keepalive= seconds)
+#define STRM_DEFAULT_KEEPALIVE_S 10
+// consecutive frames a reduced tier may fail to encode before the session falls back to full frames
+#define STRM_TIER_MAX_FAILURES 3
+
+static QueueHandle_t s_queue = NULL;
+static SemaphoreHandle_t s_idleWorkers = NULL;  // counts workers free to take a new session
+
+// Frame pacing against absolute deadlines on the esp_timer clock. Send time
+// does not push later frames back, and when a client falls behind the missed
+// deadlines are dropped (it gets the newest frame next) instead of queued.
+struct StreamPacer {
+  int64_t period_us;
+  int64_t next_us;
+};
+
+static void pacer_init(StreamPacer *p, float fps) {
+  p->period_us = (int64_t)(1000000.0f / fps);
+  p->next_us = esp_timer_get_time();
+}
+
+// block until the next deadline is due
+static void pacer_wait(StreamPacer *p) {
+  int64_t wait_us = p->next_us - esp_timer_get_time();
+  if (wait_us >= 1000) vTaskDelay(pdMS_TO_TICKS(wait_us / 1000));
+}
+
+// schedule the deadline after the one just served, skipping any already past
+static void pacer_advance(StreamPacer *p) {
+  int64_t now = esp_timer_get_time();
+  p->next_us += p->period_us;
+  if (p->next_us <= now) {
+    int64_t missed = (now - p->next_us) / p->period_us + 1;
+    p->next_us += missed * p->period_us;
+  }
+}
+
+// ?size= names for the frame tiers; full is the sensor frame as captured
+static const char* const TIER_NAMES[FRAME_TIER_COUNT] = { "full", "hvga", "qvga", "qqvga" };
+
+struct StreamOptions {
+  float fps;
+  FrameTier tier;
+  bool suppress_unchanged;  // skip frames whose fingerprint matches the last one sent
+  int64_t keepalive_us;     // ...but never go longer than this without sending
+};
+
+// Read ?fps=, ?size=, ?suppress= and ?keepalive= from the request, applying defaults and limits.
+static void parse_stream_query(httpd_req_t *req, StreamOptions *opt) {
+  char query[128];
+  char value[16];
+  opt->fps = STRM_DEFAULT_FPS;
+  opt->tier = FRAME_TIER_FULL;
+  opt->suppress_unchanged = false;
+  opt->keepalive_us = (int64_t)STRM_DEFAULT_KEEPALIVE_S * 1000000LL;
+  if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+    if (httpd_query_key_value(query, "fps", value, sizeof(value)) == ESP_OK) opt->fps = atof(value);
+    if (httpd_query_key_value(query, "size", value, sizeof(value)) == ESP_OK) {
+      for (int i = 0; i < FRAME_TIER_COUNT; ++i) {
+        if (strcmp(value, TIER_NAMES[i]) == 0) opt->tier = (FrameTier)i;
+      }
+    }
+    if (httpd_query_key_value(query, "suppress", value, sizeof(value)) == ESP_OK) {
+      opt->suppress_unchanged = atoi(value) != 0;
+    }
+    if (httpd_query_key_value(query, "keepalive", value, sizeof(value)) == ESP_OK && atoi(value) > 0) {
+      opt->keepalive_us = (int64_t)atoi(value) * 1000000LL;
+    }
+  }
+  if (!(opt->fps >= STRM_MIN_FPS)) opt->fps = STRM_MIN_FPS;
+  if (opt->fps > STRM_MAX_FPS) opt->fps = STRM_MAX_FPS;
+}
+
+// writev() until every iovec has gone out; lwIP may accept only part of a large frame.
+// The socket is blocking with httpd's SO_SNDTIMEO, so EAGAIN means the client
+// has not read for the whole send timeout: give up on it, as httpd's own send
+// does, rather than pin a stream worker.
+static esp_err_t send_iov(int fd, struct iovec *iov, int cnt) {
+  while (cnt > 0) {
+    ssize_t n = lwip_writev(fd, iov, cnt);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) Serial.println("stream: send timed out, dropping client");
+      return ESP_FAIL;
+    }
+    while (cnt > 0 && (size_t)n >= iov->iov_len) {
+      n -= iov->iov_len;
+      ++iov;
+      --cnt;
+    }
+    if (cnt > 0) {
+      iov->iov_base = (uint8_t*)iov->iov_base + n;
+      iov->iov_len -= n;
+    }
+  }
+  return ESP_OK;
+}
+
+// Send frames until the client goes away. Runs on a stream worker task.
+static esp_err_t run_session(httpd_req_t *req) {
+  esp_err_t res = ESP_OK;
+  uint32_t last_seq = 0;
+  char part_buf[64];
+  StreamPacer pacer;
+  uint32_t frames = 0;
+  uint64_t wire_bytes = 0;
+  int64_t send_us = 0;
+
+  int fd = httpd_req_to_sockfd(req);
+  if (fd < 0) return ESP_FAIL;
+
+  StreamOptions opt;
+  parse_stream_query(req, &opt);
+  FrameTier tier = opt.tier;
+  int tier_failures = 0;
+  uint32_t last_fp = 0;
+  int64_t last_sent_us = 0;
+  uint32_t suppressed = 0;
+  pacer_init(&pacer, opt.fps);
+  Serial.printf("stream: %s at %.1f fps%s\n", TIER_NAMES[tier], opt.fps,
+                opt.suppress_unchanged ? ", unchanged frames suppressed" : "");
+
+  struct iovec hdr = { (void*)_STREAM_RESPONSE_HEADER, strlen(_STREAM_RESPONSE_HEADER) };
+  res = send_iov(fd, &hdr, 1);
+  if (res != ESP_OK) return res;
+
+  while (true) {
+    pacer_wait(&pacer);
+    // newest frame only; waits only if it was already sent to this client
+    SharedFrame *frame = fbc_waitNewer(last_seq, 5000);
+    if (!frame) {
+      Serial.println("Camera capture failed (stream)");
+      res = ESP_FAIL;
+      break;
+    }
+
+    // a static scene produces identical scan data; send it only as a keep-alive
+    if (opt.suppress_unchanged && frames > 0 && frame->fingerprint == last_fp &&
+        esp_timer_get_time() - last_sent_us < opt.keepalive_us) {
+      last_seq = frame->seq;
+      fbc_release(frame);
+      suppressed++;
+      pacer_advance(&pacer);
+      continue;
+    }
+
+    // reduced tiers are encoded once per frame and shared by every viewer of that tier
+    const uint8_t *jpg;
+    size_t jpg_len;
+    if (!fbc_getTier(frame, tier, &jpg, &jpg_len)) {
+      // no slab or a decode/encode error; one that keeps failing would leave
+      // the client with a header and no frames, so send it full frames instead
+      if (++tier_failures >= STRM_TIER_MAX_FAILURES) {
+        Serial.printf("stream: %s tier failed %d times in a row, sending full frames\n", TIER_NAMES[tier],
+                      tier_failures);
+        tier = FRAME_TIER_FULL;
+      }
+      last_seq = frame->seq;
+      fbc_release(frame);
+      pacer_advance(&pacer);
+      continue;
+    }
+    tier_failures = 0;
+
+    size_t hlen = snprintf((char *)part_buf, 64, _STREAM_PART, (unsigned)jpg_len);
+    struct iovec iov[3] = {
+      { part_buf, hlen },
+      { (void*)jpg, jpg_len },
+      { (void*)_STREAM_BOUNDARY, strlen(_STREAM_BOUNDARY) },
+    };
+    size_t frame_bytes = hlen + jpg_len + iov[2].iov_len;
+    int64_t t0 = esp_timer_get_time();
+    res = send_iov(fd, iov, 3);
+    send_us += esp_timer_get_time() - t0;
+    wire_bytes += frame_bytes;
+    frames++;
+    last_seq = frame->seq;
+    last_fp = frame->fingerprint;
+    last_sent_us = esp_timer_get_time();
+    fbc_release(frame);
+    if (res != ESP_OK) break;
+    pacer_advance(&pacer);
+  }
+
+  if (frames) {
+    Serial.printf("stream: %u frames (%u unchanged suppressed), %u bytes/frame on the wire, %u us/frame in send\n",
+                  (unsigned)frames, (unsigned)suppressed, (unsigned)(wire_bytes / frames), (unsigned)(send_us / frames));
+  }
+  return res;
+}
+
+static void stream_worker(void *arg) {
+  (void)arg;
+  while (true) {
+    httpd_req_t *req = NULL;
+    if (xQueueReceive(s_queue, &req, portMAX_DELAY) != pdTRUE || !req) continue;
+    Serial.printf("stream: session started (%d active)\n", strm_activeCount());
+    run_session(req);
+    // the body was close-delimited, so the connection cannot be reused
+    httpd_sess_trigger_close(req->handle, httpd_req_to_sockfd(req));
+    httpd_req_async_handler_complete(req);
+    xSemaphoreGive(s_idleWorkers);
+    Serial.printf("stream: session ended (%d active)\n", strm_activeCount());
+  }
+}
+
+bool strm_begin() {
+  if (s_queue) return true;
+  s_queue = xQueueCreate(STRM_MAX_SESSIONS, sizeof(httpd_req_t*));
+  s_idleWorkers = xSemaphoreCreateCounting(STRM_MAX_SESSIONS, STRM_MAX_SESSIONS);
+  if (!s_queue || !s_idleWorkers) {
+    Serial.println("strm: failed to create queue");
+    return false;
+  }
+  for (int i = 0; i < STRM_MAX_SESSIONS; ++i) {
+    char name[16];
+    snprintf(name, sizeof(name), "stream_%d", i);
+    // below the httpd task so control requests always win the CPU
+    if (xTaskCreate(stream_worker, name, 4096, NULL, 3, NULL) != pdPASS) {
+      Serial.printf("strm: failed to start worker %d\n", i);
+      return false;
+    }
+  }
+  return true;
+}
+
+esp_err_t strm_submit(httpd_req_t *req) {
+  if (!s_queue) return ESP_ERR_INVALID_STATE;
+  // reserve a worker first so a detached request can always be queued
+  if (xSemaphoreTake(s_idleWorkers, 0) != pdTRUE) return ESP_ERR_NO_MEM;
+
+  httpd_req_t *async_req = NULL;
+  esp_err_t err = httpd_req_async_handler_begin(req, &async_req);
+  if (err != ESP_OK) {
+    xSemaphoreGive(s_idleWorkers);
+    return err;
+  }
+  if (xQueueSend(s_queue, &async_req, 0) != pdTRUE) {
+    // cannot happen while the semaphore and queue sizes match
+    httpd_req_async_handler_complete(async_req);
+    xSemaphoreGive(s_idleWorkers);
+    return ESP_FAIL;
+  }
+  return ESP_OK;
+}
+
+int strm_activeCount() {
+  if (!s_idleWorkers) return 0;
+  return STRM_MAX_SESSIONS - (int)uxSemaphoreGetCount(s_idleWorkers);
+}
@@ -0,0 +1,23 @@
+#ifndef STREAM_SESSIONS_H
+#define STREAM_SESSIONS_H
+
+#include <Arduino.h>
+#include "esp_http_server.h"
+
+// Maximum number of MJPEG viewers served at once. Each one occupies a stream
+// worker task (and one socket) for as long as it stays connected.
+#define STRM_MAX_SESSIONS 4
+
+// Start the stream worker tasks.
+bool strm_begin();
+
+// Hand an incoming stream request over to a worker task. On ESP_OK the request
+// has been detached from the httpd worker (async handler) and the caller must
+// return immediately without touching req again. ESP_ERR_NO_MEM means every
+// worker is busy and the caller still owns req.
+esp_err_t strm_submit(httpd_req_t *req);
+
+// Number of streams currently being served.
+int strm_activeCount();
+
+#endif // STREAM_SESSIONS_H
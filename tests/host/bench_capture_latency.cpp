@@ -0,0 +1,175 @@
+// /capture latency against open streams: the sketch's capture_get_handler()
+// runs on the host with the real capture service, frame broadcaster and
+// stream workers, on the replaying camera (SVGA at 25 fps, two buffers, grab
+// latest), while 0, 1 and then 4 stream sessions at ?fps=25 send every frame to
+// loopback sockets. It prints the handler's latency (p50, avg, max) for each,
+// and the frames per second each stream sent meanwhile.
+//
+//   bench_capture_latency [captures per run]
+//
+// The SD card is a fake that takes as long as a card writing at
+// CAPLAT_SD_KBPS and stores nothing. The host's cores do not contend the way
+// the ESP32's two do, so this shows what the handler waits on (the next
+// frame, the write) and that open streams do not hold it up; the absolute
+// stream cost on the device is bench_stream_send's.
+
+#include "host_env.h"
+#include "host_camera.h"
+#include "../../royclockcamera.ino"
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define CAPLAT_FPS 25
+#define CAPLAT_SD_KBPS 2000
+
+// ---------- httpd ----------
+// A request's uri carries its query; a stream request's aux is its socket.
+static std::string s_response;
+
+esp_err_t httpd_req_get_url_query_str(httpd_req_t *req, char *buf, size_t buf_len) {
+  const char *q = req->uri ? strchr(req->uri, '?') : NULL;
+  if (!q) return ESP_FAIL;
+  strlcpy(buf, q + 1, buf_len);
+  return ESP_OK;
+}
+
+esp_err_t httpd_query_key_value(const char *qry, const char *key, char *val, size_t val_size) {
+  size_t klen = strlen(key);
+  for (const char *p = qry; p && *p; p = strchr(p, '&') ? strchr(p, '&') + 1 : NULL) {
+    if (strncmp(p, key, klen) != 0 || p[klen] != '=') continue;
+    const char *v = p + klen + 1;
+    size_t n = strcspn(v, "&");
+    if (n >= val_size) n = val_size - 1;
+    memcpy(val, v, n);
+    val[n] = '\0';
+    return ESP_OK;
+  }
+  return ESP_FAIL;
+}
+
+esp_err_t httpd_resp_set_status(httpd_req_t*, const char*) { return ESP_OK; }
+esp_err_t httpd_resp_set_type(httpd_req_t*, const char*) { return ESP_OK; }
+
+esp_err_t httpd_resp_send(httpd_req_t*, const char *buf, ssize_t len) {
+  s_response.assign(buf, len);
+  return ESP_OK;
+}
+
+int httpd_req_to_sockfd(httpd_req_t *req) {
+  return (int)(intptr_t)req->aux;
+}
+
+esp_err_t httpd_req_async_handler_begin(httpd_req_t *req, httpd_req_t **out) {
+  *out = new httpd_req_t(*req);
+  return ESP_OK;
+}
+
+esp_err_t httpd_req_async_handler_complete(httpd_req_t *req) {
+  delete req;
+  return ESP_OK;
+}
+
+esp_err_t httpd_sess_trigger_close(httpd_handle_t, int sockfd) {
+  close(sockfd);
+  return ESP_OK;
+}
+
+static std::atomic<uint32_t> s_writes;   // about one per frame sent
+
+ssize_t lwip_writev(int s, const struct iovec *iov, int iovcnt) {
+  s_writes++;
+  return ::writev(s, iov, iovcnt);
+}
+
+// ---------- SD card and the modules behind it ----------
+void sdwr_write(const char*, const uint8_t*, size_t len, SdCommitCallback done, void *arg) {
+  vTaskDelay(pdMS_TO_TICKS(len / CAPLAT_SD_KBPS));   // bytes / (KB/s) ~ ms
+  done(arg, true, len);
+}
+
+void sdwr_commit() {}
+uint32_t sdwr_commitDueMs() { return UINT32_MAX; }
+size_t catalog_appendBatch(const CatalogEntry*, size_t n) { return n; }
+size_t catalog_enforceRetention() { return 0; }
+void thumb_store(const char*, const uint8_t*, size_t) {}
+
+// the pre-event ring is not started here
+int evring_trigger(const char*) { return -1; }
+
+// ---------- streams ----------
+// Open one more stream session; the client end is read and thrown away.
+static bool open_stream() {
+  int sv[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) return false;
+  httpd_req_t req = {};
+  req.uri = "/?fps=25";   // every frame the camera delivers
+  req.aux = (void*)(intptr_t)sv[0];
+  if (strm_submit(&req) != ESP_OK) {
+    close(sv[0]);
+    close(sv[1]);
+    return false;
+  }
+  std::thread([fd = sv[1]] {
+    static char sink[65536];
+    while (read(fd, sink, sizeof(sink)) > 0) {}
+  }).detach();
+  return true;
+}
+
+// ---------- measurement ----------
+static uint32_t s_seed = 1;
+
+int main(int argc, char **argv) {
+  int captures = argc > 1 ? atoi(argv[1]) : 20;
+  host_runTasks();
+  HostClip clip;
+  hostcam_syntheticClip(16, 800, 600, &clip);
+  hostcam_begin(clip, 800, 600, CAPLAT_FPS, 2, true);
+  if (!fpool_begin(FRAMESIZE_SVGA, 16) || !fbc_begin(NULL) || !capsvc_begin() || !strm_begin()) host_exit(1);
+  delay(500);
+
+  printf("streams   p50 ms   avg ms   max ms   failed   stream fps\n");
+  for (int streams : { 0, 1, 4 }) {
+    while (strm_activeCount() < streams) {
+      if (!open_stream()) host_exit(1);
+      delay(100);
+    }
+    delay(1000);   // let the sessions reach their frame rate
+
+    std::vector<int64_t> took;
+    int failed = 0;
+    uint32_t writes0 = s_writes;
+    int64_t run0 = esp_timer_get_time();
+    for (int i = 0; i < captures; ++i) {
+      s_seed = s_seed * 1664525u + 1013904223u;
+      delay((s_seed >> 8) % 200 + 50);
+      httpd_req_t req = {};
+      req.uri = "/capture?event=0";
+      host_quiet = true;
+      int64_t t0 = esp_timer_get_time();
+      esp_err_t err = capture_get_handler(&req);
+      int64_t t1 = esp_timer_get_time();
+      host_quiet = false;
+      if (err != ESP_OK || s_response.compare(0, 6, "Saved:") != 0) {
+        failed++;
+        continue;
+      }
+      took.push_back(t1 - t0);
+    }
+    double stream_fps = streams ? (s_writes - writes0) / ((esp_timer_get_time() - run0) / 1e6) / streams : 0;
+    CHECK_EQ(failed, 0);
+    CHECK_EQ(strm_activeCount(), streams);
+    std::sort(took.begin(), took.end());
+    size_t n = took.size();
+    double sum = 0;
+    for (int64_t t : took) sum += t;
+    printf("%7d %8.1f %8.1f %8.1f %8d %12.1f\n", streams, n ? took[n / 2] / 1000.0 : 0, n ? sum / n / 1000.0 : 0,
+           n ? took[n - 1] / 1000.0 : 0, failed, stream_fps);
+  }
+  host_exit(host_failures ? 1 : 0);
+}
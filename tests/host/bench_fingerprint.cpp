@@ -0,0 +1,85 @@
+// frame_fingerprint() against the byte-wise FNV-1a over the whole scan data
+// that it replaced: time per frame at each frame size, and how many small
+// picture changes each one misses.
+//
+//   bench_fingerprint
+//
+// The frames are libjpeg encodes of the synthetic scene; a change is one
+// 16x16 patch of the picture brightened by a few levels somewhere in it.
+// Times are for a frame already in the host's cache; on the device every
+// byte FNV-1a reads comes from PSRAM, so the gap there is wider.
+
+#include "host_env.h"
+#include "host_jpeg.h"
+#include "esp_timer.h"
+#include "../../frame_fingerprint.cpp"
+
+static uint32_t fnv1a_scan(const uint8_t *jpg, size_t len) {
+  uint32_t h = 2166136261u;
+  for (size_t i = scan_data_offset(jpg, len); i < len; ++i) {
+    h ^= jpg[i];
+    h *= 16777619u;
+  }
+  return h;
+}
+
+struct Size {
+  const char *name;
+  int w, h;
+};
+
+static const Size SIZES[] = {
+  { "QVGA", 320, 240 }, { "VGA", 640, 480 }, { "SVGA", 800, 600 }, { "XGA", 1024, 768 },
+  { "SXGA", 1280, 1024 }, { "UXGA", 1600, 1200 },
+};
+
+static volatile uint32_t s_sink;
+
+template <class F> static double us_per_call(F hash, const std::vector<uint8_t> &jpg) {
+  int rounds = 0;
+  int64_t t0 = esp_timer_get_time(), t;
+  do {
+    for (int i = 0; i < 100; ++i) s_sink = s_sink + hash(jpg.data(), jpg.size());
+    rounds += 100;
+    t = esp_timer_get_time();
+  } while (t - t0 < 200000);
+  return (double)(t - t0) / rounds;
+}
+
+int main() {
+  host_useRealClock();
+  const std::vector<int> still;
+  printf("size    jpeg KB   sampled us   fnv-1a us   speedup   changes  missed sampled/fnv-1a\n");
+  uint32_t seed = 1;
+  for (const Size &s : SIZES) {
+    std::vector<uint8_t> grey, changed, jpg, jpg2;
+    hostjpg_scene(0, s.w, s.h, still, &grey);
+    hostjpg_encode(grey.data(), s.w, s.h, 80, &jpg);
+    double sampled = us_per_call(frame_fingerprint, jpg);
+    double fnv = us_per_call(fnv1a_scan, jpg);
+
+    uint32_t fp = frame_fingerprint(jpg.data(), jpg.size()), fnvfp = fnv1a_scan(jpg.data(), jpg.size());
+    int changes = 0, missed = 0, missed_fnv = 0;
+    for (int i = 0; i < 200; ++i) {
+      changed = grey;
+      seed = seed * 1664525u + 1013904223u;
+      int x0 = (seed >> 8) % (s.w - 16), y0 = (seed >> 20) % (s.h - 16);
+      int delta = 3 + (seed & 7);
+      for (int y = y0; y < y0 + 16; ++y) {
+        for (int x = x0; x < x0 + 16; ++x) changed[(size_t)y * s.w + x] = (uint8_t)min(255, changed[(size_t)y * s.w + x] + delta);
+      }
+      hostjpg_encode(changed.data(), s.w, s.h, 80, &jpg2);
+      if (jpg2 == jpg) continue;   // lost in the quantiser: nothing to detect
+      changes++;
+      if (frame_fingerprint(jpg2.data(), jpg2.size()) == fp) missed++;
+      if (fnv1a_scan(jpg2.data(), jpg2.size()) == fnvfp) missed_fnv++;
+    }
+    // an identical frame must always match
+    hostjpg_encode(grey.data(), s.w, s.h, 80, &jpg2);
+    CHECK_EQ(frame_fingerprint(jpg2.data(), jpg2.size()), fp);
+
+    printf("%-6s %8.1f %12.2f %11.2f %8.0fx %9d %7d/%d\n", s.name, jpg.size() / 1024.0, sampled, fnv, fnv / sampled,
+           changes, missed, missed_fnv);
+  }
+  return host_failures ? 1 : 0;
+}
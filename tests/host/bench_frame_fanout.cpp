@@ -0,0 +1,73 @@
+// Viewer frame rate against viewer count: the frame broadcaster's producer
+// task runs on the replaying camera (SVGA, 25 fps, two buffers, grab latest,
+// as the sketch configures it) while 1, 2, 4 and 8 reader threads each take
+// every new frame with fbc_waitNewer(), copy it out as a send would, and
+// release it. With one shared capture, every viewer should see the camera's
+// rate however many there are.
+//
+//   bench_frame_fanout [seconds per run]
+
+#include "host_env.h"
+#include "host_camera.h"
+#include "esp_timer.h"
+#include "../../frame_broadcaster.h"
+#include "../../frame_pool.h"
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#define FANOUT_FPS 25
+
+static std::atomic<bool> s_stop;
+
+static void reader(uint32_t *frames) {
+  std::vector<uint8_t> out(fpool_slabSize());
+  uint32_t last = fbc_framesPublished();   // count only frames published from now on
+  while (!s_stop) {
+    SharedFrame *f = fbc_waitNewer(last, 1000);
+    if (!f) continue;
+    memcpy(out.data(), f->buf, f->len);
+    last = f->seq;
+    fbc_release(f);
+    (*frames)++;
+  }
+}
+
+int main(int argc, char **argv) {
+  double secs = argc > 1 ? atof(argv[1]) : 3.0;
+  host_runTasks();
+  HostClip clip;
+  hostcam_syntheticClip(16, 800, 600, &clip);
+  if (!fpool_begin(FRAMESIZE_SVGA, 16)) return 1;
+  hostcam_begin(clip, 800, 600, FANOUT_FPS, 2, true);
+  if (!fbc_begin(NULL)) return 1;
+  delay(500);   // let the producer settle
+
+  printf("viewers   published fps   per-viewer fps min / avg / max   dropped\n");
+  for (int viewers : { 1, 2, 4, 8 }) {
+    std::vector<uint32_t> counts(viewers, 0);
+    std::vector<std::thread> threads;
+    s_stop = false;
+    uint32_t published0 = fbc_framesPublished(), dropped0 = fbc_framesDropped();
+    int64_t t0 = esp_timer_get_time();
+    for (int i = 0; i < viewers; ++i) threads.emplace_back(reader, &counts[i]);
+    delay((uint32_t)(secs * 1000));
+    s_stop = true;
+    for (std::thread &t : threads) t.join();
+    double elapsed = (esp_timer_get_time() - t0) / 1e6;
+
+    uint32_t published = fbc_framesPublished() - published0;
+    double lo = 1e9, hi = 0, sum = 0;
+    for (uint32_t n : counts) {
+      double fps = n / elapsed;
+      lo = min(lo, fps);
+      hi = max(hi, fps);
+      sum += fps;
+    }
+    printf("%7d %15.1f %14.1f / %5.1f / %5.1f %9u\n", viewers, published / elapsed, lo, sum / viewers, hi,
+           fbc_framesDropped() - dropped0);
+    // flat: each viewer gets (nearly) every published frame
+    for (uint32_t n : counts) CHECK(n >= published * 9 / 10);
+  }
+  host_exit(host_failures ? 1 : 0);
+}
@@ -0,0 +1,161 @@
+// Fresh-frame latency of /capture's two strategies on the same replaying
+// camera (SVGA at 25 fps, two frame buffers):
+//
+//   - the old flush_and_get_new_fb(): fetch a frame, then fetch again every
+//     80 ms (up to ten times) until an FNV-1a over its first 64 bytes
+//     changes, with the driver in its default CAMERA_GRAB_WHEN_EMPTY mode
+//     as the sketch had it;
+//   - fbc_waitCapturedAfter() on the broadcaster's producer task, with the
+//     driver in CAMERA_GRAB_LATEST mode as the sketch has it now.
+//
+// Requests come at random moments. For each strategy it reports the latency
+// from the request to the frame (p50 and max) and the share of stale frames,
+// i.e. frames whose exposure started before the request.
+//
+//   bench_frame_freshness [requests]
+
+#include "host_env.h"
+#include "host_camera.h"
+#include "esp_camera.h"
+#include "esp_timer.h"
+#include "../../frame_broadcaster.h"
+#include "../../frame_pool.h"
+#include <algorithm>
+#include <vector>
+
+#define FRESH_FPS 25
+
+// ---------- the old strategy, as it was in the sketch ----------
+// small, cheap checksum over the first sample_size bytes
+static uint32_t fb_sample_checksum(camera_fb_t *fb, size_t sample_size = 64) {
+  if (!fb || fb->len == 0) return 0;
+  size_t n = fb->len < sample_size ? fb->len : sample_size;
+  uint32_t h = 2166136261u; // FNV-1a 32-bit start
+  for (size_t i = 0; i < n; ++i) {
+    h ^= fb->buf[i];
+    h *= 16777619u;
+  }
+  return h;
+}
+
+static camera_fb_t* flush_and_get_new_fb(int retries = 10, int delay_ms = 80, size_t sample_size = 64) {
+  camera_fb_t *fb = NULL;
+  uint32_t prev_hash = 0;
+
+  // Try to get a current frame to determine the "previous" hash.
+  fb = esp_camera_fb_get();
+  if (fb) {
+    prev_hash = fb_sample_checksum(fb, sample_size);
+    esp_camera_fb_return(fb);
+    fb = NULL;
+    // short pause for the camera to advance to next buffer
+    delay(delay_ms);
+  }
+
+  // Now try to get a fresh frame that differs from prev_hash
+  for (int i = 0; i < retries; ++i) {
+    fb = esp_camera_fb_get();
+    if (!fb) {
+      delay(delay_ms);
+      continue;
+    }
+    // If we had no previous frame (prev_hash==0) we accept the first valid fb
+    if (prev_hash == 0) {
+      if (fb->len > 0) return fb;
+      esp_camera_fb_return(fb);
+      fb = NULL;
+      delay(delay_ms);
+      continue;
+    }
+
+    uint32_t h = fb_sample_checksum(fb, sample_size);
+    if (h != prev_hash && fb->len > 0) {
+      // different from previous — consider it fresh
+      return fb;
+    }
+
+    // same as previous: return and retry (discard)
+    esp_camera_fb_return(fb);
+    fb = NULL;
+    delay(delay_ms);
+  }
+
+  // last-ditch: try one final get without comparison
+  fb = esp_camera_fb_get();
+  if (fb && fb->len > 0) return fb;
+  if (fb) {
+    esp_camera_fb_return(fb);
+    fb = NULL;
+  }
+  return NULL;
+}
+
+// ---------- measurement ----------
+struct Result {
+  std::vector<int64_t> latency_us;
+  int stale = 0;
+  int failed = 0;
+};
+
+static uint32_t s_seed = 1;
+
+// idle for a random part of three frame intervals, so requests land anywhere in a frame
+static void random_pause() {
+  s_seed = s_seed * 1664525u + 1013904223u;
+  delay((uint32_t)((s_seed >> 8) % (3 * hostcam_periodUs() / 1000)) + 1);
+}
+
+static void record(Result *r, int64_t requested, int64_t captured) {
+  r->latency_us.push_back(esp_timer_get_time() - requested);
+  if (captured < requested) r->stale++;
+}
+
+static void print(const char *name, Result &r) {
+  std::sort(r.latency_us.begin(), r.latency_us.end());
+  size_t n = r.latency_us.size();
+  double p50 = n ? r.latency_us[n / 2] / 1000.0 : 0, mx = n ? r.latency_us[n - 1] / 1000.0 : 0;
+  printf("%-24s %8zu %10.1f %10.1f %8.1f%% %7d\n", name, n, p50, mx, n ? 100.0 * r.stale / n : 0.0, r.failed);
+}
+
+int main(int argc, char **argv) {
+  int requests = argc > 1 ? atoi(argv[1]) : 20;
+  host_runTasks();
+  HostClip clip;
+  hostcam_syntheticClip(16, 800, 600, &clip);
+
+  Result old_way;
+  hostcam_begin(clip, 800, 600, FRESH_FPS, 2, false);
+  for (int i = 0; i < requests; ++i) {
+    random_pause();
+    int64_t requested = esp_timer_get_time();
+    camera_fb_t *fb = flush_and_get_new_fb(/*retries=*/10, /*delay_ms=*/80, /*sample_size=*/64);
+    if (!fb) {
+      old_way.failed++;
+      continue;
+    }
+    record(&old_way, requested, (int64_t)fb->timestamp.tv_sec * 1000000 + fb->timestamp.tv_usec);
+    esp_camera_fb_return(fb);
+  }
+
+  // the producer runs for good from here on, so this goes second
+  Result new_way;
+  hostcam_begin(clip, 800, 600, FRESH_FPS, 2, true);
+  if (!fpool_begin(FRAMESIZE_SVGA, 16) || !fbc_begin(NULL)) host_exit(1);
+  delay(500);
+  for (int i = 0; i < requests; ++i) {
+    random_pause();
+    int64_t requested = esp_timer_get_time();
+    SharedFrame *f = fbc_waitCapturedAfter(requested, 1000);
+    if (!f) {
+      new_way.failed++;
+      continue;
+    }
+    record(&new_way, requested, f->timestamp_us);
+    fbc_release(f);
+  }
+
+  printf("strategy                 requests    p50 ms     max ms    stale  failed\n");
+  print("flush_and_get_new_fb", old_way);
+  print("fbc_waitCapturedAfter", new_way);
+  host_exit(0);
+}
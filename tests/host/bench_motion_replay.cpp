@@ -0,0 +1,105 @@
+// Replays an MJPEG recording (or a synthetic scene) through the motion
+// detector: each frame is decoded at 1/8 scale into the detector's luma plane
+// and compared with the previous one by the detector's own block compare, with
+// the default threshold, block count and cooldown. Reports frames per second
+// for the compare alone and with the decode, and the frames that fired.
+//
+//   bench_motion_replay [recording.mjpeg [fps]]
+//
+// fps (default 4) turns frame numbers into time for the cooldown. libjpeg
+// stands in for the device's TJpgDec, so decode times are the host's.
+
+#include "host_env.h"
+#include "host_jpeg.h"
+#include "../../motion_detector.cpp"
+
+static int s_events = 0;
+
+static void on_motion(uint16_t changed) {
+  (void)changed;
+  s_events++;
+}
+
+int main(int argc, char **argv) {
+  host_useRealClock();
+  float fps = argc > 2 ? atof(argv[2]) : 4.0f;
+  if (!(fps > 0)) fps = 4.0f;
+
+  std::vector<uint8_t> data;
+  std::vector<std::pair<size_t, size_t>> frames;
+  if (argc > 1) {
+    if (!hostjpg_readFile(argv[1], &data)) {
+      printf("cannot read %s\n", argv[1]);
+      return 1;
+    }
+    hostjpg_split(data, &frames);
+  } else {
+    // SVGA, 240 frames: the square crosses during 60..79 and 200..209
+    std::vector<int> moving;
+    for (int i = 60; i < 80; ++i) moving.push_back(i);
+    for (int i = 200; i < 210; ++i) moving.push_back(i);
+    std::vector<uint8_t> grey, jpg;
+    for (int n = 0; n < 240; ++n) {
+      hostjpg_scene(n, 800, 600, moving, &grey);
+      hostjpg_encode(grey.data(), 800, 600, 80, &jpg);
+      frames.push_back({ data.size(), jpg.size() });
+      data.insert(data.end(), jpg.begin(), jpg.end());
+    }
+    printf("synthetic scene: 240 SVGA frames, motion in 60..79 and 200..209\n");
+  }
+  if (frames.empty()) {
+    printf("no JPEG frames found\n");
+    return 1;
+  }
+
+  // planes for the largest frame size, so any recording up to UXGA fits
+  host_quiet = true;
+  if (!motion_begin(FRAMESIZE_UXGA, on_motion, true)) return 1;
+  host_quiet = false;
+  MotionConfig cfg = s_config;
+
+  int64_t decode_us = 0, compare_us = 0;
+  uint32_t compared = 0, decoded = 0;
+  bool have_prev = false;
+  uint16_t prev_w = 0, prev_h = 0;
+  int64_t last_event = -1;
+  printf("events at frames:");
+  for (size_t n = 0; n < frames.size(); ++n) {
+    uint16_t w, h;
+    int64_t t0 = esp_timer_get_time();
+    bool ok = hostjpg_luma8(&data[frames[n].first], frames[n].second, s_cur, s_stride, s_maxW, s_maxH, &w, &h);
+    int64_t t1 = esp_timer_get_time();
+    decode_us += t1 - t0;
+    if (!ok) continue;
+    decoded++;
+
+    uint16_t grid_w = min(w / MOTION_BLOCK, MOTION_GRID_MAX);
+    uint16_t grid_h = min(h / MOTION_BLOCK, MOTION_GRID_MAX);
+    bool cmp = have_prev && w == prev_w && h == prev_h;
+    uint16_t changed = cmp ? count_changed(cfg, grid_w, grid_h) : 0;
+    compare_us += esp_timer_get_time() - t1;
+    if (cmp) compared++;
+    std::swap(s_cur, s_prev);
+    have_prev = true;
+    prev_w = w;
+    prev_h = h;
+
+    int64_t frame_us = (int64_t)(n * 1000000.0 / fps);
+    if (cmp && changed >= cfg.min_blocks &&
+        (last_event < 0 || frame_us - last_event >= (int64_t)cfg.cooldown_ms * 1000)) {
+      last_event = frame_us;
+      on_motion(changed);
+      printf(" %u (%u blocks)", (unsigned)n, changed);
+    }
+  }
+  printf("%s\n", s_events ? "" : " none");
+
+  printf("%u frames decoded, %u compared, %d events (threshold %u, %u blocks, %u ms cooldown at %.1f fps)\n",
+         (unsigned)decoded, (unsigned)compared, s_events, cfg.threshold, cfg.min_blocks, (unsigned)cfg.cooldown_ms,
+         fps);
+  if (compared && compare_us) printf("compare only: %.0f frames/s (%.1f us/frame)\n",
+                                     compared * 1e6 / compare_us, (double)compare_us / compared);
+  if (decoded) printf("decode + compare: %.0f frames/s (%.1f us/frame)\n",
+                      decoded * 1e6 / (decode_us + compare_us), (double)(decode_us + compare_us) / decoded);
+  return 0;
+}
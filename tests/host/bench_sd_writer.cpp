@@ -0,0 +1,117 @@
+// Throughput and per-file latency of the capture writer (sd_writer.cpp) in
+// each durability mode, writing into a directory through POSIX
+// open/write/fsync/close exactly as on the device.
+//
+//   bench_sd_writer <dir> [files [kb_per_file]]
+//
+// Point dir at a FAT file system on a file-backed block device to get close
+// to the card's behaviour (see tests/host in ReadMe.md). Latency is from
+// sdwr_write() to the file's commit callback, so in group mode it includes
+// the wait for the rest of the group. Linux keeps closed files in the page
+// cache where FatFs would already have written them, so every run ends with
+// sync() and the throughput is also given with that flush included.
+
+#include "host_env.h"
+#include "sd_writer.h"
+#include "esp_timer.h"
+#include <unistd.h>
+#include <vector>
+
+struct Pending {
+  int64_t start_us;
+  int64_t done_us;
+  bool ok;
+};
+
+static void on_commit(void *arg, bool ok, size_t bytes) {
+  (void)bytes;
+  Pending *p = (Pending*)arg;
+  p->done_us = esp_timer_get_time();
+  p->ok = ok;
+}
+
+static double percentile(std::vector<int64_t> v, double p) {
+  std::sort(v.begin(), v.end());
+  return v[(size_t)(p * (v.size() - 1))] / 1000.0;
+}
+
+static void run(const char *dir, SdDurability mode, const char *name, int files, size_t len) {
+  std::vector<uint8_t> data(len);
+  for (size_t i = 0; i < len; ++i) data[i] = (uint8_t)(i * 131 + 7);
+  data[0] = 0xFF;
+  data[1] = 0xD8;
+
+  sdwr_setDurability(mode);
+  SdWriterStats before;
+  sdwr_getStats(&before);
+  std::vector<Pending> pending(files);
+  char path[96];
+  sync();
+  int64_t t0 = esp_timer_get_time();
+  for (int i = 0; i < files; ++i) {
+    // a new directory now and then, as at midnight
+    snprintf(path, sizeof(path), "%s/sdwr_bench/%s/%02d/%04d.jpg", dir, name, i / 100, i);
+    pending[i] = { esp_timer_get_time(), 0, false };
+    sdwr_write(path, data.data(), len, on_commit, &pending[i]);
+  }
+  sdwr_commit();   // the capture writer does this once its queue is empty
+  int64_t t1 = esp_timer_get_time();
+  sync();
+  int64_t t2 = esp_timer_get_time();
+
+  SdWriterStats after;
+  sdwr_getStats(&after);
+  std::vector<int64_t> lat;
+  int failed = 0;
+  int64_t sum = 0;
+  for (const Pending &p : pending) {
+    if (!p.ok) {
+      failed++;
+      continue;
+    }
+    lat.push_back(p.done_us - p.start_us);
+    sum += p.done_us - p.start_us;
+  }
+  double mb = (double)files * len / (1024 * 1024);
+  printf("%-6s %8.1f %10.1f %8u", name, mb * 1e6 / (t1 - t0), mb * 1e6 / (t2 - t0),
+         after.commits - before.commits);
+  if (lat.empty()) printf("   all %d files failed\n", files);
+  else printf(" %8.2f %8.2f %8.2f %8.2f%s\n", sum / 1000.0 / lat.size(), percentile(lat, 0.5),
+              percentile(lat, 0.99), percentile(lat, 1.0),
+              failed ? "  (some files failed)" : "");
+
+  for (int i = 0; i < files; ++i) {
+    snprintf(path, sizeof(path), "%s/sdwr_bench/%s/%02d/%04d.jpg", dir, name, i / 100, i);
+    unlink(path);
+  }
+  for (int d = 0; d <= (files - 1) / 100; ++d) {
+    snprintf(path, sizeof(path), "%s/sdwr_bench/%s/%02d", dir, name, d);
+    rmdir(path);
+  }
+  snprintf(path, sizeof(path), "%s/sdwr_bench/%s", dir, name);
+  rmdir(path);
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    printf("usage: %s <dir> [files [kb_per_file]]\n", argv[0]);
+    return 1;
+  }
+  host_useRealClock();
+  int files = argc > 2 ? atoi(argv[2]) : 200;
+  size_t kb = argc > 3 ? atoi(argv[3]) : 120;   // an SVGA JPEG at the default quality
+  if (files < 1 || kb < 1) return 1;
+  if (!sdwr_begin(SDWR_SYNC_EACH)) return 1;
+
+  printf("%d files of %u KB, %u KB blocks, groups of %d\n", files, (unsigned)kb, SDWR_BLOCK_SIZE / 1024,
+         SDWR_GROUP_FILES);
+  printf("mode       MB/s  +sync MB/s  commits   avg ms   p50 ms   p99 ms   max ms\n");
+  run(argv[1], SDWR_SYNC_EACH, "each", files, kb * 1024);
+  run(argv[1], SDWR_SYNC_GROUP, "group", files, kb * 1024);
+  run(argv[1], SDWR_SYNC_NONE, "none", files, kb * 1024);
+
+  char path[96];
+  snprintf(path, sizeof(path), "%s/sdwr_bench", argv[1]);
+  rmdir(path);
+  return 0;
+}
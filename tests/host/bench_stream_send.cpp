@@ -0,0 +1,164 @@
+// One multipart MJPEG frame sent two ways, over a real loopback TCP socket:
+//   chunked   the old stream_handler: three httpd_resp_send_chunk() calls
+//             (part header, JPEG, boundary), each framed as an HTTP chunk
+//             and written by httpd as three send()s of its own
+//   writev    send_iov() from stream_sessions.cpp: one writev() of the
+//             part header, JPEG and boundary, no chunk framing
+// and the bytes, send calls and time per frame of each, for every stream tier
+// of an SVGA frame. Segments counts one TCP segment per started 1436-byte MSS
+// of each call, i.e. what lwIP sends when it cannot merge calls (TCP_NODELAY,
+// or nothing unacknowledged to wait behind).
+//
+//   bench_stream_send [frames]
+
+#include "host_env.h"
+#include "host_jpeg.h"
+#include "esp_timer.h"
+#include "../../stream_sessions.cpp"
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <atomic>
+#include <thread>
+
+#define LWIP_MSS 1436
+
+static uint64_t s_calls = 0;
+static uint64_t s_bytes = 0;
+static uint64_t s_segments = 0;
+
+static void count(size_t len) {
+  s_calls++;
+  s_bytes += len;
+  s_segments += (len + LWIP_MSS - 1) / LWIP_MSS;
+}
+
+ssize_t lwip_writev(int s, const struct iovec *iov, int iovcnt) {
+  ssize_t n = ::writev(s, iov, iovcnt);
+  if (n > 0) count(n);
+  return n;
+}
+
+// ---------- the old path, as esp_http_server does it ----------
+// httpd_send_all(): send() until the buffer is out
+static esp_err_t httpd_send_all(int fd, const char *buf, size_t len) {
+  while (len > 0) {
+    ssize_t n = ::send(fd, buf, len, 0);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return ESP_FAIL;
+    }
+    count(n);
+    buf += n;
+    len -= n;
+  }
+  return ESP_OK;
+}
+
+// httpd_resp_send_chunk(): "<hex length>\r\n", the data, "\r\n"
+static esp_err_t send_chunk(int fd, const char *buf, size_t len) {
+  char len_str[10];
+  snprintf(len_str, sizeof(len_str), "%x\r\n", (unsigned)len);
+  if (httpd_send_all(fd, len_str, strlen(len_str)) != ESP_OK) return ESP_FAIL;
+  if (httpd_send_all(fd, buf, len) != ESP_OK) return ESP_FAIL;
+  return httpd_send_all(fd, "\r\n", 2);
+}
+
+static esp_err_t send_chunked(int fd, const std::vector<uint8_t> &jpg) {
+  char part_buf[64];
+  size_t hlen = snprintf(part_buf, sizeof(part_buf), _STREAM_PART, (unsigned)jpg.size());
+  esp_err_t res = send_chunk(fd, part_buf, hlen);
+  if (res == ESP_OK) res = send_chunk(fd, (const char*)jpg.data(), jpg.size());
+  if (res == ESP_OK) res = send_chunk(fd, _STREAM_BOUNDARY, strlen(_STREAM_BOUNDARY));
+  return res;
+}
+
+// ---------- the new path, as run_session() does it ----------
+static esp_err_t send_writev(int fd, const std::vector<uint8_t> &jpg) {
+  char part_buf[64];
+  size_t hlen = snprintf(part_buf, sizeof(part_buf), _STREAM_PART, (unsigned)jpg.size());
+  struct iovec iov[3] = {
+    { part_buf, hlen },
+    { (void*)jpg.data(), jpg.size() },
+    { (void*)_STREAM_BOUNDARY, strlen(_STREAM_BOUNDARY) },
+  };
+  return send_iov(fd, iov, 3);
+}
+
+// a connected loopback TCP pair; the reader end is drained by a thread
+static bool connect_pair(int *writer, int *reader) {
+  int lst = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t alen = sizeof(addr);
+  if (lst < 0 || bind(lst, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(lst, 1) != 0 ||
+      getsockname(lst, (sockaddr*)&addr, &alen) != 0) return false;
+  *writer = socket(AF_INET, SOCK_STREAM, 0);
+  if (connect(*writer, (sockaddr*)&addr, sizeof(addr)) != 0) return false;
+  *reader = accept(lst, NULL, NULL);
+  close(lst);
+  int one = 1;
+  setsockopt(*writer, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  return *reader >= 0;
+}
+
+struct Result {
+  double bytes, calls, segments, us;
+};
+
+static Result run(esp_err_t (*send)(int, const std::vector<uint8_t>&), const std::vector<uint8_t> &jpg, int frames) {
+  int wfd, rfd;
+  if (!connect_pair(&wfd, &rfd)) {
+    printf("cannot open a loopback socket\n");
+    exit(1);
+  }
+  std::atomic<uint64_t> received(0);
+  std::thread drain([&] {
+    static char buf[65536];
+    ssize_t n;
+    while ((n = read(rfd, buf, sizeof(buf))) > 0) received += n;
+  });
+  s_calls = s_bytes = s_segments = 0;
+  int64_t t0 = esp_timer_get_time();
+  for (int i = 0; i < frames; ++i) {
+    if (send(wfd, jpg) != ESP_OK) {
+      printf("send failed\n");
+      exit(1);
+    }
+  }
+  int64_t t1 = esp_timer_get_time();
+  shutdown(wfd, SHUT_WR);
+  drain.join();
+  close(wfd);
+  close(rfd);
+  if (received != s_bytes) printf("reader got %llu of %llu bytes\n", (unsigned long long)received.load(),
+                                  (unsigned long long)s_bytes);
+  return { (double)s_bytes / frames, (double)s_calls / frames, (double)s_segments / frames,
+           (double)(t1 - t0) / frames };
+}
+
+int main(int argc, char **argv) {
+  host_useRealClock();
+  int frames = argc > 1 ? atoi(argv[1]) : 2000;
+  if (frames < 1) return 1;
+  static const struct { const char *name; int w, h; } TIERS[] = {
+    { "full", 800, 600 }, { "hvga", 400, 300 }, { "qvga", 200, 150 }, { "qqvga", 100, 75 },
+  };
+  const std::vector<int> still;
+  printf("%d frames per run, SVGA scene at quality 80\n", frames);
+  printf("tier   jpeg B   path     bytes/frame  calls/frame  segments/frame  us/frame\n");
+  for (const auto &t : TIERS) {
+    std::vector<uint8_t> grey, jpg;
+    hostjpg_scene(0, t.w, t.h, still, &grey);
+    hostjpg_encode(grey.data(), t.w, t.h, 80, &jpg);
+    Result old_path = run(send_chunked, jpg, frames);
+    Result new_path = run(send_writev, jpg, frames);
+    printf("%-6s %6u   chunked  %11.0f  %11.1f  %14.1f  %8.2f\n", t.name, (unsigned)jpg.size(), old_path.bytes,
+           old_path.calls, old_path.segments, old_path.us);
+    printf("%-6s %6s   writev   %11.0f  %11.1f  %14.1f  %8.2f\n", "", "", new_path.bytes, new_path.calls,
+           new_path.segments, new_path.us);
+  }
+  return 0;
+}
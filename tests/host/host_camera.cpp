@@ -0,0 +1,126 @@
+#include "host_camera.h"
+#include "host_env.h"
+#include "host_jpeg.h"
+#include "esp_camera.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <deque>
+#include <mutex>
+
+#define HOSTCAM_GET_TIMEOUT_US 4000000   // the driver's fb_get() gives up after 4 s
+
+static std::mutex s_lock;
+static HostClip s_frames;
+static int s_width = 0, s_height = 0;
+static int64_t s_t0 = 0;
+static int64_t s_period = 40000;
+static int s_fbCount = 2;
+static bool s_latest = false;
+static uint32_t s_next = 0;          // next frame to start
+static int64_t s_exposing = -1;      // frame being exposed into a buffer, or -1
+static std::deque<uint32_t> s_ready; // finished, not yet handed out
+static int s_held = 0;               // handed out, not yet returned
+static uint32_t s_captured = 0;
+static uint32_t s_dropped = 0;
+
+void hostcam_begin(const HostClip &frames, int w, int h, int fps, int fb_count, bool grab_latest) {
+  std::lock_guard<std::mutex> lk(s_lock);
+  s_frames = frames;
+  s_width = w;
+  s_height = h;
+  s_period = 1000000 / fps;
+  s_fbCount = fb_count;
+  s_latest = grab_latest;
+  s_t0 = esp_timer_get_time();
+  s_next = 0;
+  s_exposing = -1;
+  s_ready.clear();
+  s_held = 0;
+  s_captured = s_dropped = 0;
+}
+
+void hostcam_syntheticClip(int count, int w, int h, HostClip *frames) {
+  std::vector<int> moving;
+  for (int n = 0; n < count; ++n) moving.push_back(n);
+  frames->assign(count, {});
+  std::vector<uint8_t> grey;
+  for (int n = 0; n < count; ++n) {
+    hostjpg_scene(n, w, h, moving, &grey);
+    hostjpg_encode(grey.data(), w, h, 80, &(*frames)[n]);
+  }
+}
+
+int64_t hostcam_periodUs() {
+  return s_period;
+}
+
+uint32_t hostcam_framesCaptured() {
+  return s_captured;
+}
+
+uint32_t hostcam_framesDropped() {
+  return s_dropped;
+}
+
+// Run the sensor up to now. The buffers held by the caller have not changed
+// since the last call, so every frame boundary in between sees the same count.
+static void advance(int64_t now) {
+  while (s_t0 + (int64_t)s_next * s_period <= now) {
+    if (s_exposing >= 0) {
+      if (s_latest) {
+        s_dropped += s_ready.size();
+        s_ready.clear();
+      }
+      s_ready.push_back((uint32_t)s_exposing);
+      s_exposing = -1;
+      s_captured++;
+    }
+    int free = s_fbCount - s_held - (int)s_ready.size();
+    if (free <= 0 && s_latest && !s_ready.empty()) {
+      s_ready.pop_front();   // overwritten by the new frame
+      s_dropped++;
+      free++;
+    }
+    if (free > 0) s_exposing = s_next;
+    else s_dropped++;
+    s_next++;
+  }
+}
+
+camera_fb_t* esp_camera_fb_get() {
+  int64_t give_up = esp_timer_get_time() + HOSTCAM_GET_TIMEOUT_US;
+  std::unique_lock<std::mutex> lk(s_lock);
+  while (true) {
+    int64_t now = esp_timer_get_time();
+    advance(now);
+    if (!s_ready.empty()) break;
+    if (now >= give_up || s_frames.empty()) return NULL;
+    // sleep to the next frame boundary, where an exposure may finish
+    int64_t wait_us = s_t0 + (int64_t)s_next * s_period - now;
+    lk.unlock();
+    vTaskDelay(pdMS_TO_TICKS((wait_us + 999) / 1000));
+    lk.lock();
+  }
+  uint32_t k = s_ready.front();
+  s_ready.pop_front();
+  s_held++;
+  std::vector<uint8_t> &jpg = s_frames[k % s_frames.size()];
+  int64_t start = s_t0 + (int64_t)k * s_period;
+  camera_fb_t *fb = new camera_fb_t();
+  fb->buf = jpg.data();
+  fb->len = jpg.size();
+  fb->width = s_width;
+  fb->height = s_height;
+  fb->format = PIXFORMAT_JPEG;
+  fb->timestamp.tv_sec = start / 1000000;
+  fb->timestamp.tv_usec = start % 1000000;
+  return fb;
+}
+
+void esp_camera_fb_return(camera_fb_t *fb) {
+  if (!fb) return;
+  std::lock_guard<std::mutex> lk(s_lock);
+  advance(esp_timer_get_time());
+  s_held--;
+  delete fb;
+}
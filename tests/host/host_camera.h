@@ -0,0 +1,33 @@
+#ifndef HOST_CAMERA_H
+#define HOST_CAMERA_H
+
+#include <stdint.h>
+#include <vector>
+
+// A camera for the benchmarks: replays a list of JPEG frames in a loop at a
+// fixed sensor rate through esp_camera_fb_get()/esp_camera_fb_return(),
+// with the driver's frame buffer behaviour.
+//
+// Frame k is exposed from t0 + k * period until the next one starts, and is
+// stamped with its start time. It needs a free buffer when it starts or is
+// dropped. In CAMERA_GRAB_WHEN_EMPTY mode (grab_latest false) finished
+// frames queue up and fb_get() hands out the oldest; in CAMERA_GRAB_LATEST
+// mode a finished frame replaces any unread one and fb_get() hands out the
+// newest. fb_get() waits (vTaskDelay) for a frame when none is ready.
+
+typedef std::vector<std::vector<uint8_t>> HostClip;
+
+// Start the sensor now. frames (w x h JPEGs) is copied.
+void hostcam_begin(const HostClip &frames, int w, int h, int fps, int fb_count, bool grab_latest);
+
+// count frames of the synthetic scene (host_jpeg) at w x h, with the dark
+// square moving across them so that no two are alike.
+void hostcam_syntheticClip(int count, int w, int h, HostClip *frames);
+
+int64_t hostcam_periodUs();
+
+// Frames the sensor finished or dropped because no buffer was free.
+uint32_t hostcam_framesCaptured();
+uint32_t hostcam_framesDropped();
+
+#endif // HOST_CAMERA_H
@@ -0,0 +1,322 @@
+#include "host_env.h"
+#include "esp_camera.h"
+#include "img_converters.h"
+#include "esp_http_server.h"
+#include "frame_broadcaster.h"
+#include "lwip/sockets.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "freertos/queue.h"
+#include "freertos/event_groups.h"
+#include <stdarg.h>
+#include <errno.h>
+#include <time.h>
+#include <deque>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+bool host_quiet = false;
+HostSerial Serial;
+uint32_t (*host_onWait)(uint32_t timeout_ms) = NULL;
+int host_tasksCreated = 0;
+int host_checks = 0;
+int host_failures = 0;
+
+int HostSerial::printf(const char *fmt, ...) {
+  if (host_quiet) return 0;
+  va_list ap;
+  va_start(ap, fmt);
+  int n = vprintf(fmt, ap);
+  va_end(ap);
+  return n;
+}
+
+int host_report(const char *name) {
+  printf("%s: %d checks, %d failed\n", name, host_checks, host_failures);
+  return host_failures ? 1 : 0;
+}
+
+// ---------- clock ----------
+static bool s_realClock = false;
+static int64_t s_fakeUs = 0;
+
+void host_useRealClock() {
+  s_realClock = true;
+}
+
+void host_setTimeUs(int64_t t) {
+  s_fakeUs = t;
+}
+
+void host_advanceUs(int64_t us) {
+  s_fakeUs += us;
+}
+
+int64_t esp_timer_get_time() {
+  if (!s_realClock) return s_fakeUs;
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// ---------- threads ----------
+// Threaded runs guard every semaphore, queue and event group with one lock
+// and wake all waiters on any change; the benchmarks have a handful of tasks.
+static bool s_threads = false;
+static std::mutex s_sync;
+static std::condition_variable s_changed;
+static std::recursive_mutex s_critical;
+
+void host_runTasks() {
+  host_useRealClock();
+  s_threads = true;
+}
+
+void host_exit(int status) {
+  fflush(stdout);
+  _exit(status);
+}
+
+void host_enterCritical() {
+  if (s_threads) s_critical.lock();
+}
+
+void host_exitCritical() {
+  if (s_threads) s_critical.unlock();
+}
+
+// A wait that would block: let the test act, then move the clock.
+static void host_wait(TickType_t ticks) {
+  if (ticks == portMAX_DELAY) ticks = 60000;   // nothing else runs: a forever wait ends
+  uint32_t ms = host_onWait ? host_onWait(ticks) : ticks;
+  if (ms > ticks) ms = ticks;
+  if (!s_realClock) s_fakeUs += (int64_t)ms * 1000;
+}
+
+// Threaded: block on s_changed until ready() or the timeout. lk holds s_sync.
+template <class Ready> static bool block_until(std::unique_lock<std::mutex> &lk, TickType_t ticks, Ready ready) {
+  if (ticks == portMAX_DELAY) {
+    s_changed.wait(lk, ready);
+    return true;
+  }
+  return s_changed.wait_for(lk, std::chrono::milliseconds(ticks), ready);
+}
+
+// ---------- tasks ----------
+BaseType_t xTaskCreate(TaskFunction_t fn, const char*, uint32_t, void *arg, UBaseType_t, TaskHandle_t *handle) {
+  host_tasksCreated++;
+  if (handle) *handle = (TaskHandle_t)(intptr_t)host_tasksCreated;
+  if (s_threads) std::thread([fn, arg] { fn(arg); }).detach();
+  return pdPASS;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack, void *arg,
+                                   UBaseType_t prio, TaskHandle_t *handle, BaseType_t) {
+  return xTaskCreate(fn, name, stack, arg, prio, handle);
+}
+
+void vTaskDelay(TickType_t ticks) {
+  if (s_threads) std::this_thread::sleep_for(std::chrono::milliseconds(ticks));
+  else host_wait(ticks);
+}
+
+void delay(uint32_t ms) {
+  vTaskDelay(pdMS_TO_TICKS(ms));
+}
+
+unsigned long millis() {
+  return (unsigned long)(esp_timer_get_time() / 1000);
+}
+
+// ---------- semaphores ----------
+struct HostSemaphore {
+  UBaseType_t count;
+  UBaseType_t max;
+};
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max, UBaseType_t initial) {
+  return new HostSemaphore{ initial, max };
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex() {
+  return xSemaphoreCreateCounting(1, 1);
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary() {
+  return xSemaphoreCreateCounting(1, 0);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks) {
+  if (s_threads) {
+    std::unique_lock<std::mutex> lk(s_sync);
+    if (!block_until(lk, ticks, [sem] { return sem->count > 0; })) return pdFALSE;
+    sem->count--;
+    return pdTRUE;
+  }
+  if (!sem->count && ticks) host_wait(ticks);
+  if (!sem->count) return pdFALSE;
+  sem->count--;
+  return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem) {
+  std::unique_lock<std::mutex> lk(s_sync, std::defer_lock);
+  if (s_threads) lk.lock();
+  if (sem->count >= sem->max) return pdFALSE;
+  sem->count++;
+  if (s_threads) s_changed.notify_all();
+  return pdTRUE;
+}
+
+UBaseType_t uxSemaphoreGetCount(SemaphoreHandle_t sem) {
+  std::unique_lock<std::mutex> lk(s_sync, std::defer_lock);
+  if (s_threads) lk.lock();
+  return sem->count;
+}
+
+// ---------- queues ----------
+struct HostQueue {
+  size_t length;
+  size_t item_size;
+  std::deque<std::vector<uint8_t>> items;
+};
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size) {
+  return new HostQueue{ length, item_size, {} };
+}
+
+BaseType_t xQueueSend(QueueHandle_t q, const void *item, TickType_t ticks) {
+  std::unique_lock<std::mutex> lk(s_sync, std::defer_lock);
+  if (s_threads) {
+    lk.lock();
+    if (!block_until(lk, ticks, [q] { return q->items.size() < q->length; })) return pdFALSE;
+  } else if (q->items.size() >= q->length && ticks) {
+    host_wait(ticks);
+  }
+  if (q->items.size() >= q->length) return pdFALSE;
+  const uint8_t *p = (const uint8_t*)item;
+  q->items.emplace_back(p, p + q->item_size);
+  if (s_threads) s_changed.notify_all();
+  return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t q, void *item, TickType_t ticks) {
+  std::unique_lock<std::mutex> lk(s_sync, std::defer_lock);
+  if (s_threads) {
+    lk.lock();
+    if (!block_until(lk, ticks, [q] { return !q->items.empty(); })) return pdFALSE;
+  } else if (q->items.empty() && ticks) {
+    host_wait(ticks);
+  }
+  if (q->items.empty()) return pdFALSE;
+  memcpy(item, q->items.front().data(), q->item_size);
+  q->items.pop_front();
+  if (s_threads) s_changed.notify_all();
+  return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t q) {
+  std::unique_lock<std::mutex> lk(s_sync, std::defer_lock);
+  if (s_threads) lk.lock();
+  return q->items.size();
+}
+
+// ---------- event groups ----------
+// sets[b] counts the times bit b was set, so a waiter also sees a bit that
+// was set and cleared again (a pulse) while it slept, as FreeRTOS does.
+struct HostEventGroup {
+  EventBits_t bits;
+  uint64_t sets[32];
+};
+
+EventGroupHandle_t xEventGroupCreate() {
+  return new HostEventGroup{};
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits) {
+  std::unique_lock<std::mutex> lk(s_sync, std::defer_lock);
+  if (s_threads) lk.lock();
+  group->bits |= bits;
+  for (int b = 0; b < 32; ++b) {
+    if (bits & (1u << b)) group->sets[b]++;
+  }
+  if (s_threads) s_changed.notify_all();
+  return group->bits;
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits) {
+  std::unique_lock<std::mutex> lk(s_sync, std::defer_lock);
+  if (s_threads) lk.lock();
+  EventBits_t before = group->bits;
+  group->bits &= ~bits;
+  return before;
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, BaseType_t clear, BaseType_t all,
+                                TickType_t ticks) {
+  if (!s_threads) {
+    bool met = all ? (group->bits & bits) == bits : (group->bits & bits) != 0;
+    if (!met && ticks) host_wait(ticks);
+    EventBits_t now = group->bits;
+    if (clear) group->bits &= ~bits;
+    return now;
+  }
+  std::unique_lock<std::mutex> lk(s_sync);
+  uint64_t start[32];
+  memcpy(start, group->sets, sizeof(start));
+  EventBits_t seen = 0;   // bits that are set now or were set during the wait
+  auto met = [&] {
+    seen = group->bits;
+    for (int b = 0; b < 32; ++b) {
+      if (group->sets[b] != start[b]) seen |= 1u << b;
+    }
+    return all ? (seen & bits) == bits : (seen & bits) != 0;
+  };
+  bool ok = block_until(lk, ticks, met);
+  if (ok && clear) group->bits &= ~bits;
+  return ok ? seen | group->bits : group->bits;
+}
+
+// ---------- camera ----------
+const resolution_info_t resolution[] = {
+  { 96, 96 }, { 160, 120 }, { 176, 144 }, { 240, 176 }, { 240, 240 }, { 320, 240 }, { 400, 296 },
+  { 480, 320 }, { 640, 480 }, { 800, 600 }, { 1024, 768 }, { 1280, 720 }, { 1280, 1024 }, { 1600, 1200 },
+};
+
+// ---------- modules not under test ----------
+// Weak, failing versions of what the modules call in each other and in the
+// camera driver; a test that builds the real module (or needs a working
+// fake) defines its own, which wins at link time.
+#define HOST_WEAK __attribute__((weak))
+
+HOST_WEAK camera_fb_t* esp_camera_fb_get() { return NULL; }
+HOST_WEAK void esp_camera_fb_return(camera_fb_t*) {}
+HOST_WEAK bool frame2jpg_cb(camera_fb_t*, uint8_t, jpg_out_cb, void*) { return false; }
+HOST_WEAK bool fmt2jpg_cb(uint8_t*, size_t, uint16_t, uint16_t, pixformat_t, uint8_t, jpg_out_cb, void*) { return false; }
+
+HOST_WEAK SharedFrame* fbc_waitNewer(uint32_t, uint32_t) { return NULL; }
+HOST_WEAK void fbc_release(SharedFrame*) {}
+HOST_WEAK bool fbc_getTier(SharedFrame*, FrameTier, const uint8_t**, size_t*) { return false; }
+
+HOST_WEAK bool jpgscale_luma(const uint8_t*, size_t, jpg_scale_t, uint8_t*, size_t, uint16_t*, uint16_t*) {
+  return false;
+}
+HOST_WEAK bool jpgscale_downscale(const uint8_t*, size_t, jpg_scale_t, uint8_t, jpg_out_cb, void*) {
+  return false;
+}
+
+HOST_WEAK esp_err_t httpd_req_get_url_query_str(httpd_req_t*, char*, size_t) { return ESP_FAIL; }
+HOST_WEAK esp_err_t httpd_query_key_value(const char*, const char*, char*, size_t) { return ESP_FAIL; }
+HOST_WEAK int httpd_req_to_sockfd(httpd_req_t*) { return -1; }
+HOST_WEAK esp_err_t httpd_req_async_handler_begin(httpd_req_t*, httpd_req_t**) { return ESP_FAIL; }
+HOST_WEAK esp_err_t httpd_req_async_handler_complete(httpd_req_t*) { return ESP_OK; }
+HOST_WEAK esp_err_t httpd_sess_trigger_close(httpd_handle_t, int) { return ESP_OK; }
+HOST_WEAK ssize_t lwip_writev(int, const struct iovec*, int) {
+  errno = EIO;
+  return -1;
+}
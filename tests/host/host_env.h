@@ -0,0 +1,63 @@
+#ifndef HOST_ENV_H
+#define HOST_ENV_H
+
+#include <Arduino.h>
+
+// Host stand-ins for the ESP-IDF, FreeRTOS and Arduino calls the sketch's
+// modules make, so their logic builds and runs on a PC. Tests run single
+// threaded: tasks are recorded but never started, and a wait that would
+// block moves the clock instead. Benchmarks can run the tasks for real
+// (host_runTasks()).
+//
+// The clock is fake by default: it starts at 0 and moves only through
+// host_advanceUs() and the waits. Benchmarks switch to the real monotonic
+// clock with host_useRealClock().
+
+void host_useRealClock();
+void host_setTimeUs(int64_t t);
+void host_advanceUs(int64_t us);
+
+// Called by every wait that would block (vTaskDelay, event group waits,
+// semaphore and queue timeouts) with its timeout in ms; returns how many ms
+// pass before it ends. A test sets it to play the other task's part, e.g.
+// publish a frame; NULL waits out the whole timeout.
+extern uint32_t (*host_onWait)(uint32_t timeout_ms);
+
+// Tasks created so far (none of them run unless host_runTasks() was called).
+extern int host_tasksCreated;
+
+// Benchmarks that need the modules' tasks: switch to the real clock and run
+// every task created from now on as a thread. Semaphores, queues, event
+// groups and delays then block for real; host_onWait is not used.
+void host_runTasks();
+
+// End a threaded run without tearing down state the tasks still use.
+void host_exit(int status) __attribute__((noreturn));
+
+// ---------- checks ----------
+extern int host_checks;
+extern int host_failures;
+
+#define CHECK(cond) \
+  do { \
+    host_checks++; \
+    if (!(cond)) { \
+      host_failures++; \
+      printf("%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond); \
+    } \
+  } while (0)
+
+#define CHECK_EQ(a, b) \
+  do { \
+    host_checks++; \
+    long long va_ = (long long)(a), vb_ = (long long)(b); \
+    if (va_ != vb_) { \
+      host_failures++; \
+      printf("%s:%d: CHECK failed: %s == %s (%lld != %lld)\n", __FILE__, __LINE__, #a, #b, va_, vb_); \
+    } \
+  } while (0)
+
+// Print the summary; the exit status of a test program.
+int host_report(const char *name);
+
+#endif // HOST_ENV_H
@@ -0,0 +1,117 @@
+#include "host_jpeg.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include <algorithm>
+#include <jpeglib.h>
+
+void hostjpg_scene(int n, int w, int h, const std::vector<int> &moving, std::vector<uint8_t> *grey) {
+  grey->resize((size_t)w * h);
+  uint32_t seed = 0x9E3779B9u * (uint32_t)(n + 1);
+  for (int y = 0; y < h; ++y) {
+    for (int x = 0; x < w; ++x) {
+      seed = seed * 1664525u + 1013904223u;
+      int noise = (int)(seed >> 29) - 4;   // -4..3, mostly lost in the quantiser
+      int v = 60 + x * 120 / w + y * 40 / h + noise / 2;
+      (*grey)[(size_t)y * w + x] = (uint8_t)std::min(255, std::max(0, v));
+    }
+  }
+  if (std::find(moving.begin(), moving.end(), n) == moving.end()) return;
+  int side = w / 8;
+  int x0 = (n * w / 16) % (w - side);
+  int y0 = h / 3;
+  for (int y = y0; y < y0 + side && y < h; ++y) memset(&(*grey)[(size_t)y * w + x0], 20, side);
+}
+
+bool hostjpg_encode(const uint8_t *grey, int w, int h, int quality, std::vector<uint8_t> *jpg) {
+  jpeg_compress_struct c;
+  jpeg_error_mgr err;
+  c.err = jpeg_std_error(&err);
+  jpeg_create_compress(&c);
+  unsigned char *mem = NULL;
+  unsigned long mem_len = 0;
+  jpeg_mem_dest(&c, &mem, &mem_len);
+  c.image_width = w;
+  c.image_height = h;
+  c.input_components = 1;
+  c.in_color_space = JCS_GRAYSCALE;
+  jpeg_set_defaults(&c);
+  jpeg_set_quality(&c, quality, TRUE);
+  jpeg_start_compress(&c, TRUE);
+  while (c.next_scanline < c.image_height) {
+    JSAMPROW row = (JSAMPROW)(grey + (size_t)c.next_scanline * w);
+    jpeg_write_scanlines(&c, &row, 1);
+  }
+  jpeg_finish_compress(&c);
+  jpeg_destroy_compress(&c);
+  jpg->assign(mem, mem + mem_len);
+  free(mem);
+  return true;
+}
+
+struct HostJpegError {
+  jpeg_error_mgr mgr;
+  jmp_buf jump;
+};
+
+static void host_error_exit(j_common_ptr cinfo) {
+  longjmp(((HostJpegError*)cinfo->err)->jump, 1);
+}
+
+bool hostjpg_luma8(const uint8_t *jpg, size_t len, uint8_t *out, size_t stride, uint16_t max_w, uint16_t max_h,
+                   uint16_t *w, uint16_t *h) {
+  jpeg_decompress_struct d;
+  HostJpegError err;
+  d.err = jpeg_std_error(&err.mgr);
+  err.mgr.error_exit = host_error_exit;
+  err.mgr.output_message = [](j_common_ptr) {};
+  jpeg_create_decompress(&d);
+  if (setjmp(err.jump)) {
+    jpeg_destroy_decompress(&d);
+    return false;
+  }
+  jpeg_mem_src(&d, (unsigned char*)jpg, len);
+  jpeg_read_header(&d, TRUE);
+  d.scale_num = 1;
+  d.scale_denom = 8;
+  d.out_color_space = JCS_GRAYSCALE;
+  jpeg_start_decompress(&d);
+  bool ok = d.output_width <= max_w && d.output_height <= max_h;
+  if (ok) {
+    while (d.output_scanline < d.output_height) {
+      JSAMPROW row = out + (size_t)d.output_scanline * stride;
+      jpeg_read_scanlines(&d, &row, 1);
+    }
+    *w = d.output_width;
+    *h = d.output_height;
+    jpeg_finish_decompress(&d);
+  }
+  jpeg_destroy_decompress(&d);
+  return ok;
+}
+
+void hostjpg_split(const std::vector<uint8_t> &mjpeg, std::vector<std::pair<size_t, size_t>> *frames) {
+  frames->clear();
+  size_t n = mjpeg.size();
+  for (size_t i = 0; i + 1 < n; ++i) {
+    if (mjpeg[i] != 0xFF || mjpeg[i + 1] != 0xD8) continue;
+    // EOI does not occur inside entropy-coded data (0xFF is stuffed there)
+    size_t j = i + 2;
+    while (j + 1 < n && !(mjpeg[j] == 0xFF && mjpeg[j + 1] == 0xD9)) ++j;
+    if (j + 1 >= n) break;
+    frames->push_back({ i, j + 2 - i });
+    i = j + 1;
+  }
+}
+
+bool hostjpg_readFile(const char *path, std::vector<uint8_t> *data) {
+  FILE *f = fopen(path, "rb");
+  if (!f) return false;
+  uint8_t buf[65536];
+  size_t n;
+  data->clear();
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0) data->insert(data->end(), buf, buf + n);
+  fclose(f);
+  return true;
+}
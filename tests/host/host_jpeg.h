@@ -0,0 +1,30 @@
+#ifndef HOST_JPEG_H
+#define HOST_JPEG_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+// libjpeg helpers for the host benchmarks: a synthetic scene to encode when
+// no recording is given, decoding at 1/8 scale into a luma plane (what
+// jpgscale_luma() does on the device with TJpgDec), and splitting an MJPEG
+// recording into its frames.
+
+// Frame n of a w x h grey scene: a fixed gradient with +-2 levels of sensor
+// noise, and a dark 1/8-width square crossing it during the given frames.
+void hostjpg_scene(int n, int w, int h, const std::vector<int> &moving, std::vector<uint8_t> *grey);
+
+bool hostjpg_encode(const uint8_t *grey, int w, int h, int quality, std::vector<uint8_t> *jpg);
+
+// Decode at 1/8 scale into out (rows stride bytes apart, at most max_w x
+// max_h). Fails on a corrupt frame instead of exiting.
+bool hostjpg_luma8(const uint8_t *jpg, size_t len, uint8_t *out, size_t stride, uint16_t max_w, uint16_t max_h,
+                   uint16_t *w, uint16_t *h);
+
+// Offsets and lengths of the JPEGs (SOI to EOI) in an MJPEG recording, with
+// or without multipart headers between them.
+void hostjpg_split(const std::vector<uint8_t> &mjpeg, std::vector<std::pair<size_t, size_t>> *frames);
+
+bool hostjpg_readFile(const char *path, std::vector<uint8_t> *data);
+
+#endif // HOST_JPEG_H
@@ -0,0 +1,122 @@
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+// The parts of the Arduino core the sketch's modules use, for host builds.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <algorithm>
+#include <string>
+#include <type_traits>
+
+// The core pulls these in for every sketch.
+#include "esp_heap_caps.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+// Like the core's macros: mixed argument types compare in their common type.
+template <class A, class B> static inline typename std::common_type<A, B>::type min(A a, B b) { return b < a ? b : a; }
+template <class A, class B> static inline typename std::common_type<A, B>::type max(A a, B b) { return a < b ? b : a; }
+
+// On the host clock: delay() is vTaskDelay(), millis() reads esp_timer.
+void delay(uint32_t ms);
+unsigned long millis();
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+#if defined(__GLIBC__) && (__GLIBC__ < 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ < 38))
+static inline size_t strlcpy(char *dst, const char *src, size_t size) {
+  size_t len = strlen(src);
+  if (size) {
+    size_t n = len < size - 1 ? len : size - 1;
+    memcpy(dst, src, n);
+    dst[n] = '\0';
+  }
+  return len;
+}
+#endif
+
+// The core's String, over std::string: the members the sketch uses.
+class String {
+ public:
+  String() {}
+  String(const char *c) : s_(c ? c : "") {}
+  String(const std::string &c) : s_(c) {}
+  String(char c) : s_(1, c) {}
+  String(int v) : s_(std::to_string(v)) {}
+  String(unsigned v) : s_(std::to_string(v)) {}
+  String(long v) : s_(std::to_string(v)) {}
+  String(unsigned long v) : s_(std::to_string(v)) {}
+  String(long long v) : s_(std::to_string(v)) {}
+  String(unsigned long long v) : s_(std::to_string(v)) {}
+  String(float v) : String((double)v) {}
+  String(double v) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.2f", v);
+    s_ = buf;
+  }
+
+  const char* c_str() const { return s_.c_str(); }
+  unsigned length() const { return s_.size(); }
+  bool reserve(unsigned n) { s_.reserve(n); return true; }
+  char operator[](unsigned i) const { return i < s_.size() ? s_[i] : 0; }
+  void setCharAt(unsigned i, char c) { if (i < s_.size()) s_[i] = c; }
+  bool startsWith(const String &p) const { return s_.compare(0, p.s_.size(), p.s_) == 0; }
+  bool endsWith(const String &p) const {
+    return s_.size() >= p.s_.size() && s_.compare(s_.size() - p.s_.size(), p.s_.size(), p.s_) == 0;
+  }
+  int indexOf(char c) const { return found(s_.find(c)); }
+  int indexOf(const String &p) const { return found(s_.find(p.s_)); }
+  int lastIndexOf(char c) const { return found(s_.rfind(c)); }
+  String substring(unsigned from) const { return from < s_.size() ? String(s_.substr(from)) : String(); }
+  String substring(unsigned from, unsigned to) const {
+    return from < to && from < s_.size() ? String(s_.substr(from, to - from)) : String();
+  }
+  void toLowerCase() { for (char &c : s_) c = (char)tolower((unsigned char)c); }
+  void replace(const String &from, const String &to) {
+    if (from.s_.empty()) return;
+    for (size_t i = s_.find(from.s_); i != std::string::npos; i = s_.find(from.s_, i + to.s_.size())) {
+      s_.replace(i, from.s_.size(), to.s_);
+    }
+  }
+  long toInt() const { return atol(s_.c_str()); }
+  bool equals(const String &o) const { return s_ == o.s_; }
+
+  String& operator+=(const String &o) { s_ += o.s_; return *this; }
+  String& operator+=(const char *o) { s_ += o; return *this; }
+  String& operator+=(char o) { s_ += o; return *this; }
+  bool operator==(const String &o) const { return s_ == o.s_; }
+  bool operator==(const char *o) const { return s_ == o; }
+  bool operator!=(const String &o) const { return s_ != o.s_; }
+  bool operator<(const String &o) const { return s_ < o.s_; }
+  friend String operator+(const String &a, const String &b) { return String(a.s_ + b.s_); }
+  friend String operator+(const String &a, const char *b) { return String(a.s_ + b); }
+  friend String operator+(const char *a, const String &b) { return String(a + b.s_); }
+
+ private:
+  static int found(size_t pos) { return pos == std::string::npos ? -1 : (int)pos; }
+  std::string s_;
+};
+
+// The board has PSRAM in the host builds.
+static inline bool psramFound() { return true; }
+
+// Serial output goes to stdout unless host_quiet is set.
+extern bool host_quiet;
+
+struct HostSerial {
+  int printf(const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+  void begin(unsigned long baud) { (void)baud; }
+  void setDebugOutput(bool on) { (void)on; }
+  void print(const char *s) { if (!host_quiet) fputs(s, stdout); }
+  void print(const String &s) { print(s.c_str()); }
+  void println(const char *s = "") { if (!host_quiet) puts(s); }
+  void println(const String &s) { println(s.c_str()); }
+};
+extern HostSerial Serial;
+
+#endif // HOST_ARDUINO_H
@@ -0,0 +1,12 @@
+#ifndef HOST_ESPMDNS_H
+#define HOST_ESPMDNS_H
+
+// Declarations only, like WiFi.h.
+
+struct HostMDNS {
+  bool begin(const char *hostname);
+  void addService(const char *service, const char *proto, int port);
+};
+extern HostMDNS MDNS;
+
+#endif // HOST_ESPMDNS_H
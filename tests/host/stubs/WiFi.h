@@ -0,0 +1,20 @@
+#ifndef HOST_WIFI_H
+#define HOST_WIFI_H
+
+#include <Arduino.h>
+
+// Declarations only: the host builds of the sketch never bring up a network.
+
+#define WL_CONNECTED 3
+
+struct HostWiFi {
+  void begin(const char *ssid, const char *password);
+  int status();
+  void disconnect();
+  const char* localIP();
+};
+extern HostWiFi WiFi;
+
+void configTime(long gmt_offset, int dst_offset, const char *server);
+
+#endif // HOST_WIFI_H
@@ -0,0 +1,6 @@
+#ifndef HOST_DRIVER_SDMMC_DEFS_H
+#define HOST_DRIVER_SDMMC_DEFS_H
+
+// The SD/MMC types the sketch uses are in esp_vfs_fat.h.
+
+#endif // HOST_DRIVER_SDMMC_DEFS_H
@@ -0,0 +1,19 @@
+#ifndef HOST_ESP_TIMER_H
+#define HOST_ESP_TIMER_H
+
+#include <stdint.h>
+
+typedef int esp_err_t;
+#define ESP_OK 0
+#define ESP_FAIL -1
+#define ESP_ERR_NO_MEM 0x101
+#define ESP_ERR_INVALID_ARG 0x102
+#define ESP_ERR_INVALID_STATE 0x103
+
+const char* esp_err_to_name(esp_err_t err);
+
+// Microseconds on the host clock (host_env.h): fake unless a benchmark
+// switched to the real one.
+int64_t esp_timer_get_time();
+
+#endif // HOST_ESP_TIMER_H
@@ -0,0 +1,35 @@
+#ifndef HOST_ESP_VFS_FAT_H
+#define HOST_ESP_VFS_FAT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_timer.h"
+
+// The SD/MMC driver types and the FAT mount call, declarations only: host
+// builds of the sketch use a directory on the PC instead of a card.
+
+typedef struct {
+  int slot;
+} sdmmc_host_t;
+
+typedef struct {
+  int width;
+} sdmmc_slot_config_t;
+
+typedef struct {
+  int size;
+} sdmmc_card_t;
+
+typedef struct {
+  bool format_if_mount_failed;
+  int max_files;
+  size_t allocation_unit_size;
+} esp_vfs_fat_sdmmc_mount_config_t;
+
+#define SDMMC_HOST_DEFAULT() sdmmc_host_t{}
+#define SDMMC_SLOT_CONFIG_DEFAULT() sdmmc_slot_config_t{}
+
+esp_err_t esp_vfs_fat_sdmmc_mount(const char *base_path, const sdmmc_host_t *host, const void *slot_config,
+                                  const esp_vfs_fat_sdmmc_mount_config_t *mount_config, sdmmc_card_t **card);
+
+#endif // HOST_ESP_VFS_FAT_H
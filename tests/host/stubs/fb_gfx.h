@@ -0,0 +1,6 @@
+#ifndef HOST_FB_GFX_H
+#define HOST_FB_GFX_H
+
+// Included by the sketch, nothing used from it.
+
+#endif // HOST_FB_GFX_H
@@ -0,0 +1,39 @@
+#ifndef HOST_FREERTOS_H
+#define HOST_FREERTOS_H
+
+#include <stdint.h>
+
+// FreeRTOS for host runs: one tick is 1 ms. Single threaded (tests), every
+// wait moves the host clock; with host_runTasks() (benchmarks) tasks are
+// threads and waits block for real (host_env.h).
+
+typedef int BaseType_t;
+typedef unsigned UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define pdFAIL 0
+#define portMAX_DELAY 0xFFFFFFFFu
+#define portTICK_PERIOD_MS 1
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+
+typedef struct {
+  int unused;
+} portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED { 0 }
+
+// one lock for every critical section, as on a single core
+void host_enterCritical();
+void host_exitCritical();
+static inline void taskENTER_CRITICAL(portMUX_TYPE *mux) {
+  (void)mux;
+  host_enterCritical();
+}
+static inline void taskEXIT_CRITICAL(portMUX_TYPE *mux) {
+  (void)mux;
+  host_exitCritical();
+}
+
+#endif // HOST_FREERTOS_H
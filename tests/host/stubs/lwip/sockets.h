@@ -0,0 +1,10 @@
+#ifndef HOST_LWIP_SOCKETS_H
+#define HOST_LWIP_SOCKETS_H
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+// host_env.cpp's version fails with EIO; a test that sends defines its own.
+ssize_t lwip_writev(int s, const struct iovec *iov, int iovcnt);
+
+#endif // HOST_LWIP_SOCKETS_H
@@ -0,0 +1,6 @@
+#ifndef HOST_SDMMC_CMD_H
+#define HOST_SDMMC_CMD_H
+
+// The SD/MMC types the sketch uses are in esp_vfs_fat.h.
+
+#endif // HOST_SDMMC_CMD_H
@@ -0,0 +1,8 @@
+#ifndef HOST_SECRETS_34_H
+#define HOST_SECRETS_34_H
+
+// Placeholders for the untracked credentials header.
+#define WIFI_SSID_34 "host"
+#define WIFI_PASSWORD_34 "host"
+
+#endif // HOST_SECRETS_34_H
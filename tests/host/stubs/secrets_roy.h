@@ -0,0 +1,8 @@
+#ifndef HOST_SECRETS_ROY_H
+#define HOST_SECRETS_ROY_H
+
+// Placeholders for the untracked credentials header.
+#define WIFI_SSID_79 "host"
+#define WIFI_PASSWORD_79 "host"
+
+#endif // HOST_SECRETS_ROY_H
@@ -0,0 +1,6 @@
+#ifndef HOST_SOC_RTC_CNTL_REG_H
+#define HOST_SOC_RTC_CNTL_REG_H
+
+#define RTC_CNTL_BROWN_OUT_REG 0
+
+#endif // HOST_SOC_RTC_CNTL_REG_H
@@ -0,0 +1,7 @@
+#ifndef HOST_SOC_SOC_H
+#define HOST_SOC_SOC_H
+
+// Register writes do nothing on the host.
+#define WRITE_PERI_REG(addr, val) ((void)(addr), (void)(val))
+
+#endif // HOST_SOC_SOC_H
@@ -0,0 +1,144 @@
+// Frame freshness by sequence and capture time: fbc_waitNewer() and
+// fbc_waitCapturedAfter() on the fake clock, with the producer's part played
+// by host_onWait publishing frames while a viewer waits.
+
+#include "host_env.h"
+#include "../../frame_broadcaster.cpp"
+#include <deque>
+
+// ---------- producer ----------
+struct Publish {
+  uint32_t after_ms;    // into the wait
+  int64_t captured_us;  // absolute capture time
+};
+static std::deque<Publish> s_script;
+static int s_waits = 0;
+
+static SharedFrame* produce(int64_t captured_us) {
+  SharedFrame *slot = claim_slot();
+  if (!slot) return NULL;
+  slot->timestamp_us = captured_us;
+  publish_slot(slot);
+  return slot;
+}
+
+// publishes the next scripted frame part way into the wait, which then ends
+static uint32_t producer_wait(uint32_t timeout_ms) {
+  s_waits++;
+  if (s_script.empty() || s_script.front().after_ms > timeout_ms) return timeout_ms;
+  Publish p = s_script.front();
+  s_script.pop_front();
+  produce(p.captured_us);
+  return p.after_ms;
+}
+
+static void check_unreferenced() {
+  for (int i = 0; i < FBC_SLOT_COUNT; ++i) CHECK_EQ(s_slots[i].refs, 0);
+}
+
+static void test_wait_newer() {
+  host_setTimeUs(0);
+  // nothing captured yet: the whole timeout, then NULL
+  CHECK(fbc_waitNewer(0, 500) == NULL);
+  CHECK(esp_timer_get_time() >= 500000 && esp_timer_get_time() <= 502000);
+
+  // a frame published 40 ms into the wait ends it
+  host_setTimeUs(1000000);
+  s_script = { { 40, 1030000 } };
+  SharedFrame *f = fbc_waitNewer(0, 1000);
+  CHECK(f != NULL);
+  CHECK_EQ(f->seq, 1);
+  CHECK_EQ(esp_timer_get_time(), 1040000);
+  CHECK_EQ(f->refs, 1);
+
+  // a newer frame is already there: no wait
+  s_waits = 0;
+  fbc_release(f);
+  f = fbc_waitNewer(0, 1000);
+  CHECK(f != NULL && f->seq == 1);
+  CHECK_EQ(s_waits, 0);
+  fbc_release(f);
+
+  // the newest frame was already sent: wait for the next, and skip straight
+  // to the newest when several went by
+  produce(1050000);
+  produce(1060000);
+  f = fbc_waitNewer(1, 1000);
+  CHECK(f != NULL && f->seq == 3);
+  CHECK_EQ(s_waits, 0);
+  fbc_release(f);
+  s_script = { { 40, 1090000 } };
+  f = fbc_waitNewer(3, 1000);
+  CHECK(f != NULL && f->seq == 4);
+  CHECK_EQ(s_waits, 1);
+  fbc_release(f);
+  check_unreferenced();
+
+  // the sequence wraps after 2^32 frames; newer is by difference, not size
+  s_seq = 0xFFFFFFFEu;
+  SharedFrame *last = produce(2000000);
+  CHECK_EQ(last->seq, 0xFFFFFFFFu);
+  f = fbc_waitNewer(0xFFFFFFFEu, 1000);
+  CHECK(f == last);
+  fbc_release(f);
+  SharedFrame *wrapped = produce(2040000);
+  CHECK_EQ(wrapped->seq, 0);
+  s_waits = 0;
+  f = fbc_waitNewer(0xFFFFFFFFu, 1000);
+  CHECK(f == wrapped);
+  CHECK_EQ(s_waits, 0);
+  fbc_release(f);
+  host_setTimeUs(3000000);
+  CHECK(fbc_waitNewer(0, 200) == NULL);   // seq 0 is the one just sent
+  CHECK(esp_timer_get_time() >= 3200000);
+  check_unreferenced();
+}
+
+static void test_wait_captured_after() {
+  // /capture asks at t0 = 5 s; the latest frame was captured before that
+  host_setTimeUs(5000000);
+  produce(4950000);
+  int64_t t0 = esp_timer_get_time();
+  // the frame already in flight at t0 (captured 10 ms before it) is not
+  // fresh enough; the one captured after it is
+  s_script = { { 30, 4990000 }, { 40, 5060000 } };
+  SharedFrame *f = fbc_waitCapturedAfter(t0, 2000);
+  CHECK(f != NULL);
+  CHECK(f && f->timestamp_us > t0);
+  CHECK_EQ(f ? f->timestamp_us : 0, 5060000);
+  CHECK_EQ(esp_timer_get_time(), 5070000);   // about one frame interval, no fixed sleeps
+  CHECK_EQ(f ? f->refs : 0, 1);
+  fbc_release(f);
+  check_unreferenced();
+
+  // already fresh: returned at once
+  s_waits = 0;
+  f = fbc_waitCapturedAfter(5000000, 2000);
+  CHECK(f != NULL && f->timestamp_us == 5060000);
+  CHECK_EQ(s_waits, 0);
+  fbc_release(f);
+
+  // the producer keeps publishing frames captured too early (a stuck clock):
+  // give up at the timeout with nothing held
+  host_setTimeUs(6000000);
+  s_script.clear();
+  for (int i = 1; i <= 20; ++i) s_script.push_back({ 40, 5500000 });
+  CHECK(fbc_waitCapturedAfter(6000000, 300) == NULL);
+  CHECK(esp_timer_get_time() >= 6300000 && esp_timer_get_time() <= 6342000);
+  check_unreferenced();
+
+  // no producer at all
+  s_script.clear();
+  host_setTimeUs(7000000);
+  CHECK(fbc_waitCapturedAfter(7000000, 250) == NULL);
+  CHECK(esp_timer_get_time() >= 7250000 && esp_timer_get_time() <= 7252000);
+}
+
+int main() {
+  host_quiet = true;
+  s_events = xEventGroupCreate();
+  host_onWait = producer_wait;
+  test_wait_newer();
+  test_wait_captured_after();
+  return host_report("test_frame_freshness");
+}
@@ -0,0 +1,93 @@
+// Slot life cycle of the frame broadcaster: the producer claims the lowest
+// free slot, publishing makes it latest and drops the producer's reference,
+// viewers' references keep a slot from being refilled, and a frame is
+// dropped when every slot is latest or still held.
+
+#include "host_env.h"
+#include "../../frame_broadcaster.cpp"
+
+// what producer_task does with a filled slot
+static SharedFrame* produce(int64_t captured_us) {
+  SharedFrame *slot = claim_slot();
+  if (!slot) return NULL;
+  CHECK_EQ(slot->refs, 1);
+  slot->timestamp_us = captured_us;
+  publish_slot(slot);
+  return slot;
+}
+
+int main() {
+  host_quiet = true;
+  s_events = xEventGroupCreate();
+
+  CHECK(fbc_acquireLatest() == NULL);
+
+  // one viewer that always lets go before the next frame: two slots alternate
+  SharedFrame *a = produce(1000);
+  CHECK(a == &s_slots[0]);
+  CHECK(s_latest == a);
+  CHECK_EQ(a->seq, 1);
+  CHECK_EQ(a->refs, 0);
+  SharedFrame *f = fbc_acquireLatest();
+  CHECK(f == a);
+  CHECK_EQ(a->refs, 1);
+  fbc_release(f);
+  CHECK_EQ(a->refs, 0);
+  SharedFrame *b = produce(2000);
+  CHECK(b == &s_slots[1]);
+  CHECK_EQ(b->seq, 2);
+  CHECK(produce(3000) == &s_slots[0]);
+  CHECK(produce(4000) == &s_slots[1]);
+  CHECK_EQ(fbc_framesPublished(), 4);
+
+  // a slow viewer holds slot 1; the producer skips it, and frees it only
+  // once the viewer has released it
+  SharedFrame *held1 = fbc_acquireLatest();
+  CHECK(held1 == &s_slots[1]);
+  CHECK(produce(5000) == &s_slots[0]);
+  CHECK(produce(6000) == &s_slots[2]);
+  CHECK(produce(7000) == &s_slots[0]);
+  CHECK_EQ(held1->seq, 4);                 // not refilled under the viewer
+  CHECK_EQ(held1->timestamp_us, 4000);
+
+  // two viewers on the same frame: both references count
+  SharedFrame *held0 = fbc_acquireLatest();
+  SharedFrame *again = fbc_acquireLatest();
+  CHECK(held0 == again);
+  CHECK_EQ(held0->refs, 2);
+  CHECK(produce(8000) == &s_slots[2]);
+  fbc_release(again);
+  CHECK_EQ(held0->refs, 1);
+
+  // slots 0 and 1 held, 2 latest: 3 is the last free one
+  CHECK(produce(9000) == &s_slots[3]);
+  SharedFrame *held3 = fbc_acquireLatest();
+  CHECK(produce(10000) == &s_slots[2]);
+  // every slot is latest or held: the frame is dropped, nothing is touched
+  uint32_t seq = s_seq;
+  CHECK(claim_slot() == NULL);
+  CHECK_EQ(s_seq, seq);
+  CHECK(s_latest == &s_slots[2]);
+
+  // releasing frees the lowest slot first
+  fbc_release(held3);
+  fbc_release(held1);
+  CHECK(produce(11000) == &s_slots[1]);
+  fbc_release(held0);
+  CHECK(produce(12000) == &s_slots[0]);
+  for (int i = 0; i < FBC_SLOT_COUNT; ++i) CHECK_EQ(s_slots[i].refs, 0);
+
+  // a failed fill hands the claim back
+  SharedFrame *slot = claim_slot();
+  CHECK(slot == &s_slots[1]);
+  unclaim_slot(slot);
+  CHECK_EQ(slot->refs, 0);
+  CHECK(claim_slot() == slot);
+  unclaim_slot(slot);
+
+  // a stray release never wraps the count
+  fbc_release(&s_slots[3]);
+  CHECK_EQ(s_slots[3].refs, 0);
+  fbc_release(NULL);
+  return host_report("test_frame_slots");
+}
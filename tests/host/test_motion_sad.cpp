@@ -0,0 +1,61 @@
+// motion_blockSad8x8() against a plain per-pixel SAD: random blocks,
+// extremes and every stride the detector can use.
+
+#include "host_env.h"
+#include "motion_detector.h"
+
+static uint32_t sad_reference(const uint8_t *a, const uint8_t *b, size_t stride) {
+  uint32_t sum = 0;
+  for (int y = 0; y < MOTION_BLOCK; ++y) {
+    for (int x = 0; x < MOTION_BLOCK; ++x) sum += abs((int)a[y * stride + x] - (int)b[y * stride + x]);
+  }
+  return sum;
+}
+
+static uint32_t s_seed = 12345;
+
+static uint8_t next_byte() {
+  s_seed = s_seed * 1664525u + 1013904223u;
+  return (uint8_t)(s_seed >> 24);
+}
+
+int main() {
+  host_quiet = true;
+  // planes as the detector lays them out: word aligned, stride a multiple of 4
+  alignas(4) static uint8_t a[MOTION_BLOCK * 256];
+  alignas(4) static uint8_t b[MOTION_BLOCK * 256];
+
+  for (size_t stride = 8; stride <= 256; stride += 4) {
+    for (int round = 0; round < 200; ++round) {
+      // uniform noise, then pairs that differ only a little, as in a still scene
+      for (size_t i = 0; i < sizeof(a); ++i) {
+        a[i] = next_byte();
+        b[i] = round & 1 ? next_byte() : (uint8_t)constrain(a[i] + (int)(next_byte() % 9) - 4, 0, 255);
+      }
+      CHECK_EQ(motion_blockSad8x8(a, b, stride), sad_reference(a, b, stride));
+      CHECK_EQ(motion_blockSad8x8(b, a, stride), sad_reference(a, b, stride));
+    }
+  }
+
+  // extremes: every lane at its largest difference, in both directions
+  memset(a, 0, sizeof(a));
+  memset(b, 255, sizeof(b));
+  CHECK_EQ(motion_blockSad8x8(a, b, 8), 64 * 255);
+  CHECK_EQ(motion_blockSad8x8(b, a, 8), 64 * 255);
+  CHECK_EQ(motion_blockSad8x8(a, a, 8), 0);
+  for (size_t i = 0; i < sizeof(a); ++i) {
+    a[i] = i & 1 ? 255 : 0;
+    b[i] = i & 1 ? 0 : 255;
+  }
+  CHECK_EQ(motion_blockSad8x8(a, b, 16), 64 * 255);
+
+  // equal bytes next to a 255 step: the lane borrow trick at its boundary
+  for (int v = 0; v < 256; ++v) {
+    for (size_t i = 0; i < sizeof(a); ++i) {
+      a[i] = (uint8_t)v;
+      b[i] = i % 3 ? (uint8_t)v : (uint8_t)(255 - v);
+    }
+    CHECK_EQ(motion_blockSad8x8(a, b, 32), sad_reference(a, b, 32));
+  }
+  return host_report("test_motion_sad");
+}
@@ -0,0 +1,97 @@
+// send_iov(): one multipart frame (part header, JPEG, boundary) through a
+// fake socket that takes a few bytes at a time, is interrupted, or times out.
+// Every byte must leave once and in order.
+
+#include "host_env.h"
+#include "../../stream_sessions.cpp"
+#include <limits.h>
+#include <string>
+#include <vector>
+
+// ---------- socket ----------
+static std::string s_wire;
+static std::vector<ssize_t> s_script;   // per call: bytes accepted, or -errno
+static size_t s_call = 0;
+static ssize_t s_accept = SSIZE_MAX;    // after the script: accept up to this much per call
+
+ssize_t lwip_writev(int s, const struct iovec *iov, int iovcnt) {
+  (void)s;
+  ssize_t limit = s_call < s_script.size() ? s_script[s_call] : s_accept;
+  s_call++;
+  if (limit < 0) {
+    errno = (int)-limit;
+    return -1;
+  }
+  ssize_t n = 0;
+  for (int i = 0; i < iovcnt && n < limit; ++i) {
+    size_t take = std::min(iov[i].iov_len, (size_t)(limit - n));
+    s_wire.append((const char*)iov[i].iov_base, take);
+    n += take;
+  }
+  return n;
+}
+
+static std::string s_part, s_jpeg, s_boundary;
+
+static esp_err_t send_frame(const std::vector<ssize_t> &script, ssize_t accept) {
+  s_wire.clear();
+  s_script = script;
+  s_call = 0;
+  s_accept = accept;
+  struct iovec iov[3] = {
+    { (void*)s_part.data(), s_part.size() },
+    { (void*)s_jpeg.data(), s_jpeg.size() },
+    { (void*)s_boundary.data(), s_boundary.size() },
+  };
+  return send_iov(3, iov, 3);
+}
+
+int main() {
+  host_quiet = true;
+  for (int i = 0; i < 5000; ++i) s_jpeg += (char)(i * 7 + (i >> 8));
+  char part[64];
+  snprintf(part, sizeof(part), _STREAM_PART, (unsigned)s_jpeg.size());
+  s_part = part;
+  s_boundary = _STREAM_BOUNDARY;
+  const std::string whole = s_part + s_jpeg + s_boundary;
+
+  // everything in one call
+  CHECK_EQ(send_frame({}, SSIZE_MAX), ESP_OK);
+  CHECK(s_wire == whole);
+  CHECK_EQ(s_call, 1);
+
+  // partial writes of every size from one byte to past the part header,
+  // so a write ends inside, and exactly at the end of, each iovec
+  for (ssize_t step = 1; step <= (ssize_t)s_part.size() + 3; ++step) {
+    CHECK_EQ(send_frame({}, step), ESP_OK);
+    CHECK(s_wire == whole);
+  }
+  // ends exactly on the iovec boundaries
+  CHECK_EQ(send_frame({ (ssize_t)s_part.size(), (ssize_t)s_jpeg.size() }, SSIZE_MAX), ESP_OK);
+  CHECK(s_wire == whole);
+  CHECK_EQ(s_call, 3);
+  // lwIP's usual 5744-byte bites
+  CHECK_EQ(send_frame({}, 5744), ESP_OK);
+  CHECK(s_wire == whole);
+
+  // an interrupted call is retried and loses nothing
+  CHECK_EQ(send_frame({ 100, -EINTR, -EINTR, 2000 }, 1460), ESP_OK);
+  CHECK(s_wire == whole);
+
+  // a timed-out send drops the client at once instead of retrying
+  CHECK_EQ(send_frame({ 100, -EAGAIN }, SSIZE_MAX), ESP_FAIL);
+  CHECK_EQ(s_call, 2);
+  CHECK(s_wire == whole.substr(0, 100));
+  CHECK_EQ(send_frame({ -EWOULDBLOCK }, SSIZE_MAX), ESP_FAIL);
+  CHECK_EQ(s_call, 1);
+
+  // any other error ends the stream too
+  CHECK_EQ(send_frame({ 10, -ECONNRESET }, SSIZE_MAX), ESP_FAIL);
+  CHECK_EQ(s_call, 2);
+
+  // nothing to send
+  s_call = 0;
+  CHECK_EQ(send_iov(3, NULL, 0), ESP_OK);
+  CHECK_EQ(s_call, 0);
+  return host_report("test_stream_send");
+}
@@ -0,0 +1,240 @@
+// Stream pacing on the fake clock, ?fps= limits, the worker reservation in
+// strm_submit() (a request is only detached once a worker is free for it),
+// and a session falling back to full frames when its tier cannot be encoded.
+
+#include "host_env.h"
+#include "../../stream_sessions.cpp"
+#include <vector>
+
+// ---------- httpd ----------
+static const char *s_query = NULL;
+static int s_detached = 0;
+static int s_completed = 0;
+static bool s_detachFails = false;
+
+esp_err_t httpd_req_get_url_query_str(httpd_req_t *req, char *buf, size_t buf_len) {
+  (void)req;
+  if (!s_query) return ESP_FAIL;
+  strlcpy(buf, s_query, buf_len);
+  return ESP_OK;
+}
+
+esp_err_t httpd_query_key_value(const char *qry, const char *key, char *val, size_t val_size) {
+  size_t klen = strlen(key);
+  for (const char *p = qry; p && *p; p = strchr(p, '&') ? strchr(p, '&') + 1 : NULL) {
+    if (strncmp(p, key, klen) != 0 || p[klen] != '=') continue;
+    const char *v = p + klen + 1;
+    size_t n = strcspn(v, "&");
+    if (n >= val_size) n = val_size - 1;
+    memcpy(val, v, n);
+    val[n] = '\0';
+    return ESP_OK;
+  }
+  return ESP_FAIL;
+}
+
+esp_err_t httpd_req_async_handler_begin(httpd_req_t *req, httpd_req_t **out) {
+  if (s_detachFails) return ESP_ERR_NO_MEM;
+  *out = new httpd_req_t(*req);
+  s_detached++;
+  return ESP_OK;
+}
+
+esp_err_t httpd_req_async_handler_complete(httpd_req_t *req) {
+  delete req;
+  s_completed++;
+  return ESP_OK;
+}
+
+int httpd_req_to_sockfd(httpd_req_t *req) {
+  (void)req;
+  return 3;
+}
+
+// ---------- broadcaster and socket ----------
+static uint8_t s_jpeg[1000];
+static SharedFrame s_frame;
+static bool s_tierWorks = false;
+static int s_tierCalls = 0;
+static std::vector<size_t> s_sentLens;   // Content-Length of each part sent
+static size_t s_sendLimit = 0;          // parts before the client goes away
+
+SharedFrame* fbc_waitNewer(uint32_t after_seq, uint32_t timeout_ms) {
+  (void)timeout_ms;
+  s_frame.buf = s_jpeg;
+  s_frame.len = sizeof(s_jpeg);
+  s_frame.seq = after_seq + 1;
+  s_frame.fingerprint = s_frame.seq;
+  return &s_frame;
+}
+
+void fbc_release(SharedFrame *frame) {
+  (void)frame;
+}
+
+bool fbc_getTier(SharedFrame *frame, FrameTier tier, const uint8_t **buf, size_t *len) {
+  if (tier != FRAME_TIER_FULL) {
+    s_tierCalls++;
+    if (!s_tierWorks) return false;
+    *buf = frame->buf;
+    *len = 100;
+    return true;
+  }
+  *buf = frame->buf;
+  *len = frame->len;
+  return true;
+}
+
+ssize_t lwip_writev(int s, const struct iovec *iov, int iovcnt) {
+  (void)s;
+  unsigned len;
+  if (iovcnt == 3 && sscanf((const char*)iov[0].iov_base, "Content-Type: image/jpeg\r\nContent-Length: %u", &len) == 1) {
+    if (s_sentLens.size() == s_sendLimit) {
+      errno = ECONNRESET;
+      return -1;
+    }
+    s_sentLens.push_back(len);
+  }
+  ssize_t n = 0;
+  for (int i = 0; i < iovcnt; ++i) n += iov[i].iov_len;
+  return n;
+}
+
+static float parsed_fps(const char *query) {
+  httpd_req_t req = {};
+  StreamOptions opt;
+  s_query = query;
+  parse_stream_query(&req, &opt);
+  s_query = NULL;
+  return opt.fps;
+}
+
+static void test_pacer() {
+  StreamPacer p;
+  host_setTimeUs(5000000);
+  pacer_init(&p, 4.0f);
+  CHECK_EQ(p.period_us, 250000);
+
+  // the first frame goes out at once
+  pacer_wait(&p);
+  CHECK_EQ(esp_timer_get_time(), 5000000);
+  pacer_advance(&p);
+  CHECK_EQ(p.next_us, 5250000);
+
+  // send time is absorbed by the wait: deadlines stay on the 250 ms grid
+  for (int i = 1; i <= 8; ++i) {
+    host_advanceUs(30000 + i * 10000);   // sending
+    pacer_wait(&p);
+    CHECK_EQ(esp_timer_get_time(), 5000000 + i * 250000);
+    pacer_advance(&p);
+  }
+  CHECK_EQ(p.next_us, 7250000);
+
+  // a client that stalls for 600 ms skips the deadlines it missed instead of
+  // getting a burst of frames to catch up
+  host_setTimeUs(7250000);
+  pacer_wait(&p);
+  pacer_advance(&p);
+  host_advanceUs(600000);
+  pacer_wait(&p);
+  CHECK_EQ(esp_timer_get_time(), 7850000);   // already late: no wait
+  pacer_advance(&p);
+  CHECK_EQ(p.next_us, 8000000);              // next grid point after now
+  pacer_wait(&p);
+  CHECK_EQ(esp_timer_get_time(), 8000000);
+
+  // a frame finished exactly on the following deadline skips that one too
+  pacer_advance(&p);
+  CHECK_EQ(p.next_us, 8250000);
+  host_setTimeUs(8500000);
+  pacer_advance(&p);
+  CHECK_EQ(p.next_us, 8750000);
+
+  // waits under a tick are not worth a context switch
+  host_setTimeUs(8749500);
+  pacer_wait(&p);
+  CHECK_EQ(esp_timer_get_time(), 8749500);
+
+  // the limits
+  pacer_init(&p, STRM_MAX_FPS);
+  CHECK_EQ(p.period_us, 40000);
+  pacer_init(&p, STRM_MIN_FPS);
+  CHECK_EQ(p.period_us, 10000000);
+}
+
+static void test_query() {
+  CHECK(parsed_fps(NULL) == STRM_DEFAULT_FPS);
+  CHECK(parsed_fps("fps=10") == 10.0f);
+  CHECK(parsed_fps("size=qvga&fps=2.5") == 2.5f);
+  CHECK(parsed_fps("fps=100") == STRM_MAX_FPS);
+  CHECK(parsed_fps("fps=0") == STRM_MIN_FPS);
+  CHECK(parsed_fps("fps=-3") == STRM_MIN_FPS);
+  CHECK(parsed_fps("fps=nan") == STRM_MIN_FPS);
+  CHECK(parsed_fps("fps=abc") == STRM_MIN_FPS);
+}
+
+static void test_submit() {
+  httpd_req_t req = {};
+  CHECK_EQ(strm_submit(&req), ESP_ERR_INVALID_STATE);
+  CHECK(strm_begin());
+  CHECK_EQ(host_tasksCreated, STRM_MAX_SESSIONS);
+  CHECK_EQ(strm_activeCount(), 0);
+
+  // a failed detach hands the reserved worker back
+  s_detachFails = true;
+  CHECK_EQ(strm_submit(&req), ESP_ERR_NO_MEM);
+  s_detachFails = false;
+  CHECK_EQ(strm_activeCount(), 0);
+
+  for (int i = 0; i < STRM_MAX_SESSIONS; ++i) CHECK_EQ(strm_submit(&req), ESP_OK);
+  CHECK_EQ(strm_activeCount(), STRM_MAX_SESSIONS);
+  CHECK_EQ(s_detached, STRM_MAX_SESSIONS);
+  CHECK_EQ(uxQueueMessagesWaiting(s_queue), STRM_MAX_SESSIONS);
+
+  // every worker is taken: refused before the request is detached
+  CHECK_EQ(strm_submit(&req), ESP_ERR_NO_MEM);
+  CHECK_EQ(s_detached, STRM_MAX_SESSIONS);
+
+  // a worker finishing a session (what stream_worker does after run_session)
+  httpd_req_t *done = NULL;
+  CHECK(xQueueReceive(s_queue, &done, 0) == pdTRUE);
+  httpd_req_async_handler_complete(done);
+  xSemaphoreGive(s_idleWorkers);
+  CHECK_EQ(strm_activeCount(), STRM_MAX_SESSIONS - 1);
+  CHECK_EQ(strm_submit(&req), ESP_OK);
+  CHECK_EQ(strm_activeCount(), STRM_MAX_SESSIONS);
+}
+
+static void run_tier_session(const char *query, size_t parts) {
+  httpd_req_t req = {};
+  s_sentLens.clear();
+  s_sendLimit = parts;
+  s_tierCalls = 0;
+  s_query = query;
+  CHECK_EQ(run_session(&req), ESP_FAIL);   // ends when the client goes away
+  s_query = NULL;
+}
+
+static void test_tier_fallback() {
+  // a tier that encodes is sent as it is
+  s_tierWorks = true;
+  run_tier_session("size=qvga&fps=25", 5);
+  CHECK_EQ(s_sentLens.size(), 5);
+  for (size_t len : s_sentLens) CHECK_EQ(len, 100);
+
+  // one that never does: a few frames are skipped, then full frames go out
+  s_tierWorks = false;
+  run_tier_session("size=qvga&fps=25", 5);
+  CHECK_EQ(s_tierCalls, STRM_TIER_MAX_FAILURES);
+  CHECK_EQ(s_sentLens.size(), 5);
+  for (size_t len : s_sentLens) CHECK_EQ(len, sizeof(s_jpeg));
+}
+
+int main() {
+  host_quiet = true;
+  test_pacer();
+  test_query();
+  test_submit();
+  test_tier_fallback();
+  return host_report("test_stream_sessions");
+}